@@ -0,0 +1,407 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Benchmark.cpp
+//
+//      Implementation of CBenchmark methods.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Benchmark.h"
+#include "TargaImage.h"
+#include "ThreadPool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+
+using namespace std;
+
+// constants
+const int           c_defaultReps       = 5;                        // timed runs unless told otherwise
+const int           c_flatBlocks        = 8;                        // flat images are c_flatBlocks x c_flatBlocks blocks of one color
+const char          c_sScratchRaw[]     = "benchmark_scratch.tga";  // written and read back by the file benchmarks
+const char          c_sScratchRLE[]     = "benchmark_scratch_rle.tga";
+
+const char* const   c_asPatterns[]      = { "noise", "gradient", "flat" };
+const int           c_numPatterns       = sizeof(c_asPatterns) / sizeof(c_asPatterns[0]);
+
+// an operation on a fresh copy of the image, with a second image of the same size to composite against.
+// Some operations return false even when they have done their work, so the result is not checked.
+struct SBenchOp
+{
+    const char*                                     sName;
+    function<bool(TargaImage& image, TargaImage& matte)> run;
+};
+
+// run times of one operation on one image, and how they came out
+struct SBenchResult
+{
+    string              sOperation;
+    string              sPattern;
+    int                 width,
+                        height;
+    vector<double>      times;          // ns, sorted
+    bool                bFailed;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Next value of a small deterministic generator, so the noise images are
+//  the same on every run and every platform.
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned int Next_Random(unsigned int& state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}// Next_Random
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Make an opaque test image: random pixels, smooth ramps of each
+//  channel, or large blocks of one color.
+//
+///////////////////////////////////////////////////////////////////////////////
+static TargaImage* Make_Image(int pattern, int width, int height)
+{
+    vector<unsigned char>   pixels((size_t)width * height * 4);
+    unsigned int            state = 0x2545f491u + pattern;
+
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+        {
+            unsigned char* pixel = &pixels[((size_t)y * width + x) * 4];
+            if (pattern == 0)
+            {
+                unsigned int bits = Next_Random(state);
+                pixel[0] = (unsigned char)bits;
+                pixel[1] = (unsigned char)(bits >> 8);
+                pixel[2] = (unsigned char)(bits >> 16);
+            }// if
+            else if (pattern == 1)
+            {
+                pixel[0] = (unsigned char)(255 * x / max(width - 1, 1));
+                pixel[1] = (unsigned char)(255 * y / max(height - 1, 1));
+                pixel[2] = (unsigned char)(255 - (pixel[0] + pixel[1]) / 2);
+            }// else if
+            else
+            {
+                int block = (y * c_flatBlocks / height) * c_flatBlocks + x * c_flatBlocks / width;
+                pixel[0] = (unsigned char)(block * 37);
+                pixel[1] = (unsigned char)(block * 91);
+                pixel[2] = (unsigned char)(block * 151);
+            }// else
+            pixel[3] = 255;
+        }// for
+
+    return new TargaImage(width, height, &pixels[0]);
+}// Make_Image
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Make the image the compositing operations work against: a color ramp
+//  fading from transparent at the left to opaque at the right, premultiplied.
+//
+///////////////////////////////////////////////////////////////////////////////
+static TargaImage* Make_Matte(int width, int height)
+{
+    vector<unsigned char> pixels((size_t)width * height * 4);
+
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+        {
+            unsigned char*  pixel = &pixels[((size_t)y * width + x) * 4];
+            int             alpha = 255 * x / max(width - 1, 1);
+            pixel[0] = (unsigned char)(alpha * (255 * y / max(height - 1, 1)) / 255);
+            pixel[1] = (unsigned char)(alpha / 2);
+            pixel[2] = (unsigned char)(alpha * (255 - 255 * y / max(height - 1, 1)) / 255);
+            pixel[3] = (unsigned char)alpha;
+        }// for
+
+    return new TargaImage(width, height, &pixels[0]);
+}// Make_Matte
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Every operation, with the arguments the script commands commonly use.
+//
+///////////////////////////////////////////////////////////////////////////////
+static vector<SBenchOp> Operations()
+{
+    SBenchOp ops[] =
+    {
+        { "To_RGB",                 [](TargaImage& i, TargaImage&) { unsigned char* rgb = i.To_RGB(); bool bDone = rgb != NULL; delete[] rgb; return bDone; } },
+        { "To_Grayscale",           [](TargaImage& i, TargaImage&) { return i.To_Grayscale(); } },
+        { "Quant_Uniform",          [](TargaImage& i, TargaImage&) { return i.Quant_Uniform(); } },
+        { "Quant_Populosity",       [](TargaImage& i, TargaImage&) { return i.Quant_Populosity(); } },
+        { "Dither_Threshold",       [](TargaImage& i, TargaImage&) { return i.Dither_Threshold(); } },
+        { "Dither_Random",          [](TargaImage& i, TargaImage&) { return i.Dither_Random(); } },
+        { "Dither_FS",              [](TargaImage& i, TargaImage&) { return i.Dither_FS(); } },
+        { "Dither_Bright",          [](TargaImage& i, TargaImage&) { return i.Dither_Bright(); } },
+        { "Dither_Cluster",         [](TargaImage& i, TargaImage&) { return i.Dither_Cluster(); } },
+        { "Dither_Color",           [](TargaImage& i, TargaImage&) { return i.Dither_Color(); } },
+        { "Comp_Over",              [](TargaImage& i, TargaImage& m) { return i.Comp_Over(&m); } },
+        { "Comp_In",                [](TargaImage& i, TargaImage& m) { return i.Comp_In(&m); } },
+        { "Comp_Out",               [](TargaImage& i, TargaImage& m) { return i.Comp_Out(&m); } },
+        { "Comp_Atop",              [](TargaImage& i, TargaImage& m) { return i.Comp_Atop(&m); } },
+        { "Comp_Xor",               [](TargaImage& i, TargaImage& m) { return i.Comp_Xor(&m); } },
+        { "Difference",             [](TargaImage& i, TargaImage& m) { return i.Difference(&m); } },
+        { "Point_Ops",              [](TargaImage& i, TargaImage&)
+                                    {
+                                        vector<TargaImage::RowOp> ops;
+                                        ops.push_back(TargaImage::Gray_Op());
+                                        ops.push_back(TargaImage::Dither_Threshold_Op());
+                                        return i.Point_Ops(ops);
+                                    } },
+        { "Filter_Box",             [](TargaImage& i, TargaImage&) { return i.Filter_Box(); } },
+        { "Filter_Box_N",           [](TargaImage& i, TargaImage&) { return i.Filter_Box_N(7); } },
+        { "Filter_Bartlett",        [](TargaImage& i, TargaImage&) { return i.Filter_Bartlett(); } },
+        { "Filter_Gaussian",        [](TargaImage& i, TargaImage&) { return i.Filter_Gaussian(); } },
+        { "Filter_Gaussian_N",      [](TargaImage& i, TargaImage&) { return i.Filter_Gaussian_N(15); } },
+        { "Filter_Gaussian_Sigma",  [](TargaImage& i, TargaImage&) { return i.Filter_Gaussian_Sigma(8.0f); } },
+        { "Filter_Edge",            [](TargaImage& i, TargaImage&) { return i.Filter_Edge(); } },
+        { "Filter_Enhance",         [](TargaImage& i, TargaImage&) { return i.Filter_Enhance(); } },
+        { "NPR_Paint",              [](TargaImage& i, TargaImage&) { return i.NPR_Paint(); } },
+        { "Half_Size",              [](TargaImage& i, TargaImage&) { return i.Half_Size(); } },
+        { "Double_Size",            [](TargaImage& i, TargaImage&) { return i.Double_Size(); } },
+        { "Resize",                 [](TargaImage& i, TargaImage&) { return i.Resize(1.5f); } },
+        { "Rotate",                 [](TargaImage& i, TargaImage&) { return i.Rotate(30.0f); } },
+    };
+
+    return vector<SBenchOp>(ops, ops + sizeof(ops) / sizeof(ops[0]));
+}// Operations
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Whether the options select the given operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Selected(const CBenchmark::SOptions& options, const char* sName)
+{
+    return options.only.empty() || find(options.only.begin(), options.only.end(), sName) != options.only.end();
+}// Selected
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Time reps runs of body, each after a call to setup which is not
+//  timed.  Stops at the first run that fails.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Time_Runs(int reps, const function<void()>& setup, const function<bool()>& body, SBenchResult& result)
+{
+    result.bFailed = false;
+    for (int rep = 0; rep < reps && !result.bFailed; ++rep)
+    {
+        setup();
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        result.bFailed = !body();
+        chrono::steady_clock::time_point stop = chrono::steady_clock::now();
+
+        result.times.push_back((double)chrono::duration_cast<chrono::nanoseconds>(stop - start).count());
+    }// for
+
+    sort(result.times.begin(), result.times.end());
+}// Time_Runs
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Nearest rank percentile of sorted times.
+//
+///////////////////////////////////////////////////////////////////////////////
+static double Percentile(const vector<double>& times, double percent)
+{
+    if (times.empty())
+        return 0.0;
+
+    size_t rank = (size_t)ceil(percent / 100.0 * times.size());
+    return times[rank ? rank - 1 : 0];
+}// Percentile
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write a result as a row of the table.  Rates are per input pixel and
+//  input byte, at the median.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Print_Result(const SBenchResult& result)
+{
+    double pixels = (double)result.width * result.height,
+           median = Percentile(result.times, 50);
+
+    cout << left << setw(24) << result.sOperation << setw(10) << result.sPattern
+         << right << setw(6) << result.width << "x" << left << setw(7) << result.height << right;
+    if (result.bFailed)
+    {
+        cout << "  failed" << endl;
+        return;
+    }// if
+
+    cout << fixed << setprecision(2)
+         << setw(12) << median / 1e6 << setw(12) << Percentile(result.times, 90) / 1e6
+         << setw(12) << median / pixels << setw(12) << pixels * 4 / (median / 1e9) / 1e6 << endl;
+    cout.unsetf(ios::floatfield);
+    cout << setprecision(6);
+}// Print_Result
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write the results as JSON, one object per operation and image.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Write_Json(const string& sFilename, const CBenchmark::SOptions& options, const vector<SBenchResult>& results)
+{
+    ofstream json(sFilename.c_str());
+    if (!json)
+        return false;
+
+    json << fixed << setprecision(3)
+         << "{\n  \"threads\": " << CThreadPool::Instance().GetThreadCount()
+         << ",\n  \"reps\": " << options.reps
+         << ",\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const SBenchResult& result = results[i];
+        double              pixels = (double)result.width * result.height,
+                            median = Percentile(result.times, 50),
+                            total = 0.0;
+        for (size_t j = 0; j < result.times.size(); ++j)
+            total += result.times[j];
+
+        json << (i ? "," : "") << "\n    { \"operation\": \"" << result.sOperation << "\", \"image\": \"" << result.sPattern
+             << "\", \"width\": " << result.width << ", \"height\": " << result.height
+             << ", \"failed\": " << (result.bFailed ? "true" : "false") << ", \"runs\": " << result.times.size()
+             << ", \"min_ns\": " << Percentile(result.times, 0) << ", \"p50_ns\": " << median
+             << ", \"p90_ns\": " << Percentile(result.times, 90) << ", \"p99_ns\": " << Percentile(result.times, 99)
+             << ", \"max_ns\": " << Percentile(result.times, 100)
+             << ", \"mean_ns\": " << (result.times.empty() ? 0.0 : total / result.times.size())
+             << ", \"ns_per_pixel\": " << median / pixels << ", \"mb_per_s\": " << (median > 0 ? pixels * 4 / (median / 1e9) / 1e6 : 0.0)
+             << " }";
+    }// for
+    json << "\n  ]\n}\n";
+
+    return !json.fail();
+}// Write_Json
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Options for the full suite.
+//
+///////////////////////////////////////////////////////////////////////////////
+CBenchmark::SOptions CBenchmark::Defaults()
+{
+    SOptions options;
+    options.megapixels.push_back(1);
+    options.megapixels.push_back(12);
+    options.megapixels.push_back(50);
+    options.reps = c_defaultReps;
+    return options;
+}// Defaults
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run the benchmarks.  Each size is 4:3.  Files are written to and read
+//  back from scratch files in the current directory, removed at the end.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CBenchmark::Run(const SOptions& options)
+{
+    vector<SBenchOp>        ops = Operations();
+    vector<SBenchResult>    results;
+    bool                    bResult = true;
+
+    cout << left << setw(24) << "operation" << setw(10) << "image" << setw(14) << "size" << right
+         << setw(12) << "p50 ms" << setw(12) << "p90 ms" << setw(12) << "ns/pixel" << setw(12) << "MB/s" << endl;
+
+    for (size_t size = 0; size < options.megapixels.size(); ++size)
+    {
+        int width = max((int)(sqrt(options.megapixels[size] * 1e6 * 4 / 3) + 0.5), 1),
+            height = max((int)(options.megapixels[size] * 1e6 / width + 0.5), 1);
+
+        TargaImage* pMatte = Make_Matte(width, height);
+        for (int pattern = 0; pattern < c_numPatterns; ++pattern)
+        {
+            TargaImage* pSource = Make_Image(pattern, width, height);
+            TargaImage* pImage = NULL;
+            SBenchResult result;
+            result.sPattern = c_asPatterns[pattern];
+            result.width = width;
+            result.height = height;
+
+            for (size_t op = 0; op < ops.size(); ++op)
+            {
+                if (!Selected(options, ops[op].sName))
+                    continue;
+
+                result.sOperation = ops[op].sName;
+                result.times.clear();
+                Time_Runs(options.reps,
+                          [&]() { delete pImage; pImage = new TargaImage(width, height, pSource->Data()); },
+                          [&]() { ops[op].run(*pImage, *pMatte); return true; },
+                          result);
+                delete pImage;
+                pImage = NULL;
+
+                Print_Result(result);
+                results.push_back(result);
+                bResult = bResult && !result.bFailed;
+            }// for
+
+            // the files, written by the first two and read by the last two
+            const char* asFileOps[] = { "tga_write_raw", "tga_write_rle", "tga_load_raw", "tga_load_rle" };
+            for (int op = 0; op < 4; ++op)
+            {
+                if (!Selected(options, asFileOps[op]))
+                    continue;
+
+                const char* sFilename = op % 2 ? c_sScratchRLE : c_sScratchRaw;
+                result.sOperation = asFileOps[op];
+                result.times.clear();
+                if (op < 2)
+                    Time_Runs(options.reps, []() {}, [&]() { return pSource->Save_Image(sFilename, op == 1); }, result);
+                else if (pSource->Save_Image(sFilename, op == 3))
+                    Time_Runs(options.reps, []() {},
+                              [&]() { TargaImage* pLoaded = TargaImage::Load_Image((char*)sFilename); bool bDone = pLoaded != NULL; delete pLoaded; return bDone; },
+                              result);
+                else
+                    result.bFailed = true;
+
+                Print_Result(result);
+                results.push_back(result);
+                bResult = bResult && !result.bFailed;
+            }// for
+
+            delete pSource;
+        }// for
+        delete pMatte;
+    }// for
+
+    remove(c_sScratchRaw);
+    remove(c_sScratchRLE);
+
+    if (!options.sJson.empty() && !Write_Json(options.sJson, options, results))
+    {
+        cout << "Unable to write " << options.sJson << endl;
+        bResult = false;
+    }// if
+
+    return bResult;
+}// Run
@@ -0,0 +1,50 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Benchmark.h
+//
+//      Times every TargaImage operation, and reading and writing targa files,
+//  on synthetic images of several sizes, so a slower version shows up as a
+//  number rather than a hunch.  Each operation runs a few times on a fresh
+//  copy of each image; the table and the JSON report give the spread of the
+//  run times along with ns per pixel and MB/s at the median.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _C_BENCHMARK
+#define _C_BENCHMARK
+
+#include <string>
+#include <vector>
+
+class CBenchmark
+{
+    // types
+    public:
+        struct SOptions
+        {
+            std::vector<double>         megapixels;     // image sizes, in millions of pixels
+            int                         reps;           // timed runs of each operation on each image
+            std::vector<std::string>    only;           // operations to run, all if empty
+            std::string                 sJson;          // file for the JSON report, none if empty
+        };
+
+    // methods
+    public:
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Options for the full suite: 1, 12 and 50 megapixel images, five
+        //  runs each, every operation, no JSON.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static SOptions Defaults();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Run the benchmarks and write the table to standard out.  Returns
+        //  false if an operation failed or the report could not be written.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static bool Run(const SOptions& options);
+};// CBenchmark
+
+#endif // _C_BENCHMARK
@@ -0,0 +1,253 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      BufferPool.cpp
+//
+//      Implementation of CBufferPool methods.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "BufferPool.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+
+using namespace std;
+
+// constants
+const size_t    c_alignment         = 64;                   // buffer alignment, one cache line
+const int       c_minClassShift     = 8;                    // smallest size class is 1 << c_minClassShift bytes
+const size_t    c_maxCachedBytes    = (size_t)512 << 20;    // cached bytes above this go back to the heap
+const uint32_t  c_headerMagic       = 0x42554650;           // marks a live pool buffer
+
+// bookkeeping stored in the cache line before each buffer
+struct SHeader
+{
+    void*       pRaw;           // pointer returned by malloc
+    int         sizeClass;      // size class of the buffer
+    uint32_t    magic;          // c_headerMagic while handed out
+};// SHeader
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Get the process wide pool.  It is never destroyed, so images freed
+//  during static destruction can still release their buffers.
+//
+///////////////////////////////////////////////////////////////////////////////
+CBufferPool& CBufferPool::Instance()
+{
+    static CBufferPool* pPool = new CBufferPool;
+    return *pPool;
+}// Instance
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.
+//
+///////////////////////////////////////////////////////////////////////////////
+CBufferPool::CBufferPool()
+{
+    m_stats.requests = 0;
+    m_stats.hits = 0;
+    m_stats.bytesInUse = 0;
+    m_stats.peakBytesInUse = 0;
+    m_stats.markBytesInUse = 0;
+    m_stats.bytesCached = 0;
+    m_stats.bytesAllocated = 0;
+}// CBufferPool
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Destructor.  Free the cached buffers.
+//
+///////////////////////////////////////////////////////////////////////////////
+CBufferPool::~CBufferPool()
+{
+    Trim();
+}// ~CBufferPool
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Get a 64 byte aligned buffer of at least the given size, reusing a
+//  cached buffer of the same size class if there is one.
+//
+///////////////////////////////////////////////////////////////////////////////
+void* CBufferPool::Allocate(size_t bytes)
+{
+    int sizeClass = SizeClass(bytes);
+    if (sizeClass < 0)
+        return NULL;
+    size_t classBytes = ClassBytes(sizeClass);
+
+    void* pBuffer = NULL;
+    {
+        lock_guard<mutex> lock(m_mutex);
+        ++m_stats.requests;
+        if (!m_freeLists[sizeClass].empty())
+        {
+            pBuffer = m_freeLists[sizeClass].back();
+            m_freeLists[sizeClass].pop_back();
+            m_stats.bytesCached -= classBytes;
+            ++m_stats.hits;
+        }// if
+        m_stats.bytesInUse += classBytes;
+        m_stats.bytesAllocated += classBytes;
+        if (m_stats.bytesInUse > m_stats.peakBytesInUse)
+            m_stats.peakBytesInUse = m_stats.bytesInUse;
+        if (m_stats.bytesInUse > m_stats.markBytesInUse)
+            m_stats.markBytesInUse = m_stats.bytesInUse;
+    }
+
+    if (!pBuffer)
+    {
+        // room for the header and for aligning past it
+        void* pRaw = malloc(classBytes + 2 * c_alignment);
+        if (!pRaw)
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_stats.bytesInUse -= classBytes;
+            m_stats.bytesAllocated -= classBytes;
+            return NULL;
+        }// if
+
+        pBuffer = (void*)(((uintptr_t)pRaw + 2 * c_alignment - 1) & ~(uintptr_t)(c_alignment - 1));
+        SHeader* pHeader = (SHeader*)((char*)pBuffer - c_alignment);
+        pHeader->pRaw = pRaw;
+        pHeader->sizeClass = sizeClass;
+    }// if
+
+    ((SHeader*)((char*)pBuffer - c_alignment))->magic = c_headerMagic;
+    return pBuffer;
+}// Allocate
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Give a buffer back to the pool.  It is cached for reuse unless the
+//  cache is full, in which case it goes back to the heap.  A header without
+//  the magic means a buffer released twice or one from somewhere else, and
+//  carrying on would corrupt the free lists, so that aborts.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBufferPool::Release(void* pBuffer)
+{
+    if (!pBuffer)
+        return;
+
+    SHeader* pHeader = (SHeader*)((char*)pBuffer - c_alignment);
+    if (pHeader->magic != c_headerMagic)
+    {
+        fprintf(stderr, "Buffer pool: %p released twice or not from the pool\n", pBuffer);
+        abort();
+    }// if
+    pHeader->magic = 0;
+
+    int    sizeClass = pHeader->sizeClass;
+    size_t classBytes = ClassBytes(sizeClass);
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_stats.bytesInUse -= classBytes;
+        if (m_stats.bytesCached + classBytes <= c_maxCachedBytes)
+        {
+            m_freeLists[sizeClass].push_back(pBuffer);
+            m_stats.bytesCached += classBytes;
+            return;
+        }// if
+    }
+
+    free(pHeader->pRaw);
+}// Release
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Free all cached buffers back to the heap.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBufferPool::Trim()
+{
+    lock_guard<mutex> lock(m_mutex);
+    for (int i = 0; i < c_numClasses; ++i)
+    {
+        for (size_t j = 0; j < m_freeLists[i].size(); ++j)
+            free(((SHeader*)((char*)m_freeLists[i][j] - c_alignment))->pRaw);
+        m_freeLists[i].clear();
+    }// for
+    m_stats.bytesCached = 0;
+}// Trim
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Restart the marked peak from the bytes in use now.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBufferPool::MarkPeak()
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_stats.markBytesInUse = m_stats.bytesInUse;
+}// MarkPeak
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Get a snapshot of the pool counters.
+//
+///////////////////////////////////////////////////////////////////////////////
+CBufferPool::SStats CBufferPool::GetStats()
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_stats;
+}// GetStats
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Smallest size class holding the given number of bytes, or -1 if the
+//  size is too large for any class.
+//
+///////////////////////////////////////////////////////////////////////////////
+int CBufferPool::SizeClass(size_t bytes)
+{
+    for (int sizeClass = 0; sizeClass < c_numClasses; ++sizeClass)
+    {
+        size_t classBytes = ClassBytes(sizeClass);
+        if (classBytes == 0)
+            break;
+        if (classBytes >= bytes)
+            return sizeClass;
+    }// for
+    return -1;
+}// SizeClass
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Size of a class: four steps of a quarter from each power of two, so at
+//  most a fifth of a buffer is wasted.  Returns 0 for classes too large to
+//  allocate.
+//
+///////////////////////////////////////////////////////////////////////////////
+size_t CBufferPool::ClassBytes(int sizeClass)
+{
+    int    shift = c_minClassShift + sizeClass / 4;
+    if (shift >= (int)(sizeof(size_t) * 8) - 2)
+        return 0;
+    size_t base = (size_t)1 << shift;
+    return base + (sizeClass % 4) * (base >> 2);
+}// ClassBytes
+
+
+void* Pool_Alloc(size_t bytes)
+{
+    return CBufferPool::Instance().Allocate(bytes);
+}// Pool_Alloc
+
+
+void Pool_Free(void* pBuffer)
+{
+    CBufferPool::Instance().Release(pBuffer);
+}// Pool_Free
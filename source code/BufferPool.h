@@ -0,0 +1,109 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      BufferPool.h
+//
+//      Process wide pool of 64 byte aligned buffers for pixel data and
+//  scratch planes.  Sizes are rounded up to size classes four to a power of
+//  two, and released buffers are kept per class for the next request of that
+//  class, so the full image buffers that every command allocates are reused
+//  instead of going back to the heap.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _C_BUFFER_POOL
+#define _C_BUFFER_POOL
+
+#include <stddef.h>
+#include <vector>
+#include <mutex>
+
+class CBufferPool
+{
+    // types
+    public:
+        struct SStats
+        {
+            unsigned long long  requests;       // calls to Allocate
+            unsigned long long  hits;           // requests served from a cached buffer
+            size_t              bytesInUse;     // class bytes handed out and not yet released
+            size_t              peakBytesInUse; // largest bytesInUse so far
+            size_t              markBytesInUse; // largest bytesInUse since MarkPeak
+            size_t              bytesCached;    // class bytes held for reuse
+            unsigned long long  bytesAllocated; // class bytes handed out so far, reused buffers included
+        };
+
+    // methods
+    public:
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Get the process wide pool.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static CBufferPool& Instance();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Get a 64 byte aligned buffer of at least the given size.  Returns
+        //  NULL if the heap is exhausted.  Release must be used to free it.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        void* Allocate(size_t bytes);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Give a buffer from Allocate back to the pool.  NULL is ignored;
+        //  any other pointer must come from Allocate and not have been released
+        //  already, or the process aborts.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        void Release(void* pBuffer);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Free all cached buffers back to the heap.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        void Trim();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Restart markBytesInUse from the bytes in use now, to find the peak
+        //  of a stretch of work.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        void MarkPeak();
+
+        SStats GetStats();
+
+    private:
+        CBufferPool();
+        ~CBufferPool();
+
+        static int    SizeClass(size_t bytes);
+        static size_t ClassBytes(int sizeClass);
+
+    // members
+    private:
+        static const int    c_numClasses = 160;
+
+        std::mutex          m_mutex;                        // guards everything below
+        std::vector<void*>  m_freeLists[c_numClasses];      // cached buffers per size class
+        SStats              m_stats;
+};// CBufferPool
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Shorthands for the process wide pool, with the malloc / free signature
+//  so they can be handed to C code.
+//
+///////////////////////////////////////////////////////////////////////////////
+void* Pool_Alloc(size_t bytes);
+void  Pool_Free(void* pBuffer);
+
+template <class T> inline T* Pool_New(size_t count)
+{
+    return (T*)Pool_Alloc(count * sizeof(T));
+}// Pool_New
+
+#endif // _C_BUFFER_POOL
@@ -0,0 +1,361 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolution.cpp
+//
+//      Implementation of the separable convolution engine.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Convolution.h"
+#include "ThreadPool.h"
+#include "BufferPool.h"
+#include <string.h>
+#include <math.h>
+#include <atomic>
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolve one row with a 2 * radius + 1 tap kernel.  The row is copied
+//  into a zero padded buffer so the tap loop needs no bounds checks.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Convolve_Row(const float* src, float* dst, int width, const float* kernel, int radius, float* padded)
+{
+    memset(padded, 0, sizeof(float) * radius);
+    memcpy(padded + radius, src, sizeof(float) * width);
+    memset(padded + radius + width, 0, sizeof(float) * radius);
+
+    memset(dst, 0, sizeof(float) * width);
+    for (int k = 0; k <= 2 * radius; k++) {
+        const float  weight = kernel[k];
+        const float* p_src = padded + k;
+        for (int x = 0; x < width; x++)
+            dst[x] += weight * p_src[x];
+    }
+}// Convolve_Row
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Compute one output row of the column pass.  rows[k] is the input row
+//  under kernel tap k, or NULL if that row lies outside the image.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Convolve_Column(const float* const* rows, float* dst, int width, const float* kernel, int radius)
+{
+    memset(dst, 0, sizeof(float) * width);
+    for (int k = 0; k <= 2 * radius; k++) {
+        if (!rows[k]) continue;
+        const float  weight = kernel[k];
+        const float* p_src = rows[k];
+        for (int x = 0; x < width; x++)
+            dst[x] += weight * p_src[x];
+    }
+}// Convolve_Column
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolve a whole plane in place with the outer product of kernelX and
+//  kernelY: a row pass followed by a column pass.  Return false, with the
+//  plane untouched, if there is no memory for the row pass.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool Convolve_Separable(float* plane, int width, int height, const float* kernelX, const float* kernelY, int radius)
+{
+    float* rowPass = Pool_New<float>(width * height);
+    if (!rowPass)
+        return false;
+
+    // row pass
+    std::atomic<bool> bFailed(false);
+    Parallel_Rows(height, width, [&](int y0, int y1) {
+        float* padded = Pool_New<float>(width + 2 * radius);
+        if (!padded) {
+            bFailed = true;
+            return;
+        }
+        for (int y = y0; y < y1; y++)
+            Convolve_Row(plane + y * width, rowPass + y * width, width, kernelX, radius, padded);
+        Pool_Free(padded);
+    });
+    if (bFailed) {
+        Pool_Free(rowPass);
+        return false;
+    }
+
+    // column pass
+    Parallel_Rows(height, width, [&](int y0, int y1) {
+        const float** rows = new const float*[2 * radius + 1];
+        for (int y = y0; y < y1; y++) {
+            for (int k = 0; k <= 2 * radius; k++) {
+                int srcY = y + k - radius;
+                rows[k] = (srcY < 0 || srcY >= height) ? NULL : rowPass + srcY * width;
+            }
+            Convolve_Column(rows, plane + y * width, width, kernelY, radius);
+        }
+        delete[] rows;
+    });
+
+    Pool_Free(rowPass);
+    return true;
+}// Convolve_Separable
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Running sum of one row over a 2 * radius + 1 window, scaled by scale.
+//  The sum is kept in double so it does not drift along long rows.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Box_Sum_Row(const float* src, float* dst, int width, int radius, double scale)
+{
+    double sum = 0.0;
+    for (int x = 0; x < radius && x < width; x++)
+        sum += src[x];
+
+    for (int x = 0; x < width; x++) {
+        if (x + radius < width) sum += src[x + radius];
+        dst[x] = (float)(sum * scale);
+        if (x - radius >= 0) sum -= src[x - radius];
+    }
+}// Box_Sum_Row
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Box filter a whole plane in place with a (2 * radius + 1)^2 window.
+//  Uses running sums, so the cost per pixel does not depend on the radius.
+//  Return false, with the plane untouched, if there is no memory for the
+//  sums.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool Box_Filter(float* plane, int width, int height, int radius)
+{
+    const double scale = 1.0 / (2 * radius + 1);
+    float*       rowPass = Pool_New<float>(width * height);
+    double*      columnSum = Pool_New<double>(width);
+    if (!rowPass || !columnSum) {
+        Pool_Free(columnSum);
+        Pool_Free(rowPass);
+        return false;
+    }
+
+    // row pass
+    Parallel_Rows(height, width, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++)
+            Box_Sum_Row(plane + y * width, rowPass + y * width, width, radius, scale);
+    });
+
+    // column pass, one running sum per column, walked down strips of columns
+    Parallel_Columns(width, height, [&](int x0, int x1) {
+        for (int x = x0; x < x1; x++)
+            columnSum[x] = 0.0;
+        for (int y = 0; y < radius && y < height; y++) {
+            const float* p_src = rowPass + y * width;
+            for (int x = x0; x < x1; x++)
+                columnSum[x] += p_src[x];
+        }
+
+        for (int y = 0; y < height; y++) {
+            if (y + radius < height) {
+                const float* p_add = rowPass + (y + radius) * width;
+                for (int x = x0; x < x1; x++)
+                    columnSum[x] += p_add[x];
+            }
+
+            float* p_dst = plane + y * width;
+            for (int x = x0; x < x1; x++)
+                p_dst[x] = (float)(columnSum[x] * scale);
+
+            if (y - radius >= 0) {
+                const float* p_sub = rowPass + (y - radius) * width;
+                for (int x = x0; x < x1; x++)
+                    columnSum[x] -= p_sub[x];
+            }
+        }
+    });
+
+    Pool_Free(columnSum);
+    Pool_Free(rowPass);
+    return true;
+}// Box_Filter
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Build a normalized 1D binomial kernel with the given (odd) number of
+//  taps, row taps - 1 of Pascal's triangle.  Built in double by repeated
+//  averaging so it stays exact for large sizes.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Make_Binomial_Kernel(int taps, std::vector<float>& kernel)
+{
+    std::vector<double> row(taps, 0.0);
+    row[0] = 1.0;
+    for (int n = 1; n < taps; n++) {
+        for (int i = n; i > 0; i--)
+            row[i] = 0.5 * (row[i] + row[i - 1]);
+        row[0] *= 0.5;
+    }
+
+    kernel.resize(taps);
+    for (int i = 0; i < taps; i++)
+        kernel[i] = (float)row[i];
+}// Make_Binomial_Kernel
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Build a normalized sampled 1D Gaussian kernel of radius ceil(3 sigma).
+//  Returns the radius.
+//
+///////////////////////////////////////////////////////////////////////////////
+int Make_Gaussian_Kernel(float sigma, std::vector<float>& kernel)
+{
+    const int radius = (int)ceil(3.0 * sigma);
+    std::vector<double> weights(2 * radius + 1);
+    double sum = 0.0;
+    for (int i = -radius; i <= radius; i++) {
+        weights[i + radius] = exp(-(double)(i * i) / (2.0 * sigma * sigma));
+        sum += weights[i + radius];
+    }
+
+    kernel.resize(2 * radius + 1);
+    for (int i = 0; i <= 2 * radius; i++)
+        kernel[i] = (float)(weights[i] / sum);
+    return radius;
+}// Make_Gaussian_Kernel
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Boundary condition for the anti-causal recursive pass.  With a zero
+//  input past the end of a line, the anti-causal states just beyond the end
+//  are a linear function of the last three causal outputs.  Find that 3x3
+//  matrix by pushing each unit state through a zero tail of the given length
+//  and back.  Runs once per filter call, not per line.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void IIR_Tail_Matrix(float B, float a1, float a2, float a3, int length, float M[3][3])
+{
+    std::vector<double> tail(length + 3);
+
+    for (int j = 0; j < 3; j++) {
+        double w1 = (j == 0), w2 = (j == 1), w3 = (j == 2);
+        for (int n = 0; n < length; n++) {
+            double w0 = a1 * w1 + a2 * w2 + a3 * w3;
+            tail[n] = w0;
+            w3 = w2; w2 = w1; w1 = w0;
+        }
+
+        double y1 = 0.0, y2 = 0.0, y3 = 0.0;
+        for (int n = length - 1; n >= 0; n--) {
+            double y0 = B * tail[n] + a1 * y1 + a2 * y2 + a3 * y3;
+            tail[n] = y0;
+            y3 = y2; y2 = y1; y1 = y0;
+        }
+
+        for (int i = 0; i < 3; i++)
+            M[i][j] = (float)tail[i];
+    }
+}// IIR_Tail_Matrix
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Gaussian blur a whole plane in place with the recursive filter of Young
+//  and van Vliet, "Recursive implementation of the Gaussian filter" (1995).
+//  Each direction runs a causal then an anti-causal third order pass.  Pixels
+//  outside the image are zero, as for the FIR filters: the causal pass starts
+//  from zero states, the anti-causal one from IIR_Tail_Matrix.  The column
+//  passes run over whole rows at a time to stay cache friendly.  Return
+//  false, with the plane untouched, if there is no memory for the column
+//  pass boundaries.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool Gaussian_IIR(float* plane, int width, int height, float sigma)
+{
+    const double q = (sigma >= 2.5f) ? 0.98711 * sigma - 0.96330
+                                     : 3.97156 - 4.14554 * sqrt(1.0 - 0.26891 * sigma);
+    const double b0 = 1.57825 + 2.44413 * q + 1.4281 * q * q + 0.422205 * q * q * q;
+    const double b1 = 2.44413 * q + 2.85619 * q * q + 1.26661 * q * q * q;
+    const double b2 = -(1.4281 * q * q + 1.26661 * q * q * q);
+    const double b3 = 0.422205 * q * q * q;
+
+    const float a1 = (float)(b1 / b0);
+    const float a2 = (float)(b2 / b0);
+    const float a3 = (float)(b3 / b0);
+    const float B = 1.0f - (a1 + a2 + a3);
+
+    float M[3][3];
+    IIR_Tail_Matrix(B, a1, a2, a3, (int)(10.0f * sigma) + 16, M);
+
+    // taken before the row passes change the plane
+    float* zeros = Pool_New<float>(width);
+    float* tail = Pool_New<float>(3 * width);
+    if (!zeros || !tail) {
+        Pool_Free(tail);
+        Pool_Free(zeros);
+        return false;
+    }
+    memset(zeros, 0, sizeof(float) * width);
+
+    // row passes
+    Parallel_Rows(height, width, [&](int begin, int end) {
+        for (int y = begin; y < end; y++) {
+            float* row = plane + y * width;
+            float  w1 = 0.0f, w2 = 0.0f, w3 = 0.0f;
+            for (int x = 0; x < width; x++) {
+                float w0 = B * row[x] + a1 * w1 + a2 * w2 + a3 * w3;
+                row[x] = w0;
+                w3 = w2; w2 = w1; w1 = w0;
+            }
+
+            float y1 = M[0][0] * w1 + M[0][1] * w2 + M[0][2] * w3;
+            float y2 = M[1][0] * w1 + M[1][1] * w2 + M[1][2] * w3;
+            float y3 = M[2][0] * w1 + M[2][1] * w2 + M[2][2] * w3;
+            for (int x = width - 1; x >= 0; x--) {
+                float y0 = B * row[x] + a1 * y1 + a2 * y2 + a3 * y3;
+                row[x] = y0;
+                y3 = y2; y2 = y1; y1 = y0;
+            }
+        }
+    });
+
+    // column passes, walked down strips of columns
+    Parallel_Columns(width, height, [&](int x0, int x1) {
+        // causal pass, rows above the image read from a zero row
+        for (int y = 0; y < height; y++) {
+            float*       row = plane + y * width;
+            const float* r1 = (y >= 1) ? row - width : zeros;
+            const float* r2 = (y >= 2) ? row - 2 * width : zeros;
+            const float* r3 = (y >= 3) ? row - 3 * width : zeros;
+            for (int x = x0; x < x1; x++)
+                row[x] = B * row[x] + a1 * r1[x] + a2 * r2[x] + a3 * r3[x];
+        }
+
+        // anti-causal pass, the three rows below the image come from the
+        // tail matrix applied to the last three causal rows
+        const float* w1 = (height >= 1) ? plane + (height - 1) * width : zeros;
+        const float* w2 = (height >= 2) ? plane + (height - 2) * width : zeros;
+        const float* w3 = (height >= 3) ? plane + (height - 3) * width : zeros;
+        for (int i = 0; i < 3; i++)
+            for (int x = x0; x < x1; x++)
+                tail[i * width + x] = M[i][0] * w1[x] + M[i][1] * w2[x] + M[i][2] * w3[x];
+
+        for (int y = height - 1; y >= 0; y--) {
+            float*       row = plane + y * width;
+            const float* r1 = (y + 1 < height) ? row + width : tail + (y + 1 - height) * width;
+            const float* r2 = (y + 2 < height) ? row + 2 * width : tail + (y + 2 - height) * width;
+            const float* r3 = (y + 3 < height) ? row + 3 * width : tail + (y + 3 - height) * width;
+            for (int x = x0; x < x1; x++)
+                row[x] = B * row[x] + a1 * r1[x] + a2 * r2[x] + a3 * r3[x];
+        }
+    });
+
+    Pool_Free(tail);
+    Pool_Free(zeros);
+    return true;
+}// Gaussian_IIR
@@ -0,0 +1,77 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolution.h
+//
+//      Separable convolution engine shared by the TargaImage filters.  All
+//  functions work on single channel float planes, and treat pixels outside
+//  the image as zero.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _CONVOLUTION_H_
+#define _CONVOLUTION_H_
+
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolve one row with a 2 * radius + 1 tap kernel.  padded must hold
+//  width + 2 * radius floats and is used to move the border handling out of
+//  the inner loop.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Convolve_Row(const float* src, float* dst, int width, const float* kernel, int radius, float* padded);
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Compute one output row of the column pass.  rows[k] is the input row
+//  under kernel tap k, or NULL if that row lies outside the image.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Convolve_Column(const float* const* rows, float* dst, int width, const float* kernel, int radius);
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolve a whole plane in place with the outer product of kernelX and
+//  kernelY: a row pass followed by a column pass.  The filters below all
+//  return false, leaving the plane as it was, if there is no memory for
+//  their scratch buffers.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool Convolve_Separable(float* plane, int width, int height, const float* kernelX, const float* kernelY, int radius);
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Box filter a whole plane in place with a (2 * radius + 1)^2 window.
+//  Uses running sums, so the cost per pixel does not depend on the radius.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool Box_Filter(float* plane, int width, int height, int radius);
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Build a normalized 1D binomial kernel with the given (odd) number of
+//  taps, row taps - 1 of Pascal's triangle.  Built in double by repeated
+//  averaging so it stays exact for large sizes.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Make_Binomial_Kernel(int taps, std::vector<float>& kernel);
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Build a normalized sampled 1D Gaussian kernel of radius ceil(3 sigma).
+//  Returns the radius.
+//
+///////////////////////////////////////////////////////////////////////////////
+int Make_Gaussian_Kernel(float sigma, std::vector<float>& kernel);
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Gaussian blur a whole plane in place with the recursive filter of Young
+//  and van Vliet.  The cost per pixel does not depend on sigma, which must be
+//  at least 0.5.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool Gaussian_IIR(float* plane, int width, int height, float sigma);
+
+#endif // _CONVOLUTION_H_
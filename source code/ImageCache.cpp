@@ -0,0 +1,362 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ImageCache.cpp
+//
+//      Implementation of CImageCache methods.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "ImageCache.h"
+#include "TargaImage.h"
+#include <stdlib.h>
+#include <iostream>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+// constants
+const size_t    c_defaultBudget     = (size_t)256 << 20;    // pixel bytes cached unless told otherwise
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Get the canonical path, modification time and size of a file.  Return
+//  false if the file does not exist.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool File_Identity(const char* sFilename, string& sPath, time_t& modified, long long& fileSize)
+{
+#ifdef _WIN32
+    char sFullPath[_MAX_PATH];
+    struct _stat64 info;
+    if (!_fullpath(sFullPath, sFilename, _MAX_PATH) || _stat64(sFullPath, &info) != 0)
+        return false;
+    sPath = sFullPath;
+#else
+    char* sFullPath = realpath(sFilename, NULL);
+    struct stat info;
+    if (!sFullPath)
+        return false;
+    sPath = sFullPath;
+    free(sFullPath);
+    if (stat(sPath.c_str(), &info) != 0)
+        return false;
+#endif
+
+    modified = info.st_mtime;
+    fileSize = (long long)info.st_size;
+    return true;
+}// File_Identity
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Get the process wide cache.  Like the buffer pool it is never
+//  destroyed, so images it holds can release their buffers at any time.
+//
+///////////////////////////////////////////////////////////////////////////////
+CImageCache& CImageCache::Instance()
+{
+    static CImageCache* pCache = new CImageCache;
+    return *pCache;
+}// Instance
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.
+//
+///////////////////////////////////////////////////////////////////////////////
+CImageCache::CImageCache()
+    : m_budget(c_defaultBudget)
+{
+    m_stats.lookups = 0;
+    m_stats.hits = 0;
+    m_stats.bytes = 0;
+    m_stats.entries = 0;
+}// CImageCache
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Get the image in the given file, from the cache if it is still
+//  current.  The file is loaded outside the lock, so loads of different
+//  files can overlap.  Returns NULL on failure.
+//
+///////////////////////////////////////////////////////////////////////////////
+shared_ptr<TargaImage> CImageCache::Load(const char* sFilename)
+{
+    string      sPath;
+    time_t      modified;
+    long long   fileSize;
+
+    if (!sFilename)
+    {
+        cout << "No filename given." << endl;
+        return NULL;
+    }// if
+
+    // a file that cannot be found is left to Load_Image to report
+    if (!File_Identity(sFilename, sPath, modified, fileSize))
+        return shared_ptr<TargaImage>(TargaImage::Load_Image((char*)sFilename));
+
+    {
+        unique_lock<mutex> lock(m_mutex);
+        ++m_stats.lookups;
+
+        // a queued prefetch is taken over, one under way is waited for
+        for (deque<SPrefetch>::iterator queued = m_queued.begin(); queued != m_queued.end(); ++queued)
+            if (queued->sPath == sPath)
+            {
+                m_queued.erase(queued);
+                break;
+            }// if
+        m_loadedSignal.wait(lock, [&]() { return !m_loading.count(sPath); });
+
+        unordered_map<string, EntryList::iterator>::iterator found = m_index.find(sPath);
+        if (found != m_index.end())
+        {
+            EntryList::iterator entry = found->second;
+            if (entry->modified == modified && entry->fileSize == fileSize)
+            {
+                m_entries.splice(m_entries.begin(), m_entries, entry);
+                ++m_stats.hits;
+                return entry->pImage;
+            }// if
+
+            // changed on disk since it was cached
+            Remove(sPath);
+        }// if
+    }
+
+    return LoadFile(sPath, modified, fileSize);
+}// Load
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Queue the given file for the background loader.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CImageCache::Prefetch(const char* sFilename, unsigned long long owner)
+{
+    string      sPath;
+    time_t      modified;
+    long long   fileSize;
+
+    // missing files are left for Load to report
+    if (!sFilename || !File_Identity(sFilename, sPath, modified, fileSize))
+        return;
+
+    lock_guard<mutex> lock(m_mutex);
+    if (!m_budget || m_loading.count(sPath))
+        return;
+    for (size_t i = 0; i < m_queued.size(); ++i)
+        if (m_queued[i].sPath == sPath)
+            return;
+
+    unordered_map<string, EntryList::iterator>::iterator found = m_index.find(sPath);
+    if (found != m_index.end() && found->second->modified == modified && found->second->fileSize == fileSize)
+        return;
+
+    if (!m_loader.joinable())
+        m_loader = thread(&CImageCache::LoaderLoop, this);
+    SPrefetch prefetch = { sPath, owner };
+    m_queued.push_back(prefetch);
+    m_queueSignal.notify_one();
+}// Prefetch
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Drop the owner's prefetches not yet started and wait for its one under
+//  way.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CImageCache::CancelPrefetches(unsigned long long owner)
+{
+    unique_lock<mutex> lock(m_mutex);
+    for (deque<SPrefetch>::iterator queued = m_queued.begin(); queued != m_queued.end(); )
+        queued = queued->owner == owner ? m_queued.erase(queued) : queued + 1;
+
+    m_loadedSignal.wait(lock, [this, owner]()
+    {
+        for (unordered_map<string, unsigned long long>::iterator loading = m_loading.begin(); loading != m_loading.end(); ++loading)
+            if (loading->second == owner)
+                return false;
+        return true;
+    });
+}// CancelPrefetches
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Drop all the prefetches not yet started and wait for the one under way.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CImageCache::CancelAllPrefetches()
+{
+    unique_lock<mutex> lock(m_mutex);
+    m_queued.clear();
+    m_loadedSignal.wait(lock, [this]() { return m_loading.empty(); });
+}// CancelAllPrefetches
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Drop the given file from the cache.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CImageCache::Forget(const char* sFilename)
+{
+    string      sPath;
+    time_t      modified;
+    long long   fileSize;
+
+    if (!sFilename || !File_Identity(sFilename, sPath, modified, fileSize))
+        return;
+
+    lock_guard<mutex> lock(m_mutex);
+    if (m_index.count(sPath))
+        Remove(sPath);
+}// Forget
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Set the most pixel bytes the cache holds.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CImageCache::SetBudget(size_t bytes)
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_budget = bytes;
+    Evict();
+}// SetBudget
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Drop all cached images.  Images still in use elsewhere live on until
+//  their last user lets go of them.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CImageCache::Clear()
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_entries.clear();
+    m_index.clear();
+    m_stats.bytes = 0;
+    m_stats.entries = 0;
+}// Clear
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Get a snapshot of the cache counters.
+//
+///////////////////////////////////////////////////////////////////////////////
+CImageCache::SStats CImageCache::GetStats()
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_stats;
+}// GetStats
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Load the file with the given canonical path, outside the lock, and add
+//  it to the cache if it fits.  Returns NULL on failure.
+//
+///////////////////////////////////////////////////////////////////////////////
+shared_ptr<TargaImage> CImageCache::LoadFile(string& sPath, time_t modified, long long fileSize)
+{
+    shared_ptr<TargaImage> pImage(TargaImage::Load_Image(&sPath[0]));
+    if (!pImage)
+        return pImage;
+
+    lock_guard<mutex> lock(m_mutex);
+
+    size_t bytes = (size_t)pImage->width * pImage->height * 4;
+    if (bytes > m_budget || m_index.count(sPath))
+        return pImage;
+
+    SEntry entry = { sPath, modified, fileSize, pImage, bytes };
+    m_entries.push_front(entry);
+    m_index[sPath] = m_entries.begin();
+    m_stats.bytes += bytes;
+    ++m_stats.entries;
+    Evict();
+
+    return pImage;
+}// LoadFile
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Drop least recently used images until the cache fits its budget.  The
+//  caller holds the lock.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CImageCache::Evict()
+{
+    while (m_stats.bytes > m_budget && !m_entries.empty())
+    {
+        SEntry& entry = m_entries.back();
+        m_stats.bytes -= entry.bytes;
+        --m_stats.entries;
+        m_index.erase(entry.sPath);
+        m_entries.pop_back();
+    }// while
+}// Evict
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Drop the entry for the given canonical path.  The caller holds the lock
+//  and has checked that the entry exists.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CImageCache::Remove(const string& sPath)
+{
+    EntryList::iterator entry = m_index[sPath];
+    m_stats.bytes -= entry->bytes;
+    --m_stats.entries;
+    m_entries.erase(entry);
+    m_index.erase(sPath);
+}// Remove
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Background loader main loop.  Load queued files one at a time; the
+//  decode itself still spreads its rows over the thread pool.  The cache is
+//  never destroyed, so neither is the loader.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CImageCache::LoaderLoop()
+{
+    for (;;)
+    {
+        string      sQueued,
+                    sPath;
+        time_t      modified;
+        long long   fileSize;
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_queueSignal.wait(lock, [this]() { return !m_queued.empty(); });
+            sQueued = m_queued.front().sPath;
+            m_loading[sQueued] = m_queued.front().owner;
+            m_queued.pop_front();
+        }
+
+        // the file may have changed since it was queued
+        if (File_Identity(sQueued.c_str(), sPath, modified, fileSize))
+            LoadFile(sPath, modified, fileSize);
+
+        lock_guard<mutex> lock(m_mutex);
+        m_loading.erase(sQueued);
+        m_loadedSignal.notify_all();
+    }// for
+}// LoaderLoop
@@ -0,0 +1,148 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ImageCache.h
+//
+//      Process wide cache of loaded targa files, so scripts that composite
+//  against the same matte or background many times decode it once.  Entries
+//  are keyed by canonical path and checked against the file's modification
+//  time and size on every lookup, so a file changed on disk is loaded again.
+//  The least recently used entries are dropped once the images held exceed a
+//  byte budget.  Files can be queued for a background thread to load ahead of
+//  need, so decoding overlaps with the work in between.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _C_IMAGE_CACHE
+#define _C_IMAGE_CACHE
+
+#include <stddef.h>
+#include <time.h>
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+
+class TargaImage;
+
+class CImageCache
+{
+    // types
+    public:
+        struct SStats
+        {
+            unsigned long long  lookups;        // calls to Load
+            unsigned long long  hits;           // lookups served from the cache
+            size_t              bytes;          // pixel bytes of the cached images
+            size_t              entries;        // images in the cache
+        };
+
+    // methods
+    public:
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Get the process wide cache.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static CImageCache& Instance();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Get the image in the given file, from the cache if it is there and
+        //  the file has not changed, else loaded and cached.  The image is
+        //  shared with the cache and other callers, so it must not be changed.
+        //  Returns NULL if the file cannot be loaded.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        std::shared_ptr<TargaImage> Load(const char* sFilename);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Queue the given file to be loaded into the cache by the background
+        //  loader, on behalf of the given owner.  A Load of the file waits for a
+        //  load already under way rather than starting a second one.  Does
+        //  nothing if the file is missing, already cached, already queued or
+        //  caching is off.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        void Prefetch(const char* sFilename, unsigned long long owner);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Drop the queued prefetches of the given owner and wait for one of
+        //  its under way, so no load is left running when the owner is done
+        //  with them.  The other owners' prefetches carry on.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        void CancelPrefetches(unsigned long long owner);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Drop every queued prefetch and wait until the loader is idle, for
+        //  when nothing may be using the thread pool.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        void CancelAllPrefetches();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Drop the given file from the cache, for when this process has
+        //  written it and the modification time may not have moved on.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        void Forget(const char* sFilename);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Set the most pixel bytes the cache holds, dropping the least
+        //  recently used images to fit.  0 turns caching off.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        void SetBudget(size_t bytes);
+
+        void   Clear();
+        SStats GetStats();
+
+    private:
+        CImageCache();
+
+        std::shared_ptr<TargaImage> LoadFile(std::string& sPath, time_t modified, long long fileSize);
+        void Evict();
+        void Remove(const std::string& sPath);
+        void LoaderLoop();
+
+    // members
+    private:
+        struct SEntry
+        {
+            std::string                 sPath;          // canonical path of the file
+            time_t                      modified;       // modification time of the file when loaded
+            long long                   fileSize;       // size of the file when loaded
+            std::shared_ptr<TargaImage> pImage;
+            size_t                      bytes;          // pixel bytes of the image
+        };// SEntry
+
+        typedef std::list<SEntry> EntryList;
+
+        struct SPrefetch
+        {
+            std::string                 sPath;          // file as given to Prefetch
+            unsigned long long          owner;          // who asked for it
+        };// SPrefetch
+
+        std::mutex                                              m_mutex;        // guards everything below
+        EntryList                                               m_entries;      // most recently used first
+        std::unordered_map<std::string, EntryList::iterator>    m_index;        // entries by canonical path
+        size_t                                                  m_budget;
+        SStats                                                  m_stats;
+        std::deque<SPrefetch>                                   m_queued;       // prefetches not yet started
+        std::unordered_map<std::string, unsigned long long>     m_loading;      // owners of the prefetches under way
+        std::condition_variable                                 m_queueSignal;  // signalled when a prefetch is queued
+        std::condition_variable                                 m_loadedSignal; // signalled when a prefetch finishes
+        std::thread                                             m_loader;       // runs the prefetches, started on first use
+};// CImageCache
+
+#endif // _C_IMAGE_CACHE
@@ -0,0 +1,93 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ImageView.h
+//
+//      Non owning view of a rectangle of pixels: a base pointer, a size and
+//  a row stride.  Views of the RGBA bytes and of single float planes let
+//  the point operations walk any sub-rectangle row by row, without copies,
+//  and hand whole rows to the row kernels and the thread pool.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _IMAGE_VIEW_H_
+#define _IMAGE_VIEW_H_
+
+#include "ThreadPool.h"
+#include <stddef.h>
+
+template <class T>
+struct SImageView
+{
+    T*      base;       // first element of the top left pixel
+    int     width;      // width of the view in pixels
+    int     height;     // height of the view in pixels
+    int     stride;     // elements from one row to the next
+    int     channels;   // elements per pixel
+    int     x;          // position of the view in the full image, for
+    int     y;          //   patterns tied to image coordinates
+
+    ///////////////////////////////////////////////////////////////////////////////
+    //
+    //      View of a whole image of tightly packed rows.
+    //
+    ///////////////////////////////////////////////////////////////////////////////
+    static SImageView Whole(T* base, int width, int height, int channels)
+    {
+        SImageView view = { base, width, height, width * channels, channels, 0, 0 };
+        return view;
+    }// Whole
+
+    ///////////////////////////////////////////////////////////////////////////////
+    //
+    //      First element of row y of the view.
+    //
+    ///////////////////////////////////////////////////////////////////////////////
+    T* Row(int row) const
+    {
+        return base + (ptrdiff_t)row * stride;
+    }// Row
+
+    ///////////////////////////////////////////////////////////////////////////////
+    //
+    //      View of the w x h rectangle at (left, top) of this view.  The
+    //  rectangle must lie inside the view.
+    //
+    ///////////////////////////////////////////////////////////////////////////////
+    SImageView Sub(int left, int top, int w, int h) const
+    {
+        SImageView view = { Row(top) + left * channels, w, h, stride, channels, x + left, y + top };
+        return view;
+    }// Sub
+
+    ///////////////////////////////////////////////////////////////////////////////
+    //
+    //      Number of elements in one row of the view.
+    //
+    ///////////////////////////////////////////////////////////////////////////////
+    int Row_Length() const
+    {
+        return width * channels;
+    }// Row_Length
+};// SImageView
+
+typedef SImageView<unsigned char>   SPixelView;     // premultiplied RGBA bytes
+typedef SImageView<float>           SPlaneView;     // one float channel
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Call body(row, y) for every row of the view on the thread pool, where
+//  row points at the first element of the row and y counts rows from the top
+//  of the view.
+//
+///////////////////////////////////////////////////////////////////////////////
+template <class T, class Body>
+void For_Each_Row(const SImageView<T>& view, Body body)
+{
+    Parallel_Rows(view.height, view.Row_Length(), [&view, &body](int y0, int y1) {
+        for (int row = y0; row < y1; ++row)
+            body(view.Row(row), row);
+    });
+}// For_Each_Row
+
+#endif // _IMAGE_VIEW_H_
@@ -81,6 +81,18 @@ TargaImage* ImageWidget::Get_Image()
 ///////////////////////////////////////////////////////////////////////////////
 void ImageWidget::draw()
 {
+    // an expose or resize shows the commands lazy mode is holding back too.  The
+    // window cannot be resized while it draws, so if they change the size that
+    // waits for the event loop.
+    if (CScriptHandler::HasPending())
+    {
+        int width = m_pImage ? m_pImage->width : 0;
+        int height = m_pImage ? m_pImage->height : 0;
+        CScriptHandler::Flush(m_pImage);
+        if ((m_pImage ? m_pImage->width : 0) != width || (m_pImage ? m_pImage->height : 0) != height)
+            Fl::add_timeout(0.0, ResizeCallback, this);
+    }// if
+
     if (!m_pImage)          // Don't do anything if the image is empty.
     	return;
     
@@ -99,6 +111,9 @@ void ImageWidget::draw()
 ///////////////////////////////////////////////////////////////////////////////
 void ImageWidget::Redraw()
 {
+    // run any commands lazy mode is holding back first, since they may change the size
+    CScriptHandler::Flush(m_pImage);
+
     if (m_pImage)
 		parent()->size(Max(m_pImage->width, c_minWindowWidth), Max(m_pImage->height + c_buttonPaneHeight, c_minWindowHeight));
     else
@@ -117,7 +132,22 @@ void ImageWidget::CommandCallback(Fl_Widget* pWidget, void* pData)
 {
     ImageWidget* pImageWidget = static_cast<ImageWidget*>(pData);
     CScriptHandler::HandleCommand(static_cast<Fl_Input*>(pWidget)->value(), pImageWidget->m_pImage);
-    pImageWidget->Redraw();
+
+    // in lazy mode the image on screen stays as it was until the commands are
+    // flushed, by a command that needs the pixels or by the window being drawn
+    if (!CScriptHandler::HasPending())
+        pImageWidget->Redraw();
 }// CommandCallback
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Resize the window to the image draw flushed lazy commands into.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ImageWidget::ResizeCallback(void* pData)
+{
+    static_cast<ImageWidget*>(pData)->Redraw();
+}// ResizeCallback
+
+
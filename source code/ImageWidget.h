@@ -33,6 +33,7 @@ class ImageWidget : public Fl_Widget
 
     private:
         static void CommandCallback(Fl_Widget* pWidget, void* pData);           // command entered callback
+        static void ResizeCallback(void* pData);                                // fit the window to an image draw flushed
 
 
     // members
@@ -17,11 +17,17 @@
 #include <Fl/Fl.h>
 #include <Fl/Fl_Window.h>
 #include <string.h>
+#include <stdlib.h>
 #include <iostream>
 #include <vector>
+#include <string>
+#include <algorithm>
 #include "TargaImage.h"
 #include "ImageWidget.h"
 #include "ScriptHandler.h"
+#include "ResultCache.h"
+#include "Benchmark.h"
+#include "Profiler.h"
 
 
 using namespace std;
@@ -29,6 +35,17 @@ using namespace std;
 // constants
 const char      c_sNames[]          = "-names";             // display student names command line switch
 const char      c_sHeadless[]       = "-headless";          // headless command line switch
+const char      c_sBatch[]          = "-batch";             // batch script, after -headless
+const char      c_sInputs[]         = "-inputs";            // batch input images
+const char      c_sOut[]            = "-out";               // batch output directory
+const char      c_sJobs[]           = "-j";                 // batch images in flight
+const char      c_sBench[]          = "-bench";             // run the benchmarks, after -headless
+const char      c_sSizes[]          = "-sizes";             // benchmark image sizes in megapixels, comma separated
+const char      c_sReps[]           = "-reps";              // benchmark runs of each operation
+const char      c_sOnly[]           = "-only";              // benchmark operations, comma separated
+const char      c_sJson[]           = "-json";              // benchmark report file
+const char      c_sProfile[]        = "-profile";           // time the commands, reported at exit
+const char      c_sTrace[]          = "-trace";             // and write them to a Chrome trace file
 
 // globals
 std::vector<char*>  vsStudentNames;
@@ -103,13 +120,100 @@ int main(int argc, char *argv[])
     {
         if (!strcmp(argv[i], c_sNames))                                 // display names
             DisplayNames();
+        else if (!strcmp(argv[i], c_sProfile))                          // time the commands
+            CProfiler::Instance().Start("");
+        else if (!strcmp(argv[i], c_sTrace) && i + 1 < argc)            // time them and write a trace
+            CProfiler::Instance().Start(argv[++i]);
         else if (!bHeadless && !strcmp(argv[i], c_sHeadless))           // go headless
             bHeadless = true;
+        else if (bHeadless && !strcmp(argv[i], c_sBatch) && i + 1 < argc)   // run script on many images
+        {
+            // -batch script -inputs images . . . -out dir [-j N], to the end of the line
+            char*           sScript = argv[++i];
+            vector<char*>   inputs;
+            char*           sOutDir = NULL;
+            int             jobs = 0;
+            bool            bParsed = true;
+
+            while (++i < argc && bParsed)
+            {
+                if (!strcmp(argv[i], c_sInputs))
+                    while (i + 1 < argc && argv[i + 1][0] != '-')
+                        inputs.push_back(argv[++i]);
+                else if (!strcmp(argv[i], c_sOut) && i + 1 < argc)
+                    sOutDir = argv[++i];
+                else if (!strcmp(argv[i], c_sJobs) && i + 1 < argc)
+                    bParsed = (jobs = atoi(argv[++i])) > 0;
+                else
+                    bParsed = false;
+            }// while
+
+            if (!bParsed || !sOutDir || inputs.empty())
+            {
+                cerr << "Usage:" << endl << "Project1 -headless -batch script -inputs images . . . -out dir [-j N]" << endl;
+                return 1;
+            }// if
+
+            int status = CScriptHandler::HandleBatch(sScript, inputs, sOutDir, jobs) ? 0 : 1;
+            if (CResultCache::Instance().IsOpen())
+                CResultCache::Instance().PrintStats();
+            if (CProfiler::Instance().IsRecording())
+                CProfiler::Instance().Report();
+            return status;
+        }// else if
+        else if (bHeadless && !strcmp(argv[i], c_sBench))               // time the operations
+        {
+            // -bench [-sizes MP,...] [-reps N] [-only operations,...] [-json file], to the end of the line
+            CBenchmark::SOptions    options = CBenchmark::Defaults();
+            bool                    bParsed = true;
+
+            while (++i < argc && bParsed)
+            {
+                if (!strcmp(argv[i], c_sSizes) && i + 1 < argc)
+                {
+                    options.megapixels.clear();
+                    for (char* sSize = argv[++i]; bParsed && *sSize; sSize += *sSize == ',')
+                    {
+                        char* sEnd;
+                        options.megapixels.push_back(strtod(sSize, &sEnd));
+                        bParsed = sEnd != sSize && options.megapixels.back() > 0 && (*sEnd == ',' || !*sEnd);
+                        sSize = sEnd;
+                    }// for
+                    bParsed = bParsed && !options.megapixels.empty();
+                }// if
+                else if (!strcmp(argv[i], c_sReps) && i + 1 < argc)
+                    bParsed = (options.reps = atoi(argv[++i])) > 0;
+                else if (!strcmp(argv[i], c_sOnly) && i + 1 < argc)
+                {
+                    string sOnly = argv[++i];
+                    for (size_t start = 0, end; start <= sOnly.size(); start = end + 1)
+                    {
+                        end = min(sOnly.find(',', start), sOnly.size());
+                        if (end > start)
+                            options.only.push_back(sOnly.substr(start, end - start));
+                    }// for
+                }// else if
+                else if (!strcmp(argv[i], c_sJson) && i + 1 < argc)
+                    options.sJson = argv[++i];
+                else
+                    bParsed = false;
+            }// while
+
+            if (!bParsed)
+            {
+                cerr << "Usage:" << endl << "Project1 -headless -bench [-sizes MP,...] [-reps N] [-only operations,...] [-json file]" << endl;
+                return 1;
+            }// if
+
+            return CBenchmark::Run(options) ? 0 : 1;
+        }// else if
         else if (bHeadless && strcmp(argv[i], c_sHeadless))             // run script file
             CScriptHandler::HandleScriptFile(argv[i], pImage);
         else
         {
-            cerr << "Usage:" << endl << "Project1 [-names] [-headless scriptFilenames . . .]" << endl;
+            cerr << "Usage:" << endl << "Project1 [-names] [-profile] [-trace file] [-headless scriptFilenames . . .]" << endl
+                 << "Project1 -headless -batch script -inputs images . . . -out dir [-j N]" << endl
+                 << "Project1 -headless -bench [-sizes MP,...] [-reps N] [-only operations,...] [-json file]" << endl;
             return 0;
         }// else
     }// for
@@ -120,6 +224,14 @@ int main(int argc, char *argv[])
 //             << "name in MakeNames in Main.cpp.  If you do not" << endl
 //             << "comply, you will not be in compliance.  Have a nice day." << endl;
 
+    // report what the scripts saved by reusing results
+    if (bHeadless && CResultCache::Instance().IsOpen())
+        CResultCache::Instance().PrintStats();
+
+    // report where the time went
+    if (bHeadless && CProfiler::Instance().IsRecording())
+        CProfiler::Instance().Report();
+
     // run the gui if we're not headless
     if (!bHeadless)
     {
@@ -133,7 +245,10 @@ int main(int argc, char *argv[])
 
         window.show(argc, argv);
 
-        return Fl::run();
+        int status = Fl::run();
+        if (CProfiler::Instance().IsRecording())
+            CProfiler::Instance().Report();
+        return status;
     }// else
 
     return 0;
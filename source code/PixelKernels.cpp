@@ -0,0 +1,389 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      PixelKernels.cpp
+//
+//      Scalar, SSE4.1 and AVX2 versions of the 8 bit RGBA row kernels, and
+//  the dispatch between them.  The vector versions run the bulk of a row
+//  four (SSE4.1) or eight (AVX2) pixels per register and leave the tail to
+//  the scalar version.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "PixelKernels.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define PIXEL_KERNELS_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TARGET_SSE41
+#define TARGET_AVX2
+#else
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// constants
+const int       c_lumaRed           = 77;           // luminance weights in 8.8 fixed point, summing to 256
+const int       c_lumaGreen         = 151;
+const int       c_lumaBlue          = 28;
+
+// kernel set picked for this CPU
+struct SPixelKernels
+{
+    const char* name;
+    void (*gray)(uint8_t* row, int count);
+    void (*quantUniform)(uint8_t* row, int count);
+    void (*threshold)(uint8_t* row, int count, uint8_t threshold);
+    void (*thresholdMask)(uint8_t* row, int count, const uint8_t thresholds[4], int phase);
+};// SPixelKernels
+
+
+// Uniform quantization levels.  Entries 0 - 7 are the 3 bit red and green
+// levels, (uint8_t)(i * 36.42857) as Quant_Uniform always used, so the top
+// level is 254.  Entries 8 - 11 are the 2 bit blue levels, i * 85.
+static const uint8_t c_quantLevels[16] = { 0, 36, 72, 109, 145, 182, 218, 254,
+                                           0, 85, 170, 255, 0, 0, 0, 0 };
+
+// 4 x 4 clustered dot dither thresholds
+static const uint8_t c_clusterMask[4][4] = { { 180, 90, 150, 60 },
+                                             { 15, 240, 210, 105 },
+                                             { 120, 195, 225, 30 },
+                                             { 45, 135, 75, 165 } };
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Scalar kernels.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Gray_Row_Scalar(uint8_t* row, int count)
+{
+    for (int i = 0; i < count; ++i, row += 4)
+    {
+        uint8_t luminance = (uint8_t)((c_lumaRed * row[0] + c_lumaGreen * row[1] + c_lumaBlue * row[2]) >> 8);
+        row[0] = row[1] = row[2] = luminance;
+    }// for
+}// Gray_Row_Scalar
+
+
+static void Quant_Uniform_Row_Scalar(uint8_t* row, int count)
+{
+    for (int i = 0; i < count; ++i, row += 4)
+    {
+        row[0] = c_quantLevels[row[0] >> 5];
+        row[1] = c_quantLevels[row[1] >> 5];
+        row[2] = c_quantLevels[8 + (row[2] >> 6)];
+    }// for
+}// Quant_Uniform_Row_Scalar
+
+
+static void Threshold_Row_Scalar(uint8_t* row, int count, uint8_t threshold)
+{
+    for (int i = 0; i < count; ++i, row += 4)
+    {
+        row[0] = (row[0] > threshold) ? 255 : 0;
+        row[1] = (row[1] > threshold) ? 255 : 0;
+        row[2] = (row[2] > threshold) ? 255 : 0;
+    }// for
+}// Threshold_Row_Scalar
+
+
+static void Threshold_Mask_Row_Scalar(uint8_t* row, int count, const uint8_t thresholds[4], int phase)
+{
+    for (int i = 0; i < count; ++i, row += 4)
+    {
+        uint8_t threshold = thresholds[(phase + i) & 3];
+        row[0] = (row[0] > threshold) ? 255 : 0;
+        row[1] = (row[1] > threshold) ? 255 : 0;
+        row[2] = (row[2] > threshold) ? 255 : 0;
+    }// for
+}// Threshold_Mask_Row_Scalar
+
+
+#ifdef PIXEL_KERNELS_X86
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      SSE4.1 kernels, four pixels per register.
+//
+///////////////////////////////////////////////////////////////////////////////
+TARGET_SSE41 static inline __m128i Gray_4_SSE41(__m128i pixels)
+{
+    const __m128i weights = _mm_setr_epi16(c_lumaRed, c_lumaGreen, c_lumaBlue, 0, c_lumaRed, c_lumaGreen, c_lumaBlue, 0);
+    const __m128i spread = _mm_setr_epi8(0, 0, 0, -1, 4, 4, 4, -1, 8, 8, 8, -1, 12, 12, 12, -1);
+    const __m128i alphaMask = _mm_set1_epi32((int)0xFF000000);
+
+    // r * wr + g * wg and b * wb per pixel, then one sum per pixel
+    __m128i low = _mm_madd_epi16(_mm_cvtepu8_epi16(pixels), weights);
+    __m128i high = _mm_madd_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(pixels, 8)), weights);
+    __m128i luminance = _mm_srli_epi32(_mm_hadd_epi32(low, high), 8);
+
+    return _mm_or_si128(_mm_shuffle_epi8(luminance, spread), _mm_and_si128(pixels, alphaMask));
+}// Gray_4_SSE41
+
+
+TARGET_SSE41 static void Gray_Row_SSE41(uint8_t* row, int count)
+{
+    int i = 0;
+    for (; i + 4 <= count; i += 4, row += 16)
+        _mm_storeu_si128((__m128i*)row, Gray_4_SSE41(_mm_loadu_si128((const __m128i*)row)));
+    Gray_Row_Scalar(row, count - i);
+}// Gray_Row_SSE41
+
+
+TARGET_SSE41 static void Quant_Uniform_Row_SSE41(uint8_t* row, int count)
+{
+    const __m128i levels = _mm_loadu_si128((const __m128i*)c_quantLevels);
+    const __m128i blueMask = _mm_set1_epi32(0x00FF0000);
+    const __m128i alphaMask = _mm_set1_epi32((int)0xFF000000);
+    const __m128i blueBase = _mm_set1_epi32(0x00080000);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4, row += 16)
+    {
+        __m128i pixels = _mm_loadu_si128((const __m128i*)row);
+
+        // level index per byte: v >> 5 for red and green, 8 + (v >> 6) for blue
+        __m128i index3 = _mm_and_si128(_mm_srli_epi16(pixels, 5), _mm_set1_epi8(0x07));
+        __m128i index2 = _mm_add_epi8(_mm_and_si128(_mm_srli_epi16(pixels, 6), _mm_set1_epi8(0x03)), blueBase);
+        __m128i index = _mm_blendv_epi8(index3, index2, blueMask);
+
+        __m128i quantized = _mm_andnot_si128(alphaMask, _mm_shuffle_epi8(levels, index));
+        _mm_storeu_si128((__m128i*)row, _mm_or_si128(quantized, _mm_and_si128(pixels, alphaMask)));
+    }// for
+    Quant_Uniform_Row_Scalar(row, count - i);
+}// Quant_Uniform_Row_SSE41
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Compare every color byte against the threshold byte in the same place,
+//  unsigned, and keep alpha.
+//
+///////////////////////////////////////////////////////////////////////////////
+TARGET_SSE41 static inline __m128i Threshold_4_SSE41(__m128i pixels, __m128i thresholds)
+{
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    const __m128i alphaMask = _mm_set1_epi32((int)0xFF000000);
+
+    __m128i above = _mm_cmpgt_epi8(_mm_xor_si128(pixels, bias), _mm_xor_si128(thresholds, bias));
+    return _mm_blendv_epi8(above, pixels, alphaMask);
+}// Threshold_4_SSE41
+
+
+TARGET_SSE41 static void Threshold_Row_SSE41(uint8_t* row, int count, uint8_t threshold)
+{
+    const __m128i thresholds = _mm_set1_epi8((char)threshold);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4, row += 16)
+        _mm_storeu_si128((__m128i*)row, Threshold_4_SSE41(_mm_loadu_si128((const __m128i*)row), thresholds));
+    Threshold_Row_Scalar(row, count - i, threshold);
+}// Threshold_Row_SSE41
+
+
+TARGET_SSE41 static void Threshold_Mask_Row_SSE41(uint8_t* row, int count, const uint8_t thresholds[4], int phase)
+{
+    // a register holds four pixels, so the tiled mask row lines up with every register
+    uint8_t tile[16];
+    for (int i = 0; i < 16; ++i)
+        tile[i] = thresholds[(phase + i / 4) & 3];
+    const __m128i tiled = _mm_loadu_si128((const __m128i*)tile);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4, row += 16)
+        _mm_storeu_si128((__m128i*)row, Threshold_4_SSE41(_mm_loadu_si128((const __m128i*)row), tiled));
+    Threshold_Mask_Row_Scalar(row, count - i, thresholds, phase + i);
+}// Threshold_Mask_Row_SSE41
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      AVX2 kernels, eight pixels per register.
+//
+///////////////////////////////////////////////////////////////////////////////
+TARGET_AVX2 static void Gray_Row_AVX2(uint8_t* row, int count)
+{
+    const __m256i weights = _mm256_setr_epi16(c_lumaRed, c_lumaGreen, c_lumaBlue, 0, c_lumaRed, c_lumaGreen, c_lumaBlue, 0,
+                                              c_lumaRed, c_lumaGreen, c_lumaBlue, 0, c_lumaRed, c_lumaGreen, c_lumaBlue, 0);
+    const __m256i spread = _mm256_setr_epi8(0, 0, 0, -1, 4, 4, 4, -1, 8, 8, 8, -1, 12, 12, 12, -1,
+                                            0, 0, 0, -1, 4, 4, 4, -1, 8, 8, 8, -1, 12, 12, 12, -1);
+    const __m256i order = _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7);
+    const __m256i alphaMask = _mm256_set1_epi32((int)0xFF000000);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8, row += 32)
+    {
+        __m256i pixels = _mm256_loadu_si256((const __m256i*)row);
+        __m256i low = _mm256_madd_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)row)), weights);
+        __m256i high = _mm256_madd_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(row + 16))), weights);
+
+        // hadd works per 128 bit lane, giving pixels 0 1 4 5 | 2 3 6 7
+        __m256i luminance = _mm256_permutevar8x32_epi32(_mm256_hadd_epi32(low, high), order);
+        luminance = _mm256_srli_epi32(luminance, 8);
+
+        __m256i gray = _mm256_or_si256(_mm256_shuffle_epi8(luminance, spread), _mm256_and_si256(pixels, alphaMask));
+        _mm256_storeu_si256((__m256i*)row, gray);
+    }// for
+    Gray_Row_SSE41(row, count - i);
+}// Gray_Row_AVX2
+
+
+TARGET_AVX2 static void Quant_Uniform_Row_AVX2(uint8_t* row, int count)
+{
+    const __m256i levels = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)c_quantLevels));
+    const __m256i blueMask = _mm256_set1_epi32(0x00FF0000);
+    const __m256i alphaMask = _mm256_set1_epi32((int)0xFF000000);
+    const __m256i blueBase = _mm256_set1_epi32(0x00080000);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8, row += 32)
+    {
+        __m256i pixels = _mm256_loadu_si256((const __m256i*)row);
+
+        __m256i index3 = _mm256_and_si256(_mm256_srli_epi16(pixels, 5), _mm256_set1_epi8(0x07));
+        __m256i index2 = _mm256_add_epi8(_mm256_and_si256(_mm256_srli_epi16(pixels, 6), _mm256_set1_epi8(0x03)), blueBase);
+        __m256i index = _mm256_blendv_epi8(index3, index2, blueMask);
+
+        __m256i quantized = _mm256_andnot_si256(alphaMask, _mm256_shuffle_epi8(levels, index));
+        _mm256_storeu_si256((__m256i*)row, _mm256_or_si256(quantized, _mm256_and_si256(pixels, alphaMask)));
+    }// for
+    Quant_Uniform_Row_SSE41(row, count - i);
+}// Quant_Uniform_Row_AVX2
+
+
+TARGET_AVX2 static inline __m256i Threshold_8_AVX2(__m256i pixels, __m256i thresholds)
+{
+    const __m256i bias = _mm256_set1_epi8((char)0x80);
+    const __m256i alphaMask = _mm256_set1_epi32((int)0xFF000000);
+
+    __m256i above = _mm256_cmpgt_epi8(_mm256_xor_si256(pixels, bias), _mm256_xor_si256(thresholds, bias));
+    return _mm256_blendv_epi8(above, pixels, alphaMask);
+}// Threshold_8_AVX2
+
+
+TARGET_AVX2 static void Threshold_Row_AVX2(uint8_t* row, int count, uint8_t threshold)
+{
+    const __m256i thresholds = _mm256_set1_epi8((char)threshold);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8, row += 32)
+        _mm256_storeu_si256((__m256i*)row, Threshold_8_AVX2(_mm256_loadu_si256((const __m256i*)row), thresholds));
+    Threshold_Row_SSE41(row, count - i, threshold);
+}// Threshold_Row_AVX2
+
+
+TARGET_AVX2 static void Threshold_Mask_Row_AVX2(uint8_t* row, int count, const uint8_t thresholds[4], int phase)
+{
+    uint8_t tile[32];
+    for (int i = 0; i < 32; ++i)
+        tile[i] = thresholds[(phase + i / 4) & 3];
+    const __m256i tiled = _mm256_loadu_si256((const __m256i*)tile);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8, row += 32)
+        _mm256_storeu_si256((__m256i*)row, Threshold_8_AVX2(_mm256_loadu_si256((const __m256i*)row), tiled));
+    Threshold_Mask_Row_SSE41(row, count - i, thresholds, phase + i);
+}// Threshold_Mask_Row_AVX2
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Best instruction set the CPU and OS support: 2 for AVX2, 1 for SSE4.1,
+//  0 for neither.
+//
+///////////////////////////////////////////////////////////////////////////////
+static int Cpu_Level()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+
+    __cpuid(info, 1);
+    bool bSSE41 = (info[2] & (1 << 19)) != 0;
+    bool bOSXSave = (info[2] & (1 << 27)) != 0;
+    bool bAVX = (info[2] & (1 << 28)) != 0;
+
+    bool bAVX2 = false;
+    if (maxLeaf >= 7 && bOSXSave && bAVX && (_xgetbv(0) & 0x6) == 0x6)
+    {
+        __cpuidex(info, 7, 0);
+        bAVX2 = (info[1] & (1 << 5)) != 0;
+    }// if
+
+    return bAVX2 ? 2 : (bSSE41 ? 1 : 0);
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return 2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return 1;
+    return 0;
+#endif
+}// Cpu_Level
+
+#endif // PIXEL_KERNELS_X86
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Pick the kernel set once, on first use.
+//
+///////////////////////////////////////////////////////////////////////////////
+static const SPixelKernels& Kernels()
+{
+    static const SPixelKernels scalar = { "scalar", Gray_Row_Scalar, Quant_Uniform_Row_Scalar,
+                                          Threshold_Row_Scalar, Threshold_Mask_Row_Scalar };
+#ifdef PIXEL_KERNELS_X86
+    static const SPixelKernels sse41 = { "sse4.1", Gray_Row_SSE41, Quant_Uniform_Row_SSE41,
+                                         Threshold_Row_SSE41, Threshold_Mask_Row_SSE41 };
+    static const SPixelKernels avx2 = { "avx2", Gray_Row_AVX2, Quant_Uniform_Row_AVX2,
+                                        Threshold_Row_AVX2, Threshold_Mask_Row_AVX2 };
+
+    static const int level = Cpu_Level();
+    if (level == 2)
+        return avx2;
+    if (level == 1)
+        return sse41;
+#endif
+    return scalar;
+}// Kernels
+
+
+void Gray_Row(uint8_t* row, int count)
+{
+    Kernels().gray(row, count);
+}// Gray_Row
+
+
+void Quant_Uniform_Row(uint8_t* row, int count)
+{
+    Kernels().quantUniform(row, count);
+}// Quant_Uniform_Row
+
+
+void Threshold_Row(uint8_t* row, int count, uint8_t threshold)
+{
+    Kernels().threshold(row, count, threshold);
+}// Threshold_Row
+
+
+void Threshold_Mask_Row(uint8_t* row, int count, const uint8_t thresholds[4], int phase)
+{
+    Kernels().thresholdMask(row, count, thresholds, phase);
+}// Threshold_Mask_Row
+
+
+void Threshold_Cluster_Row(uint8_t* row, int count, int x, int y)
+{
+    Kernels().thresholdMask(row, count, c_clusterMask[y % 4], x % 4);
+}// Threshold_Cluster_Row
+
+
+const char* Pixel_Kernels_Name()
+{
+    return Kernels().name;
+}// Pixel_Kernels_Name
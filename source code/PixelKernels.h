@@ -0,0 +1,64 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      PixelKernels.h
+//
+//      8 bit RGBA row kernels for the point operations.  Each kernel has a
+//  scalar version and, on x86, SSE4.1 and AVX2 versions picked once at run
+//  time from the CPU.  All versions give identical results.  Alpha is never
+//  changed.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _PIXEL_KERNELS_H_
+#define _PIXEL_KERNELS_H_
+
+#include <stdint.h>
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Replace red, green and blue with the fixed point luminance
+//  (77 R + 151 G + 28 B) >> 8, ie. weights 0.30, 0.59 and 0.11 in 8.8 fixed
+//  point.  The weights sum to 256, so gray pixels stay unchanged.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Gray_Row(uint8_t* row, int count);
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Uniform quantization to 3 bits of red and green and 2 bits of blue,
+//  scaled back up to the full 0 - 255 range.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Quant_Uniform_Row(uint8_t* row, int count);
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Set each color channel to 255 if it is greater than threshold, else 0.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Threshold_Row(uint8_t* row, int count, uint8_t threshold);
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      As Threshold_Row, but pixel i of the row is compared against
+//  thresholds[(phase + i) % 4], for tiled ordered dither masks.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Threshold_Mask_Row(uint8_t* row, int count, const uint8_t thresholds[4], int phase);
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Threshold_Mask_Row against the 4 x 4 clustered dot mask, tiled from
+//  the image origin.  (x, y) is the image position of the first pixel.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Threshold_Cluster_Row(uint8_t* row, int count, int x, int y);
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Name of the kernel set in use: "avx2", "sse4.1" or "scalar".
+//
+///////////////////////////////////////////////////////////////////////////////
+const char* Pixel_Kernels_Name();
+
+#endif // _PIXEL_KERNELS_H_
@@ -0,0 +1,393 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Profiler.cpp
+//
+//      Implementation of CProfiler and CProfileScope methods.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Profiler.h"
+#include "TargaImage.h"
+#include "BufferPool.h"
+#include <string.h>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <algorithm>
+#include <unordered_map>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+using namespace std;
+
+// constants
+const char* const   c_asPhases[]        = { "parse", "load", "compute", "save" };   // by CProfiler::EPhase
+
+thread_local vector<CProfiler::SRecord> CProfiler::s_open;
+
+// number of the calling thread in the records, -1 until it first records
+static thread_local int s_threadNumber = -1;
+static atomic<int>      s_threadCount(0);
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      CPU time used by the whole process so far, in ns.
+//
+///////////////////////////////////////////////////////////////////////////////
+static long long Process_Cpu_Time()
+{
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+        return 0;
+    ULARGE_INTEGER kernelTime, userTime;
+    kernelTime.LowPart = kernel.dwLowDateTime;
+    kernelTime.HighPart = kernel.dwHighDateTime;
+    userTime.LowPart = user.dwLowDateTime;
+    userTime.HighPart = user.dwHighDateTime;
+    return (long long)(kernelTime.QuadPart + userTime.QuadPart) * 100;
+#else
+    timespec now;
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now) != 0)
+        return 0;
+    return (long long)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}// Process_Cpu_Time
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Quote a string for JSON.
+//
+///////////////////////////////////////////////////////////////////////////////
+static string Json_String(const string& sText)
+{
+    string sQuoted = "\"";
+    for (size_t i = 0; i < sText.size(); ++i)
+    {
+        unsigned char c = (unsigned char)sText[i];
+        if (c == '"' || c == '\\')
+        {
+            sQuoted += '\\';
+            sQuoted += (char)c;
+        }// if
+        else if (c < 0x20)
+        {
+            char sEscape[8];
+            sprintf(sEscape, "\\u%04x", c);
+            sQuoted += sEscape;
+        }// else if
+        else
+            sQuoted += (char)c;
+    }// for
+    return sQuoted + "\"";
+}// Json_String
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Get the process wide profiler.  Never destroyed, like the caches.
+//
+///////////////////////////////////////////////////////////////////////////////
+CProfiler& CProfiler::Instance()
+{
+    static CProfiler* pProfiler = new CProfiler;
+    return *pProfiler;
+}// Instance
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  The profiler starts out not recording.
+//
+///////////////////////////////////////////////////////////////////////////////
+CProfiler::CProfiler()
+    : m_bRecording(false), m_origin(chrono::steady_clock::now())
+{}// CProfiler
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Start recording.  A trace file given before is kept if none is given
+//  now.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CProfiler::Start(const string& sTraceFile)
+{
+    lock_guard<mutex> lock(m_mutex);
+    if (!sTraceFile.empty())
+        m_sTraceFile = sTraceFile;
+    m_bRecording = true;
+}// Start
+
+
+bool CProfiler::IsRecording() const
+{
+    return m_bRecording;
+}// IsRecording
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Open a record on this thread.  The pool's marked peak is restarted
+//  for it, after the record around it, if any, has taken the peak so far.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CProfiler::Begin(const string& sName, const string& sText, const TargaImage* pImage)
+{
+    if (s_threadNumber < 0)
+        s_threadNumber = s_threadCount++;
+
+    CBufferPool&        pool = CBufferPool::Instance();
+    CBufferPool::SStats stats = pool.GetStats();
+    if (!s_open.empty())
+        s_open.back().peak = max(s_open.back().peak, stats.markBytesInUse);
+    pool.MarkPeak();
+
+    SRecord record;
+    record.sName = sName;
+    record.sText = sText;
+    record.thread = s_threadNumber;
+    record.depth = (int)s_open.size();
+    record.wall = record.cpu = 0;
+    for (int phase = 0; phase < NUM_PHASES; ++phase)
+        record.phases[phase] = 0;
+    record.allocated = 0;
+    record.peak = stats.bytesInUse;
+    record.pixels = pImage ? (long long)pImage->width * pImage->height : 0;
+    record.allocatedStart = stats.bytesAllocated;
+    record.phase = PARSE;
+    record.cpuStart = Process_Cpu_Time();
+    record.start = record.phaseStart = Now();
+
+    s_open.push_back(record);
+}// Begin
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Move this thread's innermost record on to the given phase.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CProfiler::Phase(EPhase phase)
+{
+    if (s_open.empty() || s_open.back().phase == phase)
+        return;
+
+    SRecord&    record = s_open.back();
+    long long   now = Now();
+    if (now > record.phaseStart)
+    {
+        SSegment segment = { record.phase, record.phaseStart, now - record.phaseStart };
+        record.segments.push_back(segment);
+        record.phases[record.phase] += segment.duration;
+    }// if
+
+    record.phase = phase;
+    record.phaseStart = now;
+}// Phase
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Close this thread's innermost record, and keep it if still recording.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CProfiler::End(const TargaImage* pImage)
+{
+    if (s_open.empty())
+        return;
+
+    Phase(NUM_PHASES);
+
+    SRecord             record = s_open.back();
+    CBufferPool::SStats stats = CBufferPool::Instance().GetStats();
+    s_open.pop_back();
+
+    record.wall = record.phaseStart - record.start;
+    record.cpu = Process_Cpu_Time() - record.cpuStart;
+    record.allocated = stats.bytesAllocated - record.allocatedStart;
+    record.peak = max(record.peak, stats.markBytesInUse);
+    if (!record.pixels && pImage)
+        record.pixels = (long long)pImage->width * pImage->height;
+    if (!s_open.empty())
+        s_open.back().peak = max(s_open.back().peak, record.peak);
+
+    if (!m_bRecording)
+        return;
+
+    lock_guard<mutex> lock(m_mutex);
+    m_records.push_back(record);
+}// End
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write the records summed per command, then the trace.  Totals count
+//  only the outermost records, since the inner ones are part of them.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CProfiler::Report()
+{
+    m_bRecording = false;
+
+    lock_guard<mutex> lock(m_mutex);
+
+    // sum the records per command, in the order the commands first ended
+    vector<SRecord>                 totals;
+    unordered_map<string, size_t>   index;
+    vector<int>                     counts;
+    long long                       wall = 0;
+    size_t                          outermost = 0;
+    for (size_t i = 0; i < m_records.size(); ++i)
+    {
+        const SRecord& record = m_records[i];
+        if (!record.depth)
+        {
+            wall += record.wall;
+            ++outermost;
+        }// if
+
+        unordered_map<string, size_t>::iterator found = index.find(record.sName);
+        if (found == index.end())
+        {
+            index[record.sName] = totals.size();
+            totals.push_back(record);
+            counts.push_back(1);
+            continue;
+        }// if
+
+        SRecord& total = totals[found->second];
+        total.wall += record.wall;
+        total.cpu += record.cpu;
+        for (int phase = 0; phase < NUM_PHASES; ++phase)
+            total.phases[phase] += record.phases[phase];
+        total.allocated += record.allocated;
+        total.peak = max(total.peak, record.peak);
+        total.pixels += record.pixels;
+        ++counts[found->second];
+    }// for
+
+    const double millisecond = 1e6,
+                 megabyte = 1024.0 * 1024.0;
+
+    cout << "Profile: " << m_records.size() << " records, " << outermost << " outermost taking "
+         << wall / millisecond << " ms" << endl;
+    cout << left << setw(24) << "command" << right << setw(7) << "count" << setw(11) << "wall ms" << setw(11) << "cpu ms";
+    for (int phase = 0; phase < NUM_PHASES; ++phase)
+        cout << setw(11) << string(c_asPhases[phase]) + " ms";
+    cout << setw(11) << "alloc MB" << setw(11) << "peak MB" << setw(11) << "Mpixels" << setw(11) << "ns/pixel" << endl;
+
+    cout << fixed << setprecision(2);
+    for (size_t i = 0; i < totals.size(); ++i)
+    {
+        const SRecord& total = totals[i];
+        cout << left << setw(24) << total.sName.substr(0, 23) << right << setw(7) << counts[i]
+             << setw(11) << total.wall / millisecond << setw(11) << total.cpu / millisecond;
+        for (int phase = 0; phase < NUM_PHASES; ++phase)
+            cout << setw(11) << total.phases[phase] / millisecond;
+        cout << setw(11) << total.allocated / megabyte << setw(11) << total.peak / megabyte
+             << setw(11) << total.pixels / 1e6;
+        if (total.pixels)
+            cout << setw(11) << (double)total.wall / total.pixels;
+        else
+            cout << setw(11) << "-";
+        cout << endl;
+    }// for
+    cout.unsetf(ios::floatfield);
+    cout << setprecision(6);
+
+    if (!m_sTraceFile.empty())
+    {
+        if (WriteTrace(m_sTraceFile))
+            cout << "Profile trace written to " << m_sTraceFile << endl;
+        else
+            cout << "Unable to write profile trace:  " << m_sTraceFile << endl;
+    }// if
+
+    m_records.clear();
+    m_sTraceFile.clear();
+}// Report
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Time since the profiler was made, in ns.
+//
+///////////////////////////////////////////////////////////////////////////////
+long long CProfiler::Now() const
+{
+    return (long long)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - m_origin).count();
+}// Now
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write the records as Chrome trace events: one complete event per
+//  command, with its phases as events nested inside it.  Times are in
+//  microseconds.  The caller holds the lock.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CProfiler::WriteTrace(const string& sFilename)
+{
+    ofstream trace(sFilename.c_str());
+    if (!trace)
+        return false;
+
+    trace << fixed << setprecision(3) << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    for (size_t i = 0; i < m_records.size(); ++i)
+    {
+        const SRecord& record = m_records[i];
+        trace << (i ? "," : "") << "\n{\"name\": " << Json_String(record.sName) << ", \"cat\": \"command\", \"ph\": \"X\""
+              << ", \"pid\": 1, \"tid\": " << record.thread << ", \"ts\": " << record.start / 1e3 << ", \"dur\": " << record.wall / 1e3
+              << ", \"args\": {\"text\": " << Json_String(record.sText) << ", \"cpu_ms\": " << record.cpu / 1e6
+              << ", \"allocated_bytes\": " << record.allocated << ", \"peak_bytes\": " << record.peak
+              << ", \"pixels\": " << record.pixels << "}}";
+
+        for (size_t j = 0; j < record.segments.size(); ++j)
+        {
+            const SSegment& segment = record.segments[j];
+            trace << ",\n{\"name\": \"" << c_asPhases[segment.phase] << "\", \"cat\": \"phase\", \"ph\": \"X\""
+                  << ", \"pid\": 1, \"tid\": " << record.thread << ", \"ts\": " << segment.start / 1e3
+                  << ", \"dur\": " << segment.duration / 1e3 << "}";
+        }// for
+    }// for
+    trace << "\n]}\n";
+
+    return !trace.fail();
+}// WriteTrace
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Open a record for the enclosing block if the profiler is recording.
+//
+///////////////////////////////////////////////////////////////////////////////
+CProfileScope::CProfileScope(const char* sName, const char* sText, TargaImage* const& pImage)
+    : m_bActive(CProfiler::Instance().IsRecording()), m_pImage(pImage)
+{
+    if (!m_bActive)
+        return;
+
+    if (!sText)
+        sText = "";
+    string sWord = sName ? sName : string(sText + strspn(sText, " \t"), strcspn(sText + strspn(sText, " \t"), " \t\r\n"));
+    CProfiler::Instance().Begin(sWord, sText, pImage);
+}// CProfileScope
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Close the record, if one was opened.
+//
+///////////////////////////////////////////////////////////////////////////////
+CProfileScope::~CProfileScope()
+{
+    if (m_bActive)
+        CProfiler::Instance().End(m_pImage);
+}// ~CProfileScope
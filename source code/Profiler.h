@@ -0,0 +1,147 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Profiler.h
+//
+//      Opt in timing of script commands, to find the line that makes a script
+//  slow.  While recording, each command becomes a record of its wall and CPU
+//  time split into parse, load, compute and save phases, the pool bytes it
+//  allocated and the most in use while it ran, and the pixels it worked on.
+//  A report sums the records per command and can write them out as Chrome
+//  trace events.  CPU time and memory are counted for the whole process, so
+//  they include the pool workers and, in a batch, the jobs running alongside.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _C_PROFILER
+#define _C_PROFILER
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+class TargaImage;
+
+class CProfiler
+{
+    // types
+    public:
+        enum EPhase
+        {
+            PARSE,
+            LOAD,
+            COMPUTE,
+            SAVE,
+            NUM_PHASES
+        };// EPhase
+
+    // methods
+    public:
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Get the process wide profiler.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static CProfiler& Instance();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Start recording.  If sTraceFile is not empty the next report also
+        //  writes the records to it as Chrome trace event JSON; if it is, a
+        //  trace file given before is kept.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        void Start(const std::string& sTraceFile);
+        bool IsRecording() const;
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Record a command run on this thread.  Begin starts it in the parse
+        //  phase, Phase moves it on to another phase and End finishes it.
+        //  Records nest, and an outer record's times include the inner ones.
+        //  Phase does nothing if this thread has no record open.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        void Begin(const std::string& sName, const std::string& sText, const TargaImage* pImage);
+        void Phase(EPhase phase);
+        void End(const TargaImage* pImage);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Stop recording, write the summary table to standard out and the
+        //  trace file if one was given, and drop the records.  Commands still
+        //  running are left out.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        void Report();
+
+    private:
+        CProfiler();
+
+        long long Now() const;
+        bool WriteTrace(const std::string& sFilename);
+
+    // members
+    private:
+        struct SSegment
+        {
+            int                 phase;
+            long long           start;          // ns since m_origin
+            long long           duration;       // ns
+        };// SSegment
+
+        struct SRecord
+        {
+            std::string             sName;          // command, or the commands fused into one pass
+            std::string             sText;          // what was run
+            int                     thread;         // number of the thread it ran on, in order of first use
+            int                     depth;          // records open around it on its thread
+            long long               start;          // ns since m_origin
+            long long               wall;           // ns
+            long long               cpu;            // process CPU ns
+            long long               phases[NUM_PHASES]; // wall ns in each phase
+            unsigned long long      allocated;      // pool bytes handed out
+            size_t                  peak;           // most pool bytes in use
+            long long               pixels;         // pixels of the image worked on
+            std::vector<SSegment>   segments;       // the phases in the order they ran
+
+            // while open
+            long long               cpuStart;
+            unsigned long long      allocatedStart;
+            int                     phase;
+            long long               phaseStart;
+        };// SRecord
+
+        static thread_local std::vector<SRecord> s_open;        // records open on this thread, innermost last
+
+        std::atomic<bool>                       m_bRecording;
+        std::chrono::steady_clock::time_point   m_origin;       // when the profiler was made
+        std::mutex                              m_mutex;        // guards everything below
+        std::string                             m_sTraceFile;   // empty for no trace
+        std::vector<SRecord>                    m_records;      // finished records, in the order they ended
+};// CProfiler
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Records the enclosing block as one command, if the profiler is
+//  recording when the block starts.  A NULL name uses the first word of the
+//  text.  The image is looked at again at the end, so a command that makes
+//  an image, like load, is counted by the pixels it made.
+//
+///////////////////////////////////////////////////////////////////////////////
+class CProfileScope
+{
+    // methods
+    public:
+        CProfileScope(const char* sName, const char* sText, TargaImage* const& pImage);
+        ~CProfileScope();
+
+    // members
+    private:
+        bool                m_bActive;
+        TargaImage* const&  m_pImage;
+};// CProfileScope
+
+#endif // _C_PROFILER
@@ -0,0 +1,435 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ResultCache.cpp
+//
+//      Implementation of CResultCache methods.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "ResultCache.h"
+#include "TargaImage.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+using namespace std;
+
+// constants
+const unsigned long long    c_hashMultiplier    = 0x9e3779b97f4a7c15ull;   // odd constant spreading each word over the hash
+const unsigned long long    c_resultVersion     = 2;                        // change when an operation's output changes, to orphan old results
+const char                  c_sIndexName[]      = "index.txt";              // index file in the cache directory
+const char                  c_sResultSuffix[]   = ".raw";                   // result files are named by their key
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Scramble the bits of a 64 bit word, so every input bit affects every
+//  output bit.
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned long long Mix_Bits(unsigned long long x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}// Mix_Bits
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Hash count bytes, eight at a time, continuing from the given hash.
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned long long Hash_Bytes(unsigned long long hash, const unsigned char* pBytes, size_t count)
+{
+    hash ^= Mix_Bits(count);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        unsigned long long word;
+        memcpy(&word, pBytes + i, 8);
+        hash = (hash ^ Mix_Bits(word)) * c_hashMultiplier;
+    }// for
+
+    unsigned long long tail = 0;
+    memcpy(&tail, pBytes + i, count - i);
+    hash = (hash ^ Mix_Bits(tail)) * c_hashMultiplier;
+
+    return Mix_Bits(hash);
+}// Hash_Bytes
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Get the process wide cache.  Never destroyed, like the image cache.
+//
+///////////////////////////////////////////////////////////////////////////////
+CResultCache& CResultCache::Instance()
+{
+    static CResultCache* pCache = new CResultCache;
+    return *pCache;
+}// Instance
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  The cache starts closed, and is closed again at exit
+//  so the last uses found reach the index.
+//
+///////////////////////////////////////////////////////////////////////////////
+CResultCache::CResultCache()
+    : m_bOpen(false), m_bIndexStale(false), m_limit(0), m_clock(0)
+{
+    atexit(CloseAtExit);
+
+    m_stats.lookups = 0;
+    m_stats.hits = 0;
+    m_stats.stores = 0;
+    m_stats.bytes = 0;
+    m_stats.entries = 0;
+}// CResultCache
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Use the given directory and read its index.  Results listed in the
+//  index whose files are gone are dropped when next looked up.  Opening the
+//  directory already in use only changes the limit, so scripts run side by
+//  side in a batch can each name it.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CResultCache::Open(const char* sDirectory, size_t limit)
+{
+    if (!sDirectory || !*sDirectory)
+        return false;
+
+    string sPath = sDirectory;
+    if (sPath[sPath.size() - 1] != '/' && sPath[sPath.size() - 1] != '\\')
+        sPath += '/';
+    {
+        lock_guard<mutex> lock(m_mutex);
+        if (m_bOpen && m_sDirectory == sPath)
+        {
+            m_limit = limit;
+            Evict();
+            SaveIndex();
+            return true;
+        }// if
+    }
+
+    Close();
+
+#ifdef _WIN32
+    _mkdir(sDirectory);
+    struct _stat64 info;
+    if (_stat64(sDirectory, &info) != 0 || !(info.st_mode & _S_IFDIR))
+        return false;
+#else
+    mkdir(sDirectory, 0777);
+    struct stat info;
+    if (stat(sDirectory, &info) != 0 || !S_ISDIR(info.st_mode))
+        return false;
+#endif
+
+    lock_guard<mutex> lock(m_mutex);
+    m_sDirectory = sPath;
+    m_limit = limit;
+    m_clock = 0;
+    m_entries.clear();
+    m_uses.clear();
+    m_stats.bytes = 0;
+    m_stats.entries = 0;
+    m_bIndexStale = false;
+
+    // one line per result: key in hex, bytes, last use
+    ifstream index((m_sDirectory + c_sIndexName).c_str());
+    unsigned long long key;
+    SEntry entry;
+    vector<pair<unsigned long long, unsigned long long> > uses;
+    while (index >> hex >> key >> dec >> entry.bytes >> entry.lastUse)
+    {
+        if (m_entries.count(key))
+        {
+            m_bIndexStale = true;
+            continue;
+        }// if
+        m_entries[key] = entry;
+        uses.push_back(make_pair(entry.lastUse, key));
+        m_stats.bytes += entry.bytes;
+        ++m_stats.entries;
+        if (entry.lastUse > m_clock)
+            m_clock = entry.lastUse;
+    }// while
+
+    sort(uses.begin(), uses.end());
+    for (size_t i = 0; i < uses.size(); ++i)
+        m_entries[uses[i].second].use = m_uses.insert(m_uses.end(), uses[i].second);
+
+    m_bOpen = true;
+    Evict();
+    SaveIndex();
+    return true;
+}// Open
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Stop using the cache directory.  The results stay on disk.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CResultCache::Close()
+{
+    lock_guard<mutex> lock(m_mutex);
+    if (m_bOpen)
+        SaveIndex();
+    m_bOpen = false;
+    m_entries.clear();
+    m_uses.clear();
+    m_stats.bytes = 0;
+    m_stats.entries = 0;
+}// Close
+
+
+bool CResultCache::IsOpen()
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_bOpen;
+}// IsOpen
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Key of an image: its size and premultiplied pixels.  The bytes must be
+//  current, as they are straight after a load.
+//
+///////////////////////////////////////////////////////////////////////////////
+unsigned long long CResultCache::HashImage(const TargaImage& image)
+{
+    int size[2] = { image.width, image.height };
+    unsigned long long hash = Hash_Bytes(c_resultVersion, (const unsigned char*)size, sizeof(size));
+    if (image.Data())
+        hash = Hash_Bytes(hash, image.Data(), (size_t)image.width * image.height * 4);
+    return hash;
+}// HashImage
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Key of the result of applying a command to the result with the given
+//  key.
+//
+///////////////////////////////////////////////////////////////////////////////
+unsigned long long CResultCache::HashText(unsigned long long key, const string& sText)
+{
+    return Hash_Bytes(key, (const unsigned char*)sText.c_str(), sText.size());
+}// HashText
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Look up the longest chain of commands with a result.  The file is read
+//  outside the lock.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage* CResultCache::FindLast(const vector<unsigned long long>& keys, size_t& found)
+{
+    unsigned long long  key = 0;
+    string              sPath;
+    {
+        lock_guard<mutex> lock(m_mutex);
+        if (!m_bOpen)
+            return NULL;
+
+        ++m_stats.lookups;
+        for (found = keys.size(); found > 0 && !m_entries.count(keys[found - 1]); --found)
+            ;
+        if (!found--)
+            return NULL;
+        key = keys[found];
+        sPath = FilePath(key);
+    }
+
+    TargaImage* pImage = TargaImage::Load_Raw(sPath.c_str());
+
+    lock_guard<mutex> lock(m_mutex);
+    unordered_map<unsigned long long, SEntry>::iterator entry = m_entries.find(key);
+    if (entry == m_entries.end())
+        return pImage;
+
+    if (!pImage)
+    {
+        // deleted or damaged behind our back
+        m_stats.bytes -= entry->second.bytes;
+        --m_stats.entries;
+        m_uses.erase(entry->second.use);
+        m_entries.erase(entry);
+        remove(sPath.c_str());
+        m_bIndexStale = true;
+        SaveIndex();
+    }// if
+    else
+    {
+        // the new last use reaches the index on its next write
+        entry->second.lastUse = ++m_clock;
+        m_uses.splice(m_uses.end(), m_uses, entry->second.use);
+        m_bIndexStale = true;
+        ++m_stats.hits;
+    }// else
+
+    return pImage;
+}// FindLast
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Store a result.  The file is written outside the lock under a name of
+//  its own, then renamed into place, so a reader never sees half a file.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CResultCache::Store(unsigned long long key, TargaImage& image)
+{
+    size_t bytes = image.Raw_Size();
+    string sPath;
+    {
+        lock_guard<mutex> lock(m_mutex);
+        if (!m_bOpen || bytes > m_limit || m_entries.count(key))
+            return;
+        sPath = FilePath(key);
+    }
+
+    ostringstream sTemp;
+    sTemp << sPath << ".tmp" << hash<thread::id>()(this_thread::get_id());
+    if (!image.Save_Raw(sTemp.str().c_str()))
+    {
+        remove(sTemp.str().c_str());
+        return;
+    }// if
+
+    lock_guard<mutex> lock(m_mutex);
+    remove(sPath.c_str());
+    if (!m_bOpen || m_entries.count(key) || rename(sTemp.str().c_str(), sPath.c_str()) != 0)
+    {
+        remove(sTemp.str().c_str());
+        return;
+    }// if
+
+    SEntry entry = { bytes, ++m_clock, m_uses.insert(m_uses.end(), key) };
+    m_entries[key] = entry;
+    m_stats.bytes += bytes;
+    ++m_stats.entries;
+    ++m_stats.stores;
+    m_bIndexStale = true;
+    Evict();
+    SaveIndex();
+}// Store
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Get a snapshot of the cache counters.
+//
+///////////////////////////////////////////////////////////////////////////////
+CResultCache::SStats CResultCache::GetStats()
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_stats;
+}// GetStats
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write the cache counters to standard out.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CResultCache::PrintStats()
+{
+    SStats stats = GetStats();
+    const double megabyte = 1024.0 * 1024.0;
+
+    cout << "Result cache: " << stats.lookups << " lookups, " << stats.hits << " hits";
+    if (stats.lookups)
+        cout << " (" << 100.0 * stats.hits / stats.lookups << "%)";
+    cout << ", " << stats.lookups - stats.hits << " misses, " << stats.stores << " stores, "
+         << stats.bytes / megabyte << " MB in " << stats.entries << " results" << endl;
+}// PrintStats
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Path of the file holding the result for the given key.
+//
+///////////////////////////////////////////////////////////////////////////////
+string CResultCache::FilePath(unsigned long long key) const
+{
+    char sName[17];
+    sprintf(sName, "%016llx", key);
+    return m_sDirectory + sName + c_sResultSuffix;
+}// FilePath
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Delete least recently used results until the files fit the limit.  The
+//  caller holds the lock.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CResultCache::Evict()
+{
+    while (m_stats.bytes > m_limit && !m_uses.empty())
+    {
+        unordered_map<unsigned long long, SEntry>::iterator oldest = m_entries.find(m_uses.front());
+
+        remove(FilePath(oldest->first).c_str());
+        m_stats.bytes -= oldest->second.bytes;
+        --m_stats.entries;
+        m_entries.erase(oldest);
+        m_uses.pop_front();
+        m_bIndexStale = true;
+    }// while
+}// Evict
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Rewrite the index file if it is out of date, least recently used
+//  first.  The caller holds the lock.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CResultCache::SaveIndex()
+{
+    if (!m_bIndexStale)
+        return;
+
+    ofstream index((m_sDirectory + c_sIndexName).c_str());
+    for (list<unsigned long long>::iterator use = m_uses.begin(); use != m_uses.end(); ++use)
+    {
+        const SEntry& entry = m_entries[*use];
+        index << hex << *use << dec << " " << entry.bytes << " " << entry.lastUse << "\n";
+    }// for
+    m_bIndexStale = false;
+}// SaveIndex
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write the index of the directory in use before the process ends.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CResultCache::CloseAtExit()
+{
+    Instance().Close();
+}// CloseAtExit
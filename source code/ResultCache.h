@@ -0,0 +1,120 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ResultCache.h
+//
+//      On disk cache of script results, so runs that repeat the same
+//  commands on unchanged images skip the work.  A result is keyed by a hash
+//  of the pixels a script started from and of each command applied since,
+//  and kept as a raw image file in the cache directory.  An index file in
+//  the same directory records the size and last use of each result, and the
+//  least recently used are deleted once the files exceed a size limit.  The
+//  index is written when results are added or deleted and on close, so uses
+//  found since the last write are lost if the process dies.  One process at
+//  a time should use a directory.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _C_RESULT_CACHE
+#define _C_RESULT_CACHE
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+
+class TargaImage;
+
+class CResultCache
+{
+    // types
+    public:
+        struct SStats
+        {
+            unsigned long long  lookups;        // calls to FindLast
+            unsigned long long  hits;           // lookups that found a result
+            unsigned long long  stores;         // results written
+            size_t              bytes;          // size of the result files
+            size_t              entries;        // results in the cache
+        };
+
+    // methods
+    public:
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Get the process wide cache.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static CResultCache& Instance();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Use the given directory, created if missing, holding at most limit
+        //  bytes of results.  Results already there from earlier runs are kept.
+        //  Return false, leaving the cache closed, if the directory cannot be
+        //  used.  Close writes the index if it changed, and runs at exit.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        bool Open(const char* sDirectory, size_t limit);
+        void Close();
+        bool IsOpen();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Keys.  An image's key hashes its size and pixels; each command
+        //  applied to it extends the key with the command's text.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static unsigned long long HashImage(const TargaImage& image);
+        static unsigned long long HashText(unsigned long long key, const std::string& sText);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Get the result stored under the last of the given keys that has
+        //  one, as a new image which the caller must delete, and its position in
+        //  keys.  Counts as one lookup.  Returns NULL if none of them has one.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        TargaImage* FindLast(const std::vector<unsigned long long>& keys, size_t& found);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Store the image as the result for the given key, deleting the
+        //  least recently used results to stay within the limit.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        void Store(unsigned long long key, TargaImage& image);
+
+        SStats GetStats();
+        void   PrintStats();
+
+    private:
+        CResultCache();
+
+        std::string FilePath(unsigned long long key) const;
+        void Evict();
+        void SaveIndex();
+        static void CloseAtExit();
+
+    // members
+    private:
+        struct SEntry
+        {
+            size_t                                  bytes;      // size of the result file
+            unsigned long long                      lastUse;    // m_clock when last found or stored
+            std::list<unsigned long long>::iterator use;        // place in m_uses
+        };// SEntry
+
+        std::mutex                                          m_mutex;        // guards everything below
+        bool                                                m_bOpen;
+        bool                                                m_bIndexStale;  // m_entries differs from the index file
+        std::string                                         m_sDirectory;   // ends in a separator
+        size_t                                              m_limit;        // most bytes of result files kept
+        unsigned long long                                  m_clock;        // counts uses, saved in the index
+        std::unordered_map<unsigned long long, SEntry>      m_entries;      // results by key
+        std::list<unsigned long long>                       m_uses;         // keys of m_entries, least recently used first
+        SStats                                              m_stats;
+};// CResultCache
+
+#endif // _C_RESULT_CACHE
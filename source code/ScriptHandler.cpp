@@ -14,12 +14,25 @@
 #include <iostream>
 #include <fstream>
 #include <string.h>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include "TargaImage.h"
+#include "ThreadPool.h"
+#include "BufferPool.h"
+#include "StreamPipeline.h"
+#include "ImageCache.h"
+#include "ResultCache.h"
+#include "Profiler.h"
 
 using namespace std;
 
 // constants
 const int       c_maxLineLength         = 1000;                         // maximum length of a command in a script
+const size_t    c_prefetchDepth         = 2;                            // file operands loaded ahead of the running line
 const char      c_sWhiteSpace[]         = " \t\n\r"; 
 const char      c_asCommands[][32]      = { "load",                     // valid commands
                                             "save",
@@ -35,9 +48,11 @@ const char      c_asCommands[][32]      = { "load",                     // valid
                                             "dither-pattern",
                                             "dither-color",
                                             "filter-box",
+                                            "filter-box-n",
                                             "filter-bartlett",
                                             "filter-gauss",
                                             "filter-gauss-n",
+                                            "filter-gauss-sigma",
                                             "filter-edge",
                                             "filter-enhance",
                                             "npr-paint",
@@ -50,7 +65,18 @@ const char      c_asCommands[][32]      = { "load",                     // valid
                                             "comp-atop",
                                             "comp-xor",
                                             "diff",
-                                            "rotate"
+                                            "rotate",
+                                            "threads",
+                                            "roi",
+                                            "pool-stats",
+                                            "save-rle",
+                                            "stream",
+                                            "stream-rle",
+                                            "cache-budget",
+                                            "lazy",
+                                            "flush",
+                                            "result-cache",
+                                            "profile"
                                           };
 
 enum ECommands          // command ids
@@ -69,9 +95,11 @@ enum ECommands          // command ids
     DITHER_PATTERN,
     DITHER_COLOR,
     FILTER_BOX,
+    FILTER_BOX_N,
     FILTER_BARTLETT,
     FILTER_GAUSS,
     FILTER_GAUSS_N,
+    FILTER_GAUSS_SIGMA,
     FILTER_EDGE,
     FILTER_ENHANCE,
     NPR_PAINT,
@@ -85,9 +113,592 @@ enum ECommands          // command ids
     COMP_XOR,
     DIFF,
     ROTATE,
+    THREADS,
+    ROI,
+    POOL_STATS,
+    SAVE_RLE,
+    STREAM,
+    STREAM_RLE,
+    CACHE_BUDGET,
+    LAZY,
+    FLUSH,
+    RESULT_CACHE,
+    PROFILE,
     NUM_COMMANDS
 };// ECommands
 
+struct SScriptLine      // script line split into its command and arguments once, when the script is read
+{
+    std::string                 sText;
+    int                         command;    // ECommands value, NUM_COMMANDS if blank or unknown
+    std::vector<std::string>    args;
+};// SScriptLine
+
+struct SResultKey       // what the result cache knows of the current image while a script runs
+{
+    bool                bValid;         // key describes the pixels of the image
+    bool                bChanged;       // the image has changed since it was keyed, found or stored
+    bool                bUnkeyed;       // the image is still as the caller passed it, to be keyed when first needed
+    unsigned long long  key;
+};// SResultKey
+
+struct SOperand         // file a script line will load
+{
+    size_t      line;           // line that uses the file
+    int         barrier;        // last "run" line before it, -1 if none
+    std::string sFilename;
+};// SOperand
+
+// nesting depth of the scripts running on this thread
+static thread_local int s_scriptDepth = 0;
+
+// prefetch owner of the outermost script running on this thread, a new one
+// for each outermost script so a batch job cancels only its own read ahead
+static atomic<unsigned long long>           s_nextPrefetchOwner(0);
+static thread_local unsigned long long      s_prefetchOwner = 0;
+
+// lazy mode of this thread: commands recorded until the pixels are needed, see CScriptHandler::Flush
+static thread_local bool                 s_bLazy = false;
+static thread_local vector<SScriptLine>  s_pending;
+
+// rest of the line NextToken is splitting on this thread
+static thread_local char* s_sNextToken = NULL;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Split a command line into whitespace separated tokens, like strtok but
+//  with its position kept per thread, so batch jobs can parse scripts side
+//  by side.  Pass the line to get the first token and NULL for the rest.
+//
+///////////////////////////////////////////////////////////////////////////////
+static char* NextToken(char* sLine)
+{
+    if (sLine)
+        s_sNextToken = sLine;
+    if (!s_sNextToken)
+        return NULL;
+
+    char* sToken = s_sNextToken + strspn(s_sNextToken, c_sWhiteSpace);
+    if (!*sToken)
+    {
+        s_sNextToken = NULL;
+        return NULL;
+    }// if
+
+    char* sEnd = sToken + strcspn(sToken, c_sWhiteSpace);
+    if (*sEnd)
+        *sEnd++ = '\0';
+    s_sNextToken = sEnd;
+    return sToken;
+}// NextToken
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Append the operation named sOp, reading its argument if it takes one,
+//  to the given stream.  Operations that do not stream, and bad arguments,
+//  print an error message and return false.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool AddStreamStage(CStreamPipeline& pipeline, const char* sOp)
+{
+    int command;
+    for (command = 0; command < NUM_COMMANDS; ++command)
+        if (!strcmp(sOp, c_asCommands[command]))
+            break;
+
+    switch (command)
+    {
+        case GRAY:              pipeline.AddGrayscale();            return true;
+        case QUANT_UNIF:        pipeline.AddQuantUniform();         return true;
+        case DITHER_THRESH:     pipeline.AddDitherThreshold();      return true;
+        case DITHER_CLUSTER:    pipeline.AddDitherCluster();        return true;
+        case FILTER_BOX:        pipeline.AddFilterBox();            return true;
+        case FILTER_BARTLETT:   pipeline.AddFilterBartlett();       return true;
+        case FILTER_GAUSS:      pipeline.AddFilterGaussian();       return true;
+        case FILTER_EDGE:       pipeline.AddFilterEdge();           return true;
+        case FILTER_ENHANCE:    pipeline.AddFilterEnhance();        return true;
+        case HALF:              pipeline.AddHalfSize();             return true;
+
+        case FILTER_BOX_N:
+        {
+            char *sRadius = NextToken(NULL);
+            if (!sRadius || !pipeline.AddFilterBoxN(atoi(sRadius)))
+            {
+                cout << "Invalid box filter radius." << endl;
+                return false;
+            }// if
+            return true;
+        }// FILTER_BOX_N
+
+        case FILTER_GAUSS_N:
+        {
+            char *sN = NextToken(NULL);
+            int N = sN ? atoi(sN) : 0;
+            if (!pipeline.AddFilterGaussianN(N))
+            {
+                cout << "N \"" << N << "\" is not allowed; N must be an odd number." << endl;
+                return false;
+            }// if
+            return true;
+        }// FILTER_GAUSS_N
+
+        case FILTER_GAUSS_SIGMA:
+        {
+            char *sSigma = NextToken(NULL);
+            if (!sSigma || !pipeline.AddFilterGaussianSigma((float)atof(sSigma)))
+            {
+                cout << "Invalid Gaussian sigma." << endl;
+                return false;
+            }// if
+            return true;
+        }// FILTER_GAUSS_SIGMA
+
+        default:
+        {
+            cout << "Unable to stream command:  " << sOp << endl;
+            return false;
+        }// default
+    }// switch
+}// AddStreamStage
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Split a command line into its command and arguments.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void CompileLine(const string& sText, SScriptLine& line)
+{
+    vector<char> sLine(sText.begin(), sText.end());
+    sLine.push_back('\0');
+
+    line.sText = sText;
+    line.command = NUM_COMMANDS;
+    line.args.clear();
+
+    char* sToken = NextToken(&sLine[0]);
+    if (!sToken)
+        return;
+
+    for (line.command = 0; line.command < NUM_COMMANDS; ++line.command)
+        if (!strcmp(sToken, c_asCommands[line.command]))
+            break;
+    for (char* sArg = NextToken(NULL); sArg; sArg = NextToken(NULL))
+        line.args.push_back(sArg);
+}// CompileLine
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Split each line of a script into its command and arguments, so the
+//  script is tokenized once however its lines are then run.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void CompileScript(const vector<string>& lines, vector<SScriptLine>& script)
+{
+    script.resize(lines.size());
+    for (size_t i = 0; i < lines.size(); ++i)
+        CompileLine(lines[i], script[i]);
+}// CompileScript
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Get the image in a file an operand command reads, from the image
+//  cache, as the load phase of the command being profiled.
+//
+///////////////////////////////////////////////////////////////////////////////
+static shared_ptr<TargaImage> LoadOperand(const char* sFilename)
+{
+    CProfiler::Instance().Phase(CProfiler::LOAD);
+    shared_ptr<TargaImage> pImage = CImageCache::Instance().Load(sFilename);
+    CProfiler::Instance().Phase(CProfiler::COMPUTE);
+    return pImage;
+}// LoadOperand
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return true if the given script line is a per pixel operation that
+//  RunPointOps can fuse with its neighbours.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool IsPointOp(const SScriptLine& line)
+{
+    switch (line.command)
+    {
+        case GRAY:
+        case QUANT_UNIF:
+        case DITHER_THRESH:
+        case DITHER_CLUSTER:
+            return true;
+
+        case DIFF:
+            return !line.args.empty();
+
+        default:
+            return false;
+    }// switch
+}// IsPointOp
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run the point operations on script lines [first, end) as a single
+//  pass over the image.  The result is the same as running the lines one
+//  after another: a diff whose image is the wrong size is skipped with the
+//  usual message, and one whose image cannot be loaded ends the run after
+//  the operations before it.  Return false if the script should stop.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool RunPointOps(const vector<SScriptLine>& script, size_t first, size_t end, TargaImage* pImage)
+{
+    if (!pImage)
+    {
+        cout << "No image to operate on.  Use \"load\" command to load image." << endl;
+        return false;
+    }// if
+
+    // profiled as one command named after the lines it fuses
+    string sName, sText;
+    if (CProfiler::Instance().IsRecording())
+        for (size_t i = first; i < end; ++i)
+        {
+            sName += (i > first ? "+" : "") + string(c_asCommands[script[i].command]);
+            sText += (i > first ? "; " : "") + script[i].sText;
+        }// for
+    CProfileScope profile(sName.c_str(), sText.c_str(), pImage);
+    CProfiler::Instance().Phase(CProfiler::COMPUTE);
+
+    vector<TargaImage::RowOp>       ops;
+    vector<shared_ptr<TargaImage> > operands;      // kept alive until the pass is done
+    bool                            bParsed = true;
+
+    for (size_t i = first; i < end && bParsed; ++i)
+    {
+        switch (script[i].command)
+        {
+            case GRAY:              ops.push_back(TargaImage::Gray_Op());               break;
+            case QUANT_UNIF:        ops.push_back(TargaImage::Quant_Uniform_Op());      break;
+            case DITHER_THRESH:     ops.push_back(TargaImage::Dither_Threshold_Op());   break;
+            case DITHER_CLUSTER:    ops.push_back(TargaImage::Dither_Cluster_Op());     break;
+
+            case DIFF:
+            {
+                const char* sFilename = script[i].args[0].c_str();
+                shared_ptr<TargaImage> pNewImage = LoadOperand(sFilename);
+                if (!pNewImage)
+                {
+                    cout << "Unable to load image:  " << sFilename << endl;
+                    bParsed = false;
+                }// if
+                else if (pNewImage->width != pImage->width || pNewImage->height != pImage->height)
+                    cout << "Difference: Images not the same size\n";
+                else
+                {
+                    operands.push_back(pNewImage);
+                    ops.push_back(pImage->Difference_Op(pNewImage.get()));
+                }// else
+                break;
+            }// DIFF
+        }// switch
+    }// for
+
+    if (!ops.empty())
+        pImage->Point_Ops(ops);
+
+    return bParsed;
+}// RunPointOps
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return true if lazy mode records the given command rather than running
+//  it: the commands that only change the current image, and roi, which
+//  must stay in order with them.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool IsDeferred(int command)
+{
+    return (command >= GRAY && command <= ROTATE) || command == ROI;
+}// IsDeferred
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return true if the given command converts the image to grayscale
+//  before anything else, so a gray just before it changes nothing.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool GraysFirst(int command)
+{
+    switch (command)
+    {
+        case GRAY:
+        case DITHER_THRESH:
+        case DITHER_RAND:
+        case DITHER_FS:
+        case DITHER_BRIGHT:
+        case DITHER_CLUSTER:
+            return true;
+
+        default:
+            return false;
+    }// switch
+}// GraysFirst
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Drop recorded commands whose effect the next command undoes or
+//  repeats.  A gray is idempotent and is the first step of the dithers,
+//  and uniform quantization maps its levels to themselves.  Only neighbours
+//  are compared, so a roi between two commands keeps both.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void PrunePending(vector<SScriptLine>& pending)
+{
+    vector<SScriptLine> kept;
+    for (size_t i = 0; i < pending.size(); ++i)
+    {
+        if (!kept.empty() && kept.back().command == GRAY && GraysFirst(pending[i].command))
+            kept.pop_back();
+        else if (!kept.empty() && kept.back().command == QUANT_UNIF && pending[i].command == QUANT_UNIF)
+            continue;
+
+        kept.push_back(pending[i]);
+    }// for
+
+    pending.swap(kept);
+}// PrunePending
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run the step of a script starting at line i: a run of point operations
+//  fused into one pass, or else the single line.  Return the line after the
+//  step.
+//
+///////////////////////////////////////////////////////////////////////////////
+static size_t RunStep(const vector<SScriptLine>& script, size_t i, TargaImage*& pImage, bool& bResult)
+{
+    // in lazy mode each line goes to HandleCommand to be recorded
+    size_t end = i + 1;
+    if (!s_bLazy && IsPointOp(script[i]))
+        while (end < script.size() && IsPointOp(script[end]))
+            ++end;
+
+    bResult = end - i > 1 ? RunPointOps(script, i, end, pImage) : CScriptHandler::HandleCommand(script[i].sText.c_str(), pImage);
+    return end;
+}// RunStep
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return true if the result of the given script line depends only on
+//  the image and the line, so it can be kept in the result cache.  The
+//  operand commands read other files.  npr-paint qualifies since its strokes
+//  come from a generator seeded the same way on every call.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool IsMemoized(const SScriptLine& line)
+{
+    return line.command >= GRAY && line.command <= ROTATE &&
+           !(line.command >= COMP_OVER && line.command <= DIFF);
+}// IsMemoized
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return true if the given command leaves the pixels of the image as
+//  they are.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool KeepsPixels(int command)
+{
+    switch (command)
+    {
+        case SAVE:
+        case SAVE_RLE:
+        case THREADS:
+        case POOL_STATS:
+        case STREAM:
+        case STREAM_RLE:
+        case CACHE_BUDGET:
+        case RESULT_CACHE:
+        case NUM_COMMANDS:      // blank line
+            return true;
+
+        default:
+            return false;
+    }// switch
+}// KeepsPixels
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Key of the given key with a script line applied.  The line is hashed
+//  in a canonical form, so spacing does not matter.
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned long long ResultKey(unsigned long long key, const SScriptLine& line)
+{
+    string sText = c_asCommands[line.command];
+    for (size_t i = 0; i < line.args.size(); ++i)
+        sText += " " + line.args[i];
+    return CResultCache::HashText(key, sText);
+}// ResultKey
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      At the start of a run of cacheable lines, replace the pixels with the
+//  result cached for the longest part of the run, if any.  roi ends a run,
+//  so the region of interest is always set by running its line.  Return the
+//  first line still to run.
+//
+///////////////////////////////////////////////////////////////////////////////
+static size_t SkipCachedResults(const vector<SScriptLine>& script, size_t i, TargaImage* pImage, SResultKey& result)
+{
+    if (result.bUnkeyed && IsMemoized(script[i]) && pImage && !s_bLazy && CResultCache::Instance().IsOpen())
+    {
+        result.bValid = true;
+        result.bUnkeyed = false;
+        result.key = CResultCache::HashImage(*pImage);
+    }// if
+
+    if (!result.bValid || s_bLazy || !pImage || !IsMemoized(script[i]) || (i > 0 && IsMemoized(script[i - 1])))
+        return i;
+
+    vector<unsigned long long> keys;
+    unsigned long long key = result.key;
+    for (size_t end = i; end < script.size() && IsMemoized(script[end]); ++end)
+        keys.push_back(key = ResultKey(key, script[end]));
+
+    CProfileScope profile("result-cache", "lookup", pImage);
+    CProfiler::Instance().Phase(CProfiler::LOAD);
+
+    size_t found;
+    TargaImage* pCached = CResultCache::Instance().FindLast(keys, found);
+    if (!pCached)
+        return i;
+
+    pImage->Share_Pixels(*pCached);
+    delete pCached;
+
+    result.key = keys[found];
+    result.bChanged = false;
+    return i + found + 1;
+}// SkipCachedResults
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Follow what script lines [first, end), just run, did to the image, and
+//  store the image in the result cache at the end of a run of cacheable
+//  lines.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void TrackResult(const vector<SScriptLine>& script, size_t first, size_t end, TargaImage* pImage, SResultKey& result)
+{
+    CResultCache& results = CResultCache::Instance();
+    bool bOpen = !s_bLazy && results.IsOpen();
+
+    for (size_t i = first; i < end; ++i)
+    {
+        if (!KeepsPixels(script[i].command))
+            result.bUnkeyed = false;
+
+        if (!bOpen)
+            result.bValid = false;
+        else if (script[i].command == LOAD)
+        {
+            result.bValid = pImage != NULL;
+            result.bChanged = false;
+            if (pImage)
+                result.key = CResultCache::HashImage(*pImage);
+        }// if
+        else if (IsMemoized(script[i]))
+        {
+            result.key = ResultKey(result.key, script[i]);
+            result.bChanged = true;
+        }// else if
+        else if (script[i].command == ROI)
+            result.key = ResultKey(result.key, script[i]);
+        else if (!KeepsPixels(script[i].command))
+            result.bValid = false;
+    }// for
+
+    if (result.bValid && result.bChanged && pImage && (end == script.size() || !IsMemoized(script[end])))
+    {
+        results.Store(result.key, *pImage);
+        result.bChanged = false;
+    }// if
+}// TrackResult
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Find the files the given script lines will load, through "load" and the
+//  operand commands, so they can be read ahead.  A file written by an earlier
+//  line is left out, as reading it ahead would see the old contents, and
+//  files after a "run" line are only read once that script has run, since it
+//  may write them too.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void FindOperands(const vector<SScriptLine>& script, vector<SOperand>& operands)
+{
+    unordered_set<string>   written;
+    int                     barrier = -1;
+
+    for (size_t i = 0; i < script.size(); ++i)
+    {
+        const vector<string>& args = script[i].args;
+        switch (script[i].command)
+        {
+            case LOAD:
+            case COMP_OVER:
+            case COMP_IN:
+            case COMP_OUT:
+            case COMP_ATOP:
+            case COMP_XOR:
+            case DIFF:
+            {
+                if (!args.empty() && !written.count(args[0]))
+                {
+                    SOperand operand = { i, barrier, args[0] };
+                    operands.push_back(operand);
+                }// if
+                break;
+            }// LOAD
+
+            case SAVE:
+            case SAVE_RLE:
+            {
+                if (!args.empty())
+                    written.insert(args[0]);
+                break;
+            }// SAVE
+
+            case STREAM:
+            case STREAM_RLE:
+            {
+                if (args.size() > 1)
+                    written.insert(args[1]);
+                break;
+            }// STREAM
+
+            case RUN:
+            {
+                barrier = (int)i;
+                break;
+            }// RUN
+        }// switch
+    }// for
+}// FindOperands
+
 
 ///////////////////////////////////////////////////////////////////////////////
 //
@@ -101,9 +712,29 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
     if (!sCommand || !strlen(sCommand))
         return true;
 
+    // lazy mode records the commands that only change the image, and runs
+    // them before anything that needs the pixels; a load throws them away
+    if (s_bLazy || !s_pending.empty())
+    {
+        SScriptLine line;
+        CompileLine(sCommand, line);
+        if (s_bLazy && pImage && IsDeferred(line.command))
+        {
+            s_pending.push_back(line);
+            return true;
+        }// if
+
+        if (line.command == LOAD)
+            s_pending.clear();
+        else if (!Flush(pImage))
+            return false;
+    }// if
+
+    CProfileScope profile(NULL, sCommand, pImage);
+
     char* sCommandLine = new char[strlen(sCommand) + 1];
     strcpy(sCommandLine, sCommand);
-    char* sToken = strtok(sCommandLine, c_sWhiteSpace);
+    char* sToken = NextToken(sCommandLine);
 
     // find command that was given
     int command;
@@ -112,7 +743,9 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
 
     // if there's no image only a subset of commands are valid
-    if (!pImage && command != LOAD && command != RUN && command != NUM_COMMANDS)
+    if (!pImage && command != LOAD && command != RUN && command != THREADS && command != POOL_STATS &&
+        command != STREAM && command != STREAM_RLE && command != CACHE_BUDGET && command != LAZY && command != FLUSH &&
+        command != RESULT_CACHE && command != PROFILE && command != NUM_COMMANDS)
     {
         cout << "No image to operate on.  Use \"load\" command to load image." << endl;
         return false;
@@ -122,14 +755,20 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
     bool bResult,
          bParsed = true;
 
+    CProfiler::Instance().Phase(CProfiler::COMPUTE);
     switch (command)
     {
         case LOAD:
         {
+            CProfiler::Instance().Phase(CProfiler::LOAD);
             if (pImage)
                 delete pImage;
-            char* sFilename = strtok(NULL, c_sWhiteSpace);
-            bResult = (pImage = TargaImage::Load_Image(sFilename)) != NULL;
+            char* sFilename = NextToken(NULL);
+
+            // the copy shares the cached pixels until the script first changes them
+            shared_ptr<TargaImage> pCached = CImageCache::Instance().Load(sFilename);
+            pImage = pCached ? new TargaImage(*pCached) : NULL;
+            bResult = pImage != NULL;
 
             if (!bResult)
             {
@@ -144,19 +783,23 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
         }// LOAD
 
         case SAVE:
+        case SAVE_RLE:
         {
-            char* sFilename = strtok(NULL, c_sWhiteSpace);
+            char* sFilename = NextToken(NULL);
             if (!sFilename)
                 cout << "No filename given." << endl;
 
             bParsed = sFilename != NULL;
-            bResult =  bParsed && pImage->Save_Image(sFilename);
+            CProfiler::Instance().Phase(CProfiler::SAVE);
+            bResult =  bParsed && pImage->Save_Image(sFilename, command == SAVE_RLE);
+            if (bResult)
+                CImageCache::Instance().Forget(sFilename);
             break;
         }// SAVE
 
         case RUN:
         {
-            bResult = HandleScriptFile(strtok(NULL, c_sWhiteSpace), pImage);
+            bResult = HandleScriptFile(NextToken(NULL), pImage);
             break;
         }// RUN
 
@@ -220,6 +863,21 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
         }// DITHER_BOX
 
+        case FILTER_BOX_N:
+        {
+            char *sRadius = NextToken(NULL);
+            int radius;
+
+            if (!sRadius || (radius = atoi(sRadius)) < 1)
+            {
+                cout << "Invalid box filter radius." << endl;
+                bParsed = bResult = false;
+            }// if
+            else
+                bResult = pImage->Filter_Box_N(radius);
+            break;
+        }// FILTER_BOX_N
+
         case FILTER_BARTLETT:
         {
             bResult = pImage->Filter_Bartlett();
@@ -234,16 +892,32 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
         case FILTER_GAUSS_N:
         {
-            char *sN = strtok(NULL, c_sWhiteSpace);
-            int N = atoi(sN);
+            char *sN = NextToken(NULL);
+            int N = sN ? atoi(sN) : 0;
             if (N % 2 != 1) {
                cout << "N \"" << N << "\" is not allowed; N must be an odd number." << endl;
+               bParsed = bResult = false;
                break;
             }
             bResult = pImage->Filter_Gaussian_N(N);
             break;
         }// FILTER_GUASS_N
 
+        case FILTER_GAUSS_SIGMA:
+        {
+            char *sSigma = NextToken(NULL);
+            float sigma;
+
+            if (!sSigma || (sigma = (float)atof(sSigma)) <= 0)
+            {
+                cout << "Invalid Gaussian sigma." << endl;
+                bParsed = bResult = false;
+            }// if
+            else
+                bResult = pImage->Filter_Gaussian_Sigma(sigma);
+            break;
+        }// FILTER_GAUSS_SIGMA
+
         case FILTER_EDGE:
         {
             bResult = pImage->Filter_Edge();
@@ -277,7 +951,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
         case SCALE:
         {
-            char *sScale = strtok(NULL, c_sWhiteSpace);
+            char *sScale = NextToken(NULL);
             float scale;
 
             if (!sScale || !(scale = (float)atof(sScale)) || scale <= 0)
@@ -292,8 +966,8 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
         case COMP_OVER:
         {
-            char* sFilename = strtok(NULL, c_sWhiteSpace);
-            TargaImage* pNewImage = TargaImage::Load_Image(sFilename);
+            char* sFilename = NextToken(NULL);
+            shared_ptr<TargaImage> pNewImage = LoadOperand(sFilename);
             if (!pNewImage)
             {
                 if (sFilename)
@@ -302,15 +976,14 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
                     cout << "No filename given." << endl;
                 bParsed = false;
             }// if
-            bResult = pNewImage && pImage->Comp_Over(pNewImage);
-            delete pNewImage;
+            bResult = pNewImage && pImage->Comp_Over(pNewImage.get());
             break;
         }// COMP_OVER
 
         case COMP_IN:
         {
-            char* sFilename = strtok(NULL, c_sWhiteSpace);
-            TargaImage* pNewImage = TargaImage::Load_Image(sFilename);
+            char* sFilename = NextToken(NULL);
+            shared_ptr<TargaImage> pNewImage = LoadOperand(sFilename);
             if (!pNewImage)
             {
                 if (sFilename)
@@ -320,15 +993,14 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
                 bParsed = false;
             }// if
-            bResult = pNewImage && pImage->Comp_In(pNewImage);
-            delete pNewImage;
+            bResult = pNewImage && pImage->Comp_In(pNewImage.get());
             break;
         }// COMP_IN
 
         case COMP_OUT:
         {
-            char* sFilename = strtok(NULL, c_sWhiteSpace);
-            TargaImage* pNewImage = TargaImage::Load_Image(sFilename);
+            char* sFilename = NextToken(NULL);
+            shared_ptr<TargaImage> pNewImage = LoadOperand(sFilename);
             if (!pNewImage)
             {
                 if (sFilename)
@@ -338,15 +1010,14 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
                 bParsed = false;
             }// if
-            bResult = pNewImage && pImage->Comp_Out(pNewImage);
-            delete pNewImage;
+            bResult = pNewImage && pImage->Comp_Out(pNewImage.get());
             break;
         }// COMP_OUT
 
         case COMP_ATOP:
         {
-            char* sFilename = strtok(NULL, c_sWhiteSpace);
-            TargaImage* pNewImage = TargaImage::Load_Image(sFilename);
+            char* sFilename = NextToken(NULL);
+            shared_ptr<TargaImage> pNewImage = LoadOperand(sFilename);
             if (!pNewImage)
             {
                 if (sFilename)
@@ -356,15 +1027,14 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
                 bParsed = false;
             }// if
-            bResult = pNewImage && pImage->Comp_Atop(pNewImage);
-            delete pNewImage;
+            bResult = pNewImage && pImage->Comp_Atop(pNewImage.get());
             break;
         }// COMP_ATOP
 
         case COMP_XOR:
         {
-            char* sFilename = strtok(NULL, c_sWhiteSpace);
-            TargaImage* pNewImage = TargaImage::Load_Image(sFilename);
+            char* sFilename = NextToken(NULL);
+            shared_ptr<TargaImage> pNewImage = LoadOperand(sFilename);
             if (!pNewImage)
             {
                 if (sFilename)
@@ -374,15 +1044,14 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
                 bParsed = false;
             }// if
-            bResult = pNewImage && pImage->Comp_Xor(pNewImage);
-            delete pNewImage;
+            bResult = pNewImage && pImage->Comp_Xor(pNewImage.get());
             break;
         }// COMP_XOR
 
         case DIFF:
         {
-            char* sFilename = strtok(NULL, c_sWhiteSpace);
-            TargaImage* pNewImage = TargaImage::Load_Image(sFilename);
+            char* sFilename = NextToken(NULL);
+            shared_ptr<TargaImage> pNewImage = LoadOperand(sFilename);
             if (!pNewImage)
             {
                 if (sFilename)
@@ -392,14 +1061,13 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
                 bParsed = false;
             }// if
-            bResult = pNewImage && pImage->Difference(pNewImage);
-            delete pNewImage;
+            bResult = pNewImage && pImage->Difference(pNewImage.get());
             break;
         }// DIFF
 
         case ROTATE:
         {
-            char *sAngle = strtok(NULL, c_sWhiteSpace);
+            char *sAngle = NextToken(NULL);
             float angle;
 
             if (!sAngle || !(angle = (float)atof(sAngle)))
@@ -414,6 +1082,192 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
         }// ROTATE
 
+        case THREADS:
+        {
+            char *sCount = NextToken(NULL);
+            int count;
+
+            if (!sCount || (count = atoi(sCount)) < 1)
+            {
+                cout << "Invalid thread count." << endl;
+                bResult = bParsed = false;
+            }// if
+            else
+            {
+                // the background loader runs on the pool, so let it finish
+                // first.  Only a batch job, where the count is ignored, can
+                // have other scripts' prefetches under way.
+                CImageCache::Instance().CancelPrefetches(s_prefetchOwner);
+                CThreadPool::Instance().SetThreadCount(count);
+                bResult = true;
+            }// else
+            break;
+        }// THREADS
+
+        case ROI:
+        {
+            // "roi off" or "roi x y w h", counted from the top left
+            char *sArgs[4];
+            sArgs[0] = NextToken(NULL);
+
+            if (sArgs[0] && !strcmp(sArgs[0], "off"))
+            {
+                pImage->Clear_ROI();
+                bResult = true;
+                break;
+            }// if
+
+            for (int i = 1; i < 4; ++i)
+                sArgs[i] = NextToken(NULL);
+
+            if (!sArgs[0] || !sArgs[1] || !sArgs[2] || !sArgs[3] || atoi(sArgs[2]) < 1 || atoi(sArgs[3]) < 1 ||
+                !pImage->Set_ROI(atoi(sArgs[0]), atoi(sArgs[1]), atoi(sArgs[2]), atoi(sArgs[3])))
+            {
+                cout << "Invalid region of interest." << endl;
+                bResult = bParsed = false;
+            }// if
+            else
+                bResult = true;
+            break;
+        }// ROI
+
+        case POOL_STATS:
+        {
+            CBufferPool::SStats stats = CBufferPool::Instance().GetStats();
+            const double megabyte = 1024.0 * 1024.0;
+
+            cout << "Buffer pool: " << stats.requests << " requests, " << stats.hits << " hits";
+            if (stats.requests)
+                cout << " (" << 100.0 * stats.hits / stats.requests << "%)";
+            cout << ", " << stats.bytesInUse / megabyte << " MB in use, "
+                 << stats.peakBytesInUse / megabyte << " MB peak, "
+                 << stats.bytesCached / megabyte << " MB cached" << endl;
+
+            CImageCache::SStats cacheStats = CImageCache::Instance().GetStats();
+            cout << "Image cache: " << cacheStats.lookups << " lookups, " << cacheStats.hits << " hits, "
+                 << cacheStats.bytes / megabyte << " MB in " << cacheStats.entries << " images" << endl;
+
+            if (CResultCache::Instance().IsOpen())
+                CResultCache::Instance().PrintStats();
+            bResult = true;
+            break;
+        }// POOL_STATS
+
+        case CACHE_BUDGET:
+        {
+            // megabytes of images kept for reuse by load and the operand commands, 0 for none
+            char *sBudget = NextToken(NULL);
+            int budget;
+
+            if (!sBudget || (budget = atoi(sBudget)) < 0 || (!budget && strcmp(sBudget, "0")))
+            {
+                cout << "Invalid cache budget." << endl;
+                bResult = bParsed = false;
+            }// if
+            else
+            {
+                CImageCache::Instance().SetBudget((size_t)budget << 20);
+                bResult = true;
+            }// else
+            break;
+        }// CACHE_BUDGET
+
+        case RESULT_CACHE:
+        {
+            // "result-cache <directory> <megabytes>" or "result-cache off"
+            char* sDirectory = NextToken(NULL);
+            char* sLimit = NextToken(NULL);
+            int limit;
+
+            if (sDirectory && !strcmp(sDirectory, "off") && !sLimit)
+            {
+                CResultCache::Instance().Close();
+                bResult = true;
+            }// if
+            else if (!sDirectory || !sLimit || (limit = atoi(sLimit)) < 1)
+            {
+                cout << "Invalid result cache, use \"result-cache <directory> <MB>\" or \"result-cache off\"." << endl;
+                bResult = bParsed = false;
+            }// else if
+            else
+            {
+                bResult = CResultCache::Instance().Open(sDirectory, (size_t)limit << 20);
+                if (!bResult)
+                    cout << "Unable to use result cache directory:  " << sDirectory << endl;
+            }// else
+            break;
+        }// RESULT_CACHE
+
+        case LAZY:
+        {
+            // "lazy on" or "lazy off"; anything recorded was flushed above
+            char *sMode = NextToken(NULL);
+
+            if (sMode && !strcmp(sMode, "on"))
+                s_bLazy = true;
+            else if (sMode && !strcmp(sMode, "off"))
+                s_bLazy = false;
+            else
+            {
+                cout << "Invalid lazy mode, use \"lazy on\" or \"lazy off\"." << endl;
+                bResult = bParsed = false;
+                break;
+            }// else
+            bResult = true;
+            break;
+        }// LAZY
+
+        case PROFILE:
+        {
+            // "profile on [trace file]", or "profile off" to report what was recorded
+            char *sMode = NextToken(NULL);
+            char *sTrace = sMode ? NextToken(NULL) : NULL;
+
+            if (sMode && !strcmp(sMode, "on"))
+                CProfiler::Instance().Start(sTrace ? sTrace : "");
+            else if (sMode && !strcmp(sMode, "off") && !sTrace)
+                CProfiler::Instance().Report();
+            else
+            {
+                cout << "Invalid profile mode, use \"profile on [trace file]\" or \"profile off\"." << endl;
+                bResult = bParsed = false;
+                break;
+            }// else
+            bResult = true;
+            break;
+        }// PROFILE
+
+        case FLUSH:
+        {
+            // the recorded commands were run above
+            bResult = true;
+            break;
+        }// FLUSH
+
+        case STREAM:
+        case STREAM_RLE:
+        {
+            // "stream <input> <output> <command> [argument] ...", for images
+            // too large to load; the image being edited is not touched
+            char* sInput = NextToken(NULL);
+            char* sOutput = NextToken(NULL);
+            if (!sInput || !sOutput)
+            {
+                cout << "No filename given." << endl;
+                bResult = bParsed = false;
+                break;
+            }// if
+
+            CStreamPipeline pipeline;
+            for (char* sOp = NextToken(NULL); sOp && bParsed; sOp = NextToken(NULL))
+                bParsed = AddStreamStage(pipeline, sOp);
+
+            bResult = bParsed && pipeline.Run(sInput, sOutput, command == STREAM_RLE);
+            if (bResult)
+                CImageCache::Instance().Forget(sOutput);
+            break;
+        }// STREAM
+
         default:
         {
             cout << "Unable to parse command:  " << sCommand << endl;
@@ -430,13 +1284,11 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      The given script file is executed on the given image.  If the file is 
-//  not correctly parsed an error message is printed and false is returned.  
-//  If all commands in the script execute correctly true is returned,
-//  otherwise false is returned.
+//      Read the given script file and compile its lines.  Return success of
+//  operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool CScriptHandler::HandleScriptFile(const char* sFilename, TargaImage*& pImage)
+static bool ReadScript(const char* sFilename, vector<SScriptLine>& script)
 {
     if (!sFilename)
     {
@@ -452,19 +1304,281 @@ bool CScriptHandler::HandleScriptFile(const char* sFilename, TargaImage*& pImage
         return false;
     }// if
 
-    bool bResult = true;
+    vector<string> lines;
     char sLine[c_maxLineLength + 1];
-    while (!inFile.eof() && bResult)
+    while (!inFile.eof())
     {
         inFile.getline(sLine, c_maxLineLength);
 
         if (!inFile.eof())
-            bResult = HandleCommand(sLine, pImage);
+            lines.push_back(sLine);
     }// while
 
     inFile.close();
+
+    CompileScript(lines, script);
+    return true;
+}// ReadScript
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run the given compiled script on the given image.  If bKeyImage is set
+//  the result cache may start from the image as given, else only from images
+//  the script loads, since the caller may have set a region of interest.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool RunCompiledScript(const vector<SScriptLine>& script, TargaImage*& pImage, bool bKeyImage)
+{
+    // load the files of the next few operand commands on the cache's loader
+    // thread while the lines before them run
+    vector<SOperand> operands;
+    FindOperands(script, operands);
+
+    // skip the work of runs of commands an earlier run left in the result cache
+    SResultKey result = { false, false, bKeyImage && pImage, 0 };
+
+    bool    bResult = true;
+    size_t  current = 0,
+            next = 0,
+            i = 0;
+    if (s_scriptDepth++ == 0)
+        s_prefetchOwner = ++s_nextPrefetchOwner;
+    while (i < script.size() && bResult)
+    {
+        while (current < operands.size() && operands[current].line <= i)
+            ++current;
+        for (; next < operands.size() && next < current + c_prefetchDepth && operands[next].barrier < (int)i; ++next)
+            if (operands[next].line > i)
+                CImageCache::Instance().Prefetch(operands[next].sFilename.c_str(), s_prefetchOwner);
+
+        size_t first = SkipCachedResults(script, i, pImage, result);
+        if (first != i)
+        {
+            i = first;
+            continue;
+        }// if
+
+        i = RunStep(script, first, pImage, bResult);
+        if (bResult)
+            TrackResult(script, first, i, pImage, result);
+    }// while
+
+    // nothing read ahead outlives the outermost script
+    if (--s_scriptDepth == 0)
+        CImageCache::Instance().CancelPrefetches(s_prefetchOwner);
+
     return bResult;
-}// CScriptHandler
+}// RunCompiledScript
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run the given script file on the given image.  See RunCompiledScript.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool RunScript(const char* sFilename, TargaImage*& pImage, bool bKeyImage)
+{
+    // reading and splitting the lines is the parse phase, running them the compute phase
+    CProfileScope profile("script", sFilename, pImage);
 
+    vector<SScriptLine> script;
+    if (!ReadScript(sFilename, script))
+        return false;
+
+    CProfiler::Instance().Phase(CProfiler::COMPUTE);
+    return RunCompiledScript(script, pImage, bKeyImage);
+}// RunScript
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The given script file is executed on the given image.  If the file is 
+//  not correctly parsed an error message is printed and false is returned.  
+//  If all commands in the script execute correctly true is returned,
+//  otherwise false is returned.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CScriptHandler::HandleScriptFile(const char* sFilename, TargaImage*& pImage)
+{
+    return RunScript(sFilename, pImage, false);
+}// HandleScriptFile
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run the commands recorded in lazy mode on the given image, pruned and
+//  with their point operations fused.  If one fails to parse the rest are
+//  dropped and false is returned.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CScriptHandler::Flush(TargaImage*& pImage)
+{
+    if (s_pending.empty())
+        return true;
+
+    vector<SScriptLine> pending;
+    pending.swap(s_pending);
+    PrunePending(pending);
+
+    // run them for real rather than recording them again
+    bool bLazy = s_bLazy;
+    s_bLazy = false;
+
+    bool bResult = true;
+    for (size_t i = 0; i < pending.size() && bResult; )
+        i = RunStep(pending, i, pImage, bResult);
+
+    s_bLazy = bLazy;
+    return bResult;
+}// Flush
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Get whether lazy mode has commands waiting to run.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CScriptHandler::HasPending()
+{
+    return !s_pending.empty();
+}// HasPending
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Load one batch input, run the compiled script on it and save the
+//  result.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool RunBatchImage(const vector<SScriptLine>& script, char* sInput, const string& sOutput)
+{
+    TargaImage* pImage = NULL;
+    bool        bResult;
+
+    // profiled as one command, which ends before the image is deleted
+    {
+        CProfileScope profile("batch-image", sInput, pImage);
+
+        // inputs are read once, so they bypass the image cache
+        CProfiler::Instance().Phase(CProfiler::LOAD);
+        pImage = TargaImage::Load_Image(sInput);
+        CProfiler::Instance().Phase(CProfiler::COMPUTE);
+        if (!pImage)
+        {
+            cout << "Unable to load image:  " << sInput << endl;
+            return false;
+        }// if
+
+        // each image starts out eager, whatever the last script on this thread left set
+        s_bLazy = false;
+        s_pending.clear();
+
+        bResult = RunCompiledScript(script, pImage, true) && CScriptHandler::Flush(pImage) && pImage;
+        if (bResult)
+        {
+            CProfiler::Instance().Phase(CProfiler::SAVE);
+            bResult = pImage->Save_Image(sOutput.c_str());
+            if (!bResult)
+                cout << "Unable to save image:  " << sOutput << endl;
+            else
+                CImageCache::Instance().Forget(sOutput.c_str());
+        }// if
+    }
+
+    delete pImage;
+    return bResult;
+}// RunBatchImage
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run the given script on each input image, saving the results in the
+//  output directory.  The caller hands out images as workers free up and
+//  waits while jobs of them are in flight.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CScriptHandler::HandleBatch(const char* sScript, const vector<char*>& inputs, const char* sOutDir, int jobs)
+{
+    if (!sScript || !sOutDir)
+    {
+        cout << "No filename given." << endl;
+        return false;
+    }// if
+
+    string sDir = sOutDir;
+    if (!sDir.empty() && sDir[sDir.size() - 1] != '/' && sDir[sDir.size() - 1] != '\\')
+        sDir += '/';
+
+    // each result is saved under its input's name, so two inputs of the same
+    // name in different directories would overwrite each other
+    vector<string>          outputs;
+    unordered_set<string>   names;
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        const char* sName = inputs[i];
+        for (const char* sChar = inputs[i]; *sChar; ++sChar)
+            if (*sChar == '/' || *sChar == '\\')
+                sName = sChar + 1;
+        outputs.push_back(sDir + sName);
+
+        if (!names.insert(sName).second)
+        {
+            cout << "Two inputs would be saved as:  " << outputs.back() << endl;
+            return false;
+        }// if
+    }// for
+
+    // every image runs the same steps, even if the file is edited mid batch
+    vector<SScriptLine> script;
+    if (!ReadScript(sScript, script))
+        return false;
+
+    CThreadPool& pool = CThreadPool::Instance();
+    int threadCount = pool.GetThreadCount();
+    if (jobs < 1)
+        jobs = threadCount;
+
+    // one worker per image in flight; this thread only hands them out.  The
+    // background loader runs on the pool, so none may be under way.
+    CImageCache::Instance().CancelAllPrefetches();
+    pool.SetThreadCount(jobs + 1);
+
+    mutex               doneMutex;
+    condition_variable  doneSignal;
+    int                 inFlight = 0;
+    atomic<int>         failed(0);
+
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        {
+            unique_lock<mutex> lock(doneMutex);
+            doneSignal.wait(lock, [&]() { return inFlight < jobs; });
+            ++inFlight;
+        }
+
+        char* sInput = inputs[i];
+        string sOutput = outputs[i];
+
+        pool.Submit([&, sInput, sOutput]()
+        {
+            if (!RunBatchImage(script, sInput, sOutput))
+                ++failed;
+
+            lock_guard<mutex> lock(doneMutex);
+            --inFlight;
+            doneSignal.notify_one();
+        });
+    }// for
+
+    {
+        unique_lock<mutex> lock(doneMutex);
+        doneSignal.wait(lock, [&]() { return inFlight == 0; });
+    }
 
+    CImageCache::Instance().CancelAllPrefetches();
+    pool.SetThreadCount(threadCount);
 
+    cout << "Batch:  " << inputs.size() - failed << " of " << inputs.size() << " images done." << endl;
+    return failed == 0;
+}// HandleBatch
@@ -13,6 +13,8 @@
 #ifndef _C_SCRIPT_HANDLER
 #define _C_SCRIPT_HANDLER
 
+#include <vector>
+
 class TargaImage;
 
 class CScriptHandler
@@ -37,6 +39,32 @@ class CScriptHandler
         //
         ///////////////////////////////////////////////////////////////////////////////
         static bool HandleScriptFile(const char* sFilename, TargaImage*& pImage);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      After "lazy on", commands that only change the image are recorded
+        //  rather than run, and run together, with redundant ones dropped, once
+        //  the pixels are needed: by save, run, "flush" or any other command
+        //  that is not recorded, or by Flush, which the image widget calls
+        //  before sizing the window to the image.  Errors in recorded commands
+        //  show up when they run.  Return false if a recorded command failed to
+        //  parse.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static bool Flush(TargaImage*& pImage);
+        static bool HasPending();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Run the given script on each input image and save the result under
+        //  the same name in the output directory.  Up to jobs images are in
+        //  flight at once, each on its own pool worker, so memory stays bounded
+        //  however many inputs there are; 0 means one per hardware thread.
+        //  Return true if every image was processed and saved, and false
+        //  without running anything if two inputs share a file name.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static bool HandleBatch(const char* sScript, const std::vector<char*>& inputs, const char* sOutDir, int jobs);
 };// CScriptHandler
 
 #endif // _C_SCRIPT_HANDLER
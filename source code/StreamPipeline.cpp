@@ -0,0 +1,646 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      StreamPipeline.cpp
+//
+//      Implementation of CStreamPipeline methods and of the row stages.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "StreamPipeline.h"
+#include "Globals.h"
+#include "libtarga.h"
+#include "Convolution.h"
+#include "PixelKernels.h"
+#include "ThreadPool.h"
+#include "BufferPool.h"
+#include <iostream>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+
+using namespace std;
+
+// constants
+const int       c_bandBytes         = 4 << 20;      // bytes of pixels read from the file at a time
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.
+//
+///////////////////////////////////////////////////////////////////////////////
+CRowStage::CRowStage()
+    : m_pNext(NULL), m_width(0), m_height(0), m_bTopFirst(true), m_maxRows(0)
+{
+}// CRowStage
+
+
+void CRowStage::SetNext(CRowStage* pNext)
+{
+    m_pNext = pNext;
+}// SetNext
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Start an image.  Stages that keep the size just pass it on.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CRowStage::Begin(int width, int height, bool bTopFirst, int maxRows)
+{
+    m_width = width;
+    m_height = height;
+    m_bTopFirst = bTopFirst;
+    m_maxRows = maxRows;
+    return !m_pNext || m_pNext->Begin(width, height, bTopFirst, maxRows);
+}// Begin
+
+
+bool CRowStage::End()
+{
+    return !m_pNext || m_pNext->End();
+}// End
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Stage running op(row, width, y) over every row, in place.
+//
+///////////////////////////////////////////////////////////////////////////////
+class CPointStage : public CRowStage
+{
+    public:
+        CPointStage(const function<void(unsigned char*, int, int)>& op)
+            : m_op(op)
+        {
+        }// CPointStage
+
+        bool Push(unsigned char* pRows, int y, int count) override
+        {
+            const int step = m_bTopFirst ? 1 : -1;
+            const int rowBytes = m_width * 4;
+            Parallel_Rows(count, rowBytes, [&](int i0, int i1) {
+                for (int i = i0; i < i1; i++)
+                    m_op(pRows + (size_t)i * rowBytes, m_width, y + i * step);
+            });
+            return m_pNext->Push(pRows, y, count);
+        }// Push
+
+    private:
+        function<void(unsigned char*, int, int)>    m_op;
+};// CPointStage
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Stage whose output rows each read a window of windowRows consecutive
+//  input rows.  Incoming rows are prepared into a ring of slots, indexed by
+//  image row, that holds a window and a band; as soon as the window of the
+//  next output row has arrived, the ready outputs are computed in parallel
+//  and handed on.  Rows of a window outside the image are NULL.
+//
+///////////////////////////////////////////////////////////////////////////////
+class CWindowStage : public CRowStage
+{
+    public:
+        CWindowStage(int windowRows)
+            : m_windowRows(windowRows), m_pRing(NULL), m_pOut(NULL)
+        {
+        }// CWindowStage
+
+        ~CWindowStage()
+        {
+            Pool_Free(m_pRing);
+            Pool_Free(m_pOut);
+        }// ~CWindowStage
+
+        bool Begin(int width, int height, bool bTopFirst, int maxRows) override
+        {
+            m_width = width;
+            m_height = height;
+            m_bTopFirst = bTopFirst;
+            m_maxRows = maxRows;
+            OutputSize(width, height, m_outWidth, m_outHeight);
+
+            m_capacity = m_windowRows + maxRows;
+            m_slotBytes = SlotBytes(width);
+            m_received = m_emitted = 0;
+
+            Pool_Free(m_pRing);
+            Pool_Free(m_pOut);
+            m_pRing = Pool_New<unsigned char>(m_capacity * m_slotBytes);
+            m_pOut = Pool_New<unsigned char>((size_t)maxRows * m_outWidth * 4 + 1);
+            return m_pRing && m_pOut && m_pNext->Begin(m_outWidth, m_outHeight, bTopFirst, maxRows);
+        }// Begin
+
+        bool Push(unsigned char* pRows, int y, int count) override
+        {
+            const int step = m_bTopFirst ? 1 : -1;
+            const int rowBytes = m_width * 4;
+            atomic<bool> bFailed(false);
+            Parallel_Rows(count, rowBytes, [&](int i0, int i1) {
+                for (int i = i0; i < i1 && !bFailed; i++)
+                    if (!Prepare(pRows + (size_t)i * rowBytes, Slot(y + i * step)))
+                        bFailed = true;
+            });
+            m_received += count;
+            return !bFailed && Emit();
+        }// Push
+
+        bool End() override
+        {
+            return Emit() && m_pNext->End();
+        }// End
+
+    protected:
+        virtual void   OutputSize(int width, int height, int& outWidth, int& outHeight) = 0;
+        virtual int    FirstRow(int yo) = 0;           // top input row of the window of output row yo
+        virtual size_t SlotBytes(int width) = 0;
+        virtual bool   Prepare(const unsigned char* pRow, unsigned char* pSlot) = 0;    // false if out of memory
+        virtual bool   Compute(int yo, const unsigned char* const* slots, unsigned char* pOut) = 0;
+
+    private:
+        unsigned char* Slot(int y)
+        {
+            return m_pRing + (y % m_capacity) * m_slotBytes;
+        }// Slot
+
+        // the n-th output row in stream order
+        int OutputRow(int n)
+        {
+            return m_bTopFirst ? n : m_outHeight - 1 - n;
+        }// OutputRow
+
+        // whether every row of the window of output row yo has arrived
+        bool Ready(int yo)
+        {
+            int first = Max(FirstRow(yo), 0);
+            int last = Min(FirstRow(yo) + m_windowRows - 1, m_height - 1);
+            return m_bTopFirst ? last < m_received : first >= m_height - m_received;
+        }// Ready
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Compute and hand on the output rows whose windows are complete,
+        //  at most a band at a time.  Windows of later outputs start later, so
+        //  the rows a pending output still needs are never overwritten.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        bool Emit()
+        {
+            const int step = m_bTopFirst ? 1 : -1;
+            const int outBytes = m_outWidth * 4;
+
+            while (m_emitted < m_outHeight) {
+                int count = 0;
+                while (count < m_maxRows && m_emitted + count < m_outHeight && Ready(OutputRow(m_emitted + count)))
+                    count++;
+                if (!count)
+                    return true;
+
+                const int yo = OutputRow(m_emitted);
+                atomic<bool> bFailed(false);
+                Parallel_Rows(count, outBytes, [&](int i0, int i1) {
+                    vector<const unsigned char*> slots(m_windowRows);
+                    for (int i = i0; i < i1 && !bFailed; i++) {
+                        int first = FirstRow(yo + i * step);
+                        for (int k = 0; k < m_windowRows; k++) {
+                            int y = first + k;
+                            slots[k] = (y < 0 || y >= m_height) ? NULL : Slot(y);
+                        }
+                        if (!Compute(yo + i * step, &slots[0], m_pOut + (size_t)i * outBytes))
+                            bFailed = true;
+                    }
+                });
+
+                if (bFailed || !m_pNext->Push(m_pOut, yo, count))
+                    return false;
+                m_emitted += count;
+            }
+            return true;
+        }// Emit
+
+    protected:
+        int             m_outWidth;         // size of the outgoing image
+        int             m_outHeight;
+
+    private:
+        int             m_windowRows;       // input rows read by each output row
+        int             m_capacity;         // slots in the ring
+        size_t          m_slotBytes;
+        unsigned char*  m_pRing;            // slot of image row y is y % m_capacity
+        unsigned char*  m_pOut;             // one band of output rows
+        int             m_received;         // input rows prepared so far
+        int             m_emitted;          // output rows handed on so far
+};// CWindowStage
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Separable filter over the color channels, with the same arithmetic as
+//  TargaImage::Filter_Channels and Convolve_Separable: each slot holds the
+//  RGBA row and its three color planes after the row pass, and the column
+//  pass runs over the window when the output row is computed.
+//
+///////////////////////////////////////////////////////////////////////////////
+class CFilterStage : public CWindowStage
+{
+    public:
+        CFilterStage(const float* kernel, int radius, float selfWeight, float blurWeight, float bias)
+            : CWindowStage(2 * radius + 1), m_kernel(kernel, kernel + 2 * radius + 1), m_radius(radius),
+              m_selfWeight(selfWeight), m_blurWeight(blurWeight), m_bias(bias)
+        {
+        }// CFilterStage
+
+    protected:
+        void OutputSize(int width, int height, int& outWidth, int& outHeight) override
+        {
+            outWidth = width;
+            outHeight = height;
+        }// OutputSize
+
+        int FirstRow(int yo) override
+        {
+            return yo - m_radius;
+        }// FirstRow
+
+        size_t SlotBytes(int width) override
+        {
+            return (size_t)width * 4 + (size_t)width * 3 * sizeof(float);
+        }// SlotBytes
+
+        bool Prepare(const unsigned char* pRow, unsigned char* pSlot) override
+        {
+            float* planes = (float*)(pSlot + m_width * 4);
+            float* source = Pool_New<float>(m_width);
+            float* padded = Pool_New<float>(m_width + 2 * m_radius);
+            if (!source || !padded) {
+                Pool_Free(padded);
+                Pool_Free(source);
+                return false;
+            }
+
+            memcpy(pSlot, pRow, m_width * 4);
+            for (int color_i = 0; color_i < 3; color_i++) {
+                for (int x = 0; x < m_width; x++)
+                    source[x] = pRow[x * 4 + color_i] / 255.0f;
+                Convolve_Row(source, planes + color_i * m_width, m_width, &m_kernel[0], m_radius, padded);
+            }
+
+            Pool_Free(padded);
+            Pool_Free(source);
+            return true;
+        }// Prepare
+
+        bool Compute(int, const unsigned char* const* slots, unsigned char* pOut) override
+        {
+            const unsigned char* center = slots[m_radius];
+            vector<const float*> rows(2 * m_radius + 1);
+            float* blurred = Pool_New<float>(m_width);
+            if (!blurred)
+                return false;
+
+            memcpy(pOut, center, m_width * 4);
+            for (int color_i = 0; color_i < 3; color_i++) {
+                for (int k = 0; k <= 2 * m_radius; k++)
+                    rows[k] = slots[k] ? (const float*)(slots[k] + m_width * 4) + color_i * m_width : NULL;
+                Convolve_Column(&rows[0], blurred, m_width, &m_kernel[0], m_radius);
+
+                for (int x = 0; x < m_width; x++) {
+                    float newVal = m_selfWeight * (center[x * 4 + color_i] / 255.0f) + m_blurWeight * blurred[x] + m_bias;
+                    if (newVal < 0.0f) newVal = 0.0f;
+                    if (newVal > 1.0f) newVal = 1.0f;
+                    pOut[x * 4 + color_i] = (unsigned char)(newVal * 255.0f + 0.5f);
+                }
+            }
+
+            Pool_Free(blurred);
+            return true;
+        }// Compute
+
+    private:
+        vector<float>   m_kernel;
+        int             m_radius;
+        float           m_selfWeight;
+        float           m_blurWeight;
+        float           m_bias;
+};// CFilterStage
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Half size reduction with the same arithmetic as TargaImage::Half_Size:
+//  output pixel (x, y) is the 3 x 3 binomial average around input pixel
+//  (2x, 2y), truncated, with alpha set to 255.
+//
+///////////////////////////////////////////////////////////////////////////////
+class CHalfStage : public CWindowStage
+{
+    public:
+        CHalfStage()
+            : CWindowStage(3)
+        {
+        }// CHalfStage
+
+    protected:
+        void OutputSize(int width, int height, int& outWidth, int& outHeight) override
+        {
+            outWidth = width / 2;
+            outHeight = height / 2;
+        }// OutputSize
+
+        int FirstRow(int yo) override
+        {
+            return yo * 2 - 1;
+        }// FirstRow
+
+        size_t SlotBytes(int width) override
+        {
+            return (size_t)width * 4;
+        }// SlotBytes
+
+        bool Prepare(const unsigned char* pRow, unsigned char* pSlot) override
+        {
+            memcpy(pSlot, pRow, m_width * 4);
+            return true;
+        }// Prepare
+
+        bool Compute(int, const unsigned char* const* slots, unsigned char* pOut) override
+        {
+            const float mask[3][3] = { { 1.0f / 16, 2.0f / 16, 1.0f / 16 },
+                                       { 2.0f / 16, 4.0f / 16, 2.0f / 16 },
+                                       { 1.0f / 16, 2.0f / 16, 1.0f / 16 } };
+
+            for (int x = 0; x < m_outWidth; x++) {
+                int srcX = x * 2;
+                for (int color = 0; color < 3; color++) {
+                    float newVal = 0.0f;
+                    for (int maskY = 0; maskY < 3; maskY++) {
+                        if (!slots[maskY]) continue;
+                        for (int maskX = 0; maskX < 3; maskX++) {
+                            int idxX = srcX + maskX - 1;
+                            if (idxX < 0 || idxX >= m_width) continue;
+                            newVal += mask[maskY][maskX] * (float)slots[maskY][idxX * 4 + color];
+                        }
+                    }
+                    pOut[x * 4 + color] = (unsigned char)newVal;
+                }
+                pOut[x * 4 + 3] = 255;
+            }
+            return true;
+        }// Compute
+};// CHalfStage
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Last stage: writes the rows to a targa file in the order they come.
+//
+///////////////////////////////////////////////////////////////////////////////
+class CTargaSink : public CRowStage
+{
+    public:
+        CTargaSink(const char* sFilename, bool bRLE)
+            : m_sFilename(sFilename), m_bRLE(bRLE), m_pWriter(NULL)
+        {
+        }// CTargaSink
+
+        ~CTargaSink()
+        {
+            if (m_pWriter)
+                tga_finish_rows(m_pWriter);
+        }// ~CTargaSink
+
+        bool Begin(int width, int height, bool bTopFirst, int maxRows) override
+        {
+            CRowStage::Begin(width, height, bTopFirst, maxRows);
+            m_pWriter = tga_create_rows(m_sFilename, width, height, bTopFirst, TGA_TRUECOLOR_32, m_bRLE);
+            return m_pWriter != NULL;
+        }// Begin
+
+        bool Push(unsigned char* pRows, int, int count) override
+        {
+            return tga_write_rows(m_pWriter, pRows, count) != 0;
+        }// Push
+
+        bool End() override
+        {
+            int finished = tga_finish_rows(m_pWriter);
+            m_pWriter = NULL;
+            return finished != 0;
+        }// End
+
+    private:
+        const char*         m_sFilename;
+        bool                m_bRLE;
+        tga_row_writer*     m_pWriter;
+};// CTargaSink
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.
+//
+///////////////////////////////////////////////////////////////////////////////
+CStreamPipeline::CStreamPipeline()
+{
+}// CStreamPipeline
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Destructor.  Free the stages.
+//
+///////////////////////////////////////////////////////////////////////////////
+CStreamPipeline::~CStreamPipeline()
+{
+    for (size_t i = 0; i < m_stages.size(); ++i)
+        delete m_stages[i];
+}// ~CStreamPipeline
+
+
+void CStreamPipeline::AddGrayscale()
+{
+    AddPoint([](unsigned char* row, int width, int) { Gray_Row(row, width); });
+}// AddGrayscale
+
+
+void CStreamPipeline::AddQuantUniform()
+{
+    AddPoint([](unsigned char* row, int width, int) { Quant_Uniform_Row(row, width); });
+}// AddQuantUniform
+
+
+void CStreamPipeline::AddDitherThreshold()
+{
+    AddPoint([](unsigned char* row, int width, int) {
+        Gray_Row(row, width);
+        Threshold_Row(row, width, 128);
+    });
+}// AddDitherThreshold
+
+
+void CStreamPipeline::AddDitherCluster()
+{
+    AddPoint([](unsigned char* row, int width, int y) {
+        Gray_Row(row, width);
+        Threshold_Cluster_Row(row, width, 0, y);
+    });
+}// AddDitherCluster
+
+
+void CStreamPipeline::AddFilterBox()
+{
+    AddFilterBoxN(2);
+}// AddFilterBox
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Box filter of the given radius.  Streams as a uniform FIR kernel, so
+//  the cost grows with the radius, unlike the running sums of Box_Filter.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CStreamPipeline::AddFilterBoxN(int radius)
+{
+    if (radius < 1)
+        return false;
+
+    vector<float> kernel(2 * radius + 1, 1.0f / (2 * radius + 1));
+    AddFilter(&kernel[0], radius, 0.0f, 1.0f, 0.0f);
+    return true;
+}// AddFilterBoxN
+
+
+void CStreamPipeline::AddFilterBartlett()
+{
+    const float kernel[5] = { 1.0f / 9, 2.0f / 9, 3.0f / 9, 2.0f / 9, 1.0f / 9 };
+
+    AddFilter(kernel, 2, 0.0f, 1.0f, 0.0f);
+}// AddFilterBartlett
+
+
+void CStreamPipeline::AddFilterGaussian()
+{
+    const float kernel[5] = { 1.0f / 16, 4.0f / 16, 6.0f / 16, 4.0f / 16, 1.0f / 16 };
+
+    AddFilter(kernel, 2, 0.0f, 1.0f, 0.0f);
+}// AddFilterGaussian
+
+
+bool CStreamPipeline::AddFilterGaussianN(int N)
+{
+    if (N < 1 || N % 2 != 1)
+        return false;
+    if (N == 1)
+        return true;
+
+    if (N > 31)
+        return AddFilterGaussianSigma(sqrtf((float)(N - 1)) / 2.0f);
+
+    vector<float> kernel;
+    Make_Binomial_Kernel(N, kernel);
+    AddFilter(&kernel[0], N / 2, 0.0f, 1.0f, 0.0f);
+    return true;
+}// AddFilterGaussianN
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Gaussian of the given sigma.  Always the FIR kernel: the recursive
+//  filter runs over whole columns, which a stream never holds.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CStreamPipeline::AddFilterGaussianSigma(float sigma)
+{
+    if (sigma <= 0.0f)
+        return false;
+
+    vector<float> kernel;
+    int radius = Make_Gaussian_Kernel(sigma, kernel);
+    AddFilter(&kernel[0], radius, 0.0f, 1.0f, 0.0f);
+    return true;
+}// AddFilterGaussianSigma
+
+
+void CStreamPipeline::AddFilterEdge()
+{
+    const float kernel[5] = { 1.0f / 16, 4.0f / 16, 6.0f / 16, 4.0f / 16, 1.0f / 16 };
+
+    AddFilter(kernel, 2, 1.0f, -1.0f, 0.5f);
+}// AddFilterEdge
+
+
+void CStreamPipeline::AddFilterEnhance()
+{
+    const float kernel[5] = { 1.0f / 16, 4.0f / 16, 6.0f / 16, 4.0f / 16, 1.0f / 16 };
+
+    AddFilter(kernel, 2, 2.0f, -1.0f, 0.0f);
+}// AddFilterEnhance
+
+
+void CStreamPipeline::AddHalfSize()
+{
+    m_stages.push_back(new CHalfStage);
+}// AddHalfSize
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Stream the input file through the operations into the output file.
+//  Bands of about c_bandBytes are read at a time.  Return success of
+//  operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CStreamPipeline::Run(const char* sInput, const char* sOutput, bool bRLE)
+{
+    if (!sInput || !sOutput)
+    {
+        cout << "No filename given." << endl;
+        return false;
+    }// if
+
+    int width, height, topFirst;
+    tga_row_reader* pReader = tga_open_rows(sInput, &width, &height, &topFirst, TGA_TRUECOLOR_32);
+    if (!pReader)
+    {
+        cout << "TGA Error: " << tga_error_string(tga_get_last_error()) << endl;
+        return false;
+    }// if
+
+    CTargaSink sink(sOutput, bRLE != 0);
+    for (size_t i = 0; i < m_stages.size(); ++i)
+        m_stages[i]->SetNext(i + 1 < m_stages.size() ? m_stages[i + 1] : &sink);
+    CRowStage* pFirst = m_stages.empty() ? (CRowStage*)&sink : m_stages[0];
+
+    const int      maxRows = Max(c_bandBytes / Max(width * 4, 1), 1);
+    unsigned char* pBand = Pool_New<unsigned char>((size_t)maxRows * width * 4 + 1);
+
+    bool bResult = pBand && pFirst->Begin(width, height, topFirst != 0, maxRows);
+    for (int read = 0; bResult && read < height; )
+    {
+        int count = tga_read_rows(pReader, pBand, Min(maxRows, height - read));
+        bResult = pFirst->Push(pBand, topFirst ? read : height - 1 - read, count);
+        read += count;
+    }// for
+    bResult = bResult && pFirst->End();
+
+    if (!bResult)
+        cout << "TGA Stream Error: " << tga_error_string(tga_get_last_error()) << endl;
+
+    Pool_Free(pBand);
+    tga_close_rows(pReader);
+    return bResult;
+}// Run
+
+
+void CStreamPipeline::AddPoint(const function<void(unsigned char*, int, int)>& op)
+{
+    m_stages.push_back(new CPointStage(op));
+}// AddPoint
+
+
+void CStreamPipeline::AddFilter(const float* kernel, int radius, float selfWeight, float blurWeight, float bias)
+{
+    m_stages.push_back(new CFilterStage(kernel, radius, selfWeight, blurWeight, bias));
+}// AddFilter
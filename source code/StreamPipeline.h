@@ -0,0 +1,119 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      StreamPipeline.h
+//
+//      Runs a chain of operations over a targa file a band of rows at a time,
+//  for images too large to load whole.  Rows are decoded in file order,
+//  pushed through the stages and written out as soon as they are finished,
+//  so memory use is one band per stage plus, for each filter, a ring of the
+//  rows its window covers: O(width * kernel height) rather than O(width *
+//  height).  Only operations that read a bounded neighborhood can stream:
+//  the point operations, the separable filters and Half_Size.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _C_STREAM_PIPELINE
+#define _C_STREAM_PIPELINE
+
+#include <functional>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      One stage of a stream.  Rows of premultiplied RGBA bytes arrive in
+//  bands in file order: row i of a band is image row y + i if the file is
+//  top row first, else y - i, with y counted from the top.  Each stage hands
+//  its results on to the next in the same order.
+//
+///////////////////////////////////////////////////////////////////////////////
+class CRowStage
+{
+    // methods
+    public:
+        CRowStage();
+        virtual ~CRowStage() {}
+
+        void SetNext(CRowStage* pNext);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Start a width x height image whose bands hold at most maxRows
+        //  rows.  Return false on failure.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        virtual bool Begin(int width, int height, bool bTopFirst, int maxRows);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Take count rows starting at image row y.  The stage may change
+        //  the rows in place.  Return false on failure.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        virtual bool Push(unsigned char* pRows, int y, int count) = 0;
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      All rows have been pushed.  Return false on failure.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        virtual bool End();
+
+    // members
+    protected:
+        CRowStage*  m_pNext;            // stage the results go to
+        int         m_width;            // size of the incoming image
+        int         m_height;
+        bool        m_bTopFirst;        // rows arrive top row first
+        int         m_maxRows;          // largest band
+};// CRowStage
+
+
+class CStreamPipeline
+{
+    // methods
+    public:
+        CStreamPipeline();
+        ~CStreamPipeline();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Append an operation.  Each matches the TargaImage method of the
+        //  same name; the filters round to 8 bits between stages.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        void AddGrayscale();
+        void AddQuantUniform();
+        void AddDitherThreshold();
+        void AddDitherCluster();
+        void AddFilterBox();
+        bool AddFilterBoxN(int radius);
+        void AddFilterBartlett();
+        void AddFilterGaussian();
+        bool AddFilterGaussianN(int N);
+        bool AddFilterGaussianSigma(float sigma);
+        void AddFilterEdge();
+        void AddFilterEnhance();
+        void AddHalfSize();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Stream the input file through the operations into the output
+        //  file, run length encoded if bRLE is set.  The output keeps the row
+        //  order of the input.  Return success of operation.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        bool Run(const char* sInput, const char* sOutput, bool bRLE);
+
+    private:
+        CStreamPipeline(const CStreamPipeline&) = delete;
+        CStreamPipeline& operator=(const CStreamPipeline&) = delete;
+
+        void AddPoint(const std::function<void(unsigned char*, int, int)>& op);
+        void AddFilter(const float* kernel, int radius, float selfWeight, float blurWeight, float bias);
+
+    // members
+    private:
+        std::vector<CRowStage*> m_stages;       // operations in order, owned
+};// CStreamPipeline
+
+#endif // _C_STREAM_PIPELINE
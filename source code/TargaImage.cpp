@@ -12,6 +12,10 @@
 #include "Globals.h"
 #include "TargaImage.h"
 #include "libtarga.h"
+#include "Convolution.h"
+#include "ThreadPool.h"
+#include "PixelKernels.h"
+#include "BufferPool.h"
 #include <stdlib.h>
 #include <assert.h>
 #include <memory.h>
@@ -21,6 +25,8 @@
 #include <vector>
 #include <algorithm>
 #include <random>
+#include <atomic>
+#include <mutex>
 
 using namespace std;
 
@@ -29,6 +35,10 @@ const int           RED = 0;                // red channel
 const int           GREEN = 1;                // green channel
 const int           BLUE = 2;                // blue channel
 const unsigned char BACKGROUND[3] = { 0, 0, 0 };      // background color
+const unsigned int  c_maxBinomialTaps = 31;           // largest Filter_Gaussian_N run as an exact binomial kernel
+const float         c_minRecursiveSigma = 3.0f;       // smallest sigma run through the recursive Gaussian
+const float         c_haloSigmas = 4.0f;              // halo read around a region for the recursive Gaussian, in sigmas
+const int32_t       c_rawTag = 0x32574152;            // "RAW2", first word of a Save_Raw file
 
 
 // Computes n choose s, efficiently
@@ -44,12 +54,40 @@ double Binomial(int n, int s)
 }// Binomial
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run a libtarga loop over bands of rows on the thread pool.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Targa_Parallel(int rows, int rowLength, tga_row_body body, void* context)
+{
+    Parallel_Rows(rows, rowLength, [body, context](int y0, int y1) { body(context, y0, y1); });
+}// Targa_Parallel
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Have libtarga draw its buffers from the buffer pool and hand them over
+//  top row first, as the images keep them, so loads and saves need no copies,
+//  and decode bands of rows on the thread pool.  Done once, on the first load
+//  or save.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Configure_Targa()
+{
+    static const bool bConfigured = (tga_set_allocator(Pool_Alloc, Pool_Free), tga_set_row_order(TGA_ROWS_TOP_DOWN),
+                                     tga_set_parallel(Targa_Parallel), true);
+    (void)bConfigured;
+}// Configure_Targa
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Constructor.  Initialize member variables.
 //
 ///////////////////////////////////////////////////////////////////////////////
-TargaImage::TargaImage() : width(0), height(0), data(NULL)
+TargaImage::TargaImage() : width(0), height(0), data(NULL), m_pPlanes(NULL), m_bBytesStale(false),
+    m_roiX(0), m_roiY(0), m_roiWidth(0), m_roiHeight(0)
 {}// TargaImage
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -57,9 +95,12 @@ TargaImage::TargaImage() : width(0), height(0), data(NULL)
 //      Constructor.  Initialize member variables.
 //
 ///////////////////////////////////////////////////////////////////////////////
-TargaImage::TargaImage(int w, int h) : width(w), height(h)
+TargaImage::TargaImage(int w, int h) : width(w), height(h), data(NULL), m_pPlanes(NULL), m_bBytesStale(false),
+    m_roiX(0), m_roiY(0), m_roiWidth(0), m_roiHeight(0)
 {
-    data = new unsigned char[width * height * 4];
+    Replace_Data(Pool_New<unsigned char>(width * height * 4));
+    if (!data)
+        throw std::bad_alloc();
     ClearToBlack();
 }// TargaImage
 
@@ -70,13 +111,16 @@ TargaImage::TargaImage(int w, int h) : width(w), height(h)
 //      Constructor.  Initialize member variables to values given.
 //
 ///////////////////////////////////////////////////////////////////////////////
-TargaImage::TargaImage(int w, int h, unsigned char* d)
+TargaImage::TargaImage(int w, int h, const unsigned char* d) : data(NULL), m_pPlanes(NULL), m_bBytesStale(false),
+    m_roiX(0), m_roiY(0), m_roiWidth(0), m_roiHeight(0)
 {
     int i;
 
     width = w;
     height = h;
-    data = new unsigned char[width * height * 4];
+    Replace_Data(Pool_New<unsigned char>(width * height * 4));
+    if (!data)
+        throw std::bad_alloc();
 
     for (i = 0; i < width * height * 4; i++)
         data[i] = d[i];
@@ -84,19 +128,49 @@ TargaImage::TargaImage(int w, int h, unsigned char* d)
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Copy Constructor.  Initialize member to that of input
+//      Constructor.  Take ownership of the pixels given, which must come from
+//  Pool_Alloc, without copying them.
 //
 ///////////////////////////////////////////////////////////////////////////////
-TargaImage::TargaImage(const TargaImage& image)
+TargaImage::TargaImage(int w, int h, unsigned char* d, EAdopt) : width(w), height(h), data(NULL),
+    m_pPlanes(NULL), m_bBytesStale(false), m_roiX(0), m_roiY(0), m_roiWidth(0), m_roiHeight(0)
+{
+    Replace_Data(d);
+}// TargaImage
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Copy Constructor.  Initialize member to that of input.  The pixels
+//  are shared, not copied, until one of the images changes them; the float
+//  planes are working state and are copied.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage::TargaImage(const TargaImage& image) : data(image.data), m_pStorage(image.m_pStorage),
+    m_pPlanes(NULL), m_bBytesStale(false),
+    m_roiX(image.m_roiX), m_roiY(image.m_roiY), m_roiWidth(image.m_roiWidth), m_roiHeight(image.m_roiHeight)
 {
     width = image.width;
     height = image.height;
-    data = NULL;
-    if (image.data != NULL) {
-        data = new unsigned char[width * height * 4];
-        memcpy(data, image.data, sizeof(unsigned char) * width * height * 4);
+    if (image.m_pPlanes != NULL) {
+        m_pPlanes = Pool_New<float>(width * height * 3);
+        if (!m_pPlanes)
+            throw std::bad_alloc();
+        memcpy(m_pPlanes, image.m_pPlanes, sizeof(float) * width * height * 3);
+        m_bBytesStale = image.m_bBytesStale;
     }
-}
+}// TargaImage
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Move Constructor.  Take over the buffers of the input, leaving it
+//  empty.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage::TargaImage(TargaImage&& image) : width(0), height(0), data(NULL), m_pPlanes(NULL), m_bBytesStale(false),
+    m_roiX(0), m_roiY(0), m_roiWidth(0), m_roiHeight(0)
+{
+    Swap(image);
+}// TargaImage
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -106,11 +180,63 @@ TargaImage::TargaImage(const TargaImage& image)
 ///////////////////////////////////////////////////////////////////////////////
 TargaImage::~TargaImage()
 {
-    if (data)
-        delete[] data;
+    Pool_Free(m_pPlanes);
 }// ~TargaImage
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Copy assignment.  Copy the input, then release the old buffers.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage& TargaImage::operator=(const TargaImage& image)
+{
+    if (this != &image)
+    {
+        TargaImage copy(image);
+        Swap(copy);
+    }// if
+    return *this;
+}// operator=
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Move assignment.  Take over the buffers of the input, leaving it
+//  empty, and release the old ones.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage& TargaImage::operator=(TargaImage&& image)
+{
+    if (this != &image)
+    {
+        TargaImage old(std::move(image));
+        Swap(old);
+    }// if
+    return *this;
+}// operator=
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Exchange the pixels, planes and region of interest of two images.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Swap(TargaImage& image)
+{
+    swap(width, image.width);
+    swap(height, image.height);
+    swap(data, image.data);
+    swap(m_pStorage, image.m_pStorage);
+    swap(m_pPlanes, image.m_pPlanes);
+    swap(m_bBytesStale, image.m_bBytesStale);
+    swap(m_roiX, image.m_roiX);
+    swap(m_roiY, image.m_roiY);
+    swap(m_roiWidth, image.m_roiWidth);
+    swap(m_roiHeight, image.m_roiHeight);
+}// Swap
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Converts an image to RGB form, and returns the rgb pixel data - 24 
@@ -126,6 +252,8 @@ unsigned char* TargaImage::To_RGB(void)
     if (!data)
         return NULL;
 
+    Sync_Bytes();
+
     // Divide out the alpha
     for (i = 0; i < height; i++)
     {
@@ -144,24 +272,26 @@ unsigned char* TargaImage::To_RGB(void)
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Save the image to a targa file. Returns 1 on success, 0 on failure.
+//      Save the image to a targa file, run length encoded if bRLE is set.
+//  Returns 1 on success, 0 on failure.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Save_Image(const char* filename)
+bool TargaImage::Save_Image(const char* filename, bool bRLE)
 {
-    TargaImage* out_image = Reverse_Rows();
+    Configure_Targa();
+    Sync_Bytes();
 
-    if (!out_image)
+    if (!data || m_bBytesStale)
         return false;
 
-    if (!tga_write_raw(filename, width, height, out_image->data, TGA_TRUECOLOR_32))
+    int written = bRLE ? tga_write_rle(filename, width, height, data, TGA_TRUECOLOR_32)
+                       : tga_write_raw(filename, width, height, data, TGA_TRUECOLOR_32);
+    if (!written)
     {
         cout << "TGA Save Error: %s\n", tga_error_string(tga_get_last_error());
         return false;
     }
 
-    delete out_image;
-
     return true;
 }// Save_Image
 
@@ -175,8 +305,6 @@ bool TargaImage::Save_Image(const char* filename)
 TargaImage* TargaImage::Load_Image(char* filename)
 {
     unsigned char* temp_data;
-    TargaImage* temp_image;
-    TargaImage* result;
     int		        width, height;
 
     if (!filename)
@@ -185,6 +313,7 @@ TargaImage* TargaImage::Load_Image(char* filename)
         return NULL;
     }// if
 
+    Configure_Targa();
     temp_data = (unsigned char*)tga_load(filename, &width, &height, TGA_TRUECOLOR_32);
     if (!temp_data)
     {
@@ -192,15 +321,157 @@ TargaImage* TargaImage::Load_Image(char* filename)
         width = height = 0;
         return NULL;
     }
-    temp_image = new TargaImage(width, height, temp_data);
-    free(temp_data);
 
-    result = temp_image->Reverse_Rows();
+    // already top row first and from the pool, so the image takes it as is
+    return new TargaImage(width, height, temp_data, ADOPT);
+}// Load_Image
 
-    delete temp_image;
 
-    return result;
-}// Load_Image
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Save the image in the raw format: a tag, the width, height and number
+//  of float planes, then the premultiplied RGBA rows top first and the
+//  planes if the image holds them, all in native byte order.  The planes
+//  are kept so an image loaded back carries on from the same colors as this
+//  one, rather than from colors rounded to 8 bits.  It is only meant for
+//  caches on this machine, and loads with a single read per buffer.
+//  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Save_Raw(const char* filename)
+{
+    Sync_Bytes();
+
+    if (!data || m_bBytesStale || !filename)
+        return false;
+
+    FILE* pFile = fopen(filename, "wb");
+    if (!pFile)
+        return false;
+
+    int32_t header[4] = { c_rawTag, width, height, m_pPlanes ? 3 : 0 };
+    bool bResult = fwrite(header, sizeof(header), 1, pFile) == 1 &&
+                   fwrite(data, (size_t)width * height * 4, 1, pFile) == 1 &&
+                   (!m_pPlanes || fwrite(m_pPlanes, (size_t)width * height * 3 * sizeof(float), 1, pFile) == 1);
+    return fclose(pFile) == 0 && bResult;
+}// Save_Raw
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Load an image written by Save_Raw.  Return a new TargaImage object
+//  which must be deleted by caller.  Return NULL on failure.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage* TargaImage::Load_Raw(const char* filename)
+{
+    FILE* pFile = filename ? fopen(filename, "rb") : NULL;
+    if (!pFile)
+        return NULL;
+
+    int32_t header[4];
+    if (fread(header, sizeof(header), 1, pFile) != 1 || header[0] != c_rawTag || header[1] <= 0 || header[2] <= 0 ||
+        (header[3] != 0 && header[3] != 3))
+    {
+        fclose(pFile);
+        return NULL;
+    }// if
+
+    size_t numPixels = (size_t)header[1] * header[2];
+    unsigned char* pixels = Pool_New<unsigned char>(numPixels * 4);
+    float* planes = header[3] ? Pool_New<float>(numPixels * 3) : NULL;
+    bool bRead = pixels && (!header[3] || planes) &&
+                 fread(pixels, numPixels * 4, 1, pFile) == 1 &&
+                 (!planes || fread(planes, numPixels * 3 * sizeof(float), 1, pFile) == 1);
+    fclose(pFile);
+
+    if (!bRead)
+    {
+        Pool_Free(pixels);
+        Pool_Free(planes);
+        return NULL;
+    }// if
+
+    TargaImage* pImage = new TargaImage(header[1], header[2], pixels, ADOPT);
+    pImage->m_pPlanes = planes;
+    return pImage;
+}// Load_Raw
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Get the size of the file Save_Raw would write for the image as it is.
+//
+///////////////////////////////////////////////////////////////////////////////
+size_t TargaImage::Raw_Size() const
+{
+    size_t numPixels = (size_t)width * height;
+    return 4 * sizeof(int32_t) + numPixels * 4 + (m_pPlanes ? numPixels * 3 * sizeof(float) : 0);
+}// Raw_Size
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Take on the size and pixels of the given image, sharing them until one
+//  of the images changes them, and a copy of its float planes if it holds
+//  any.  The region of interest is kept, so a cached result can stand in for
+//  the work it saves.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Share_Pixels(TargaImage& image)
+{
+    image.Sync_Bytes();
+
+    Pool_Free(m_pPlanes);
+    m_pPlanes = NULL;
+    m_bBytesStale = false;
+
+    width = image.width;
+    height = image.height;
+    data = image.data;
+    m_pStorage = image.m_pStorage;
+
+    // without room for the planes the image goes on from the rounded bytes
+    if (image.m_pPlanes != NULL && (m_pPlanes = Pool_New<float>(width * height * 3)) != NULL)
+        memcpy(m_pPlanes, image.m_pPlanes, sizeof(float) * width * height * 3);
+}// Share_Pixels
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Limit the following operations to the w x h rectangle at (x, y),
+//  counted from the top left, clipped to the image.  Filters still read the
+//  pixels around the rectangle, but only change those inside it.  Return
+//  false, leaving the region unchanged, if nothing of the rectangle is left.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Set_ROI(int x, int y, int w, int h)
+{
+    int x1 = Min(x + w, width);
+    int y1 = Min(y + h, height);
+    x = Max(x, 0);
+    y = Max(y, 0);
+
+    if (x1 <= x || y1 <= y)
+        return false;
+
+    m_roiX = x;
+    m_roiY = y;
+    m_roiWidth = x1 - x;
+    m_roiHeight = y1 - y;
+    return true;
+}// Set_ROI
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Let operations cover the whole image again.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Clear_ROI()
+{
+    m_roiX = m_roiY = m_roiWidth = m_roiHeight = 0;
+}// Clear_ROI
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -212,16 +483,10 @@ TargaImage* TargaImage::Load_Image(char* filename)
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::To_Grayscale()
 {
-    unsigned char* p_data = data;
-    for (int x = 0; x < width; x++) {
-        for (int y = 0; y < height; y++) {
-            float Luminance = 0.30 * (float)p_data[0] + 0.59 * (float)p_data[1] + 0.11 * (float)p_data[2];
-            p_data[0] = p_data[1] = p_data[2] = (unsigned char)Luminance;
-            p_data = p_data + 4;
-        }
-    }
+    if (!data)
+        return false;
 
-    return false;
+    return Point_Ops(vector<RowOp>(1, Gray_Op()));
 }// To_Grayscale
 
 
@@ -233,17 +498,10 @@ bool TargaImage::To_Grayscale()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Quant_Uniform()
 {
-    uint8_t* p_data = data;
-    for (int x = 0; x < width; x++) {
-        for (int y = 0; y < height; y++) {
-            p_data[0] = (p_data[0] >> 5) * 36.42857; // 1110_0000
-            p_data[1] = (p_data[1] >> 5) * 36.42857; // 1110_0000
-            p_data[2] = (p_data[2] >> 6) * 85; // 1100_0000
-            p_data = p_data + 4;
-        }
-    }
+    if (!data)
+        return false;
 
-    return false;
+    return Point_Ops(vector<RowOp>(1, Quant_Uniform_Op()));
 }// Quant_Uniform
 
 
@@ -255,7 +513,11 @@ bool TargaImage::Quant_Uniform()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Quant_Populosity()
 {
-    uint8_t* p_data;
+    if (!data)
+        return false;
+
+    if (!Release_Planes())
+        return false;
 
     // histogram
     std::vector<unsigned int> histogram;
@@ -267,28 +529,39 @@ bool TargaImage::Quant_Populosity()
         indices[i] = i; // index
     }
 
-    p_data = data;
-    for (int x = 0; x < width; x++) {
-        for (int y = 0; y < height; y++) {
-            // uniform quantization
-            uint8_t color_r = p_data[0] >> 3;
-            uint8_t color_g = p_data[1] >> 3;
-            uint8_t color_b = p_data[2] >> 3;
-            // count histogram
-            uint16_t color = (color_r << 10) | (color_g << 5) | (color_b << 0);
-            histogram[color] = histogram[color] + 1;
-            p_data = p_data + 4;
+    // count per band, then merge; counts are integers so the order does not matter
+    SPixelView pixels = Pixels();
+    if (!pixels.base)
+        return false;
+    std::mutex histogramMutex;
+    Parallel_Rows(pixels.height, pixels.Row_Length(), [&](int y0, int y1) {
+        std::vector<unsigned int> bandHistogram(32768, 0);
+        for (int y = y0; y < y1; y++) {
+            const uint8_t* p_data = pixels.Row(y);
+            for (int x = 0; x < pixels.width; x++) {
+                // uniform quantization
+                uint8_t color_r = p_data[0] >> 3;
+                uint8_t color_g = p_data[1] >> 3;
+                uint8_t color_b = p_data[2] >> 3;
+                // count histogram
+                uint16_t color = (color_r << 10) | (color_g << 5) | (color_b << 0);
+                bandHistogram[color] = bandHistogram[color] + 1;
+                p_data = p_data + 4;
+            }
         }
-    }
+
+        std::lock_guard<std::mutex> lock(histogramMutex);
+        for (unsigned int i = 0; i < 32768; i++)
+            histogram[i] += bandHistogram[i];
+    });
 
     // sort
     std::sort(indices.begin(), indices.end(),
         [&histogram](size_t i1, size_t i2) {return histogram[i1] > histogram[i2]; });
 
-    //
-    p_data = data;
-    for (int x = 0; x < width; x++) {
-        for (int y = 0; y < height; y++) {
+    // map every pixel to the closest of the 256 most popular colors
+    For_Each_Row(pixels, [&](uint8_t* p_data, int) {
+        for (int x = 0; x < pixels.width; x++) {
             float inColorR = (float)p_data[0] / 255.0f;
             float inColorG = (float)p_data[1] / 255.0f;
             float inColorB = (float)p_data[2] / 255.0f;
@@ -317,9 +590,9 @@ bool TargaImage::Quant_Populosity()
 
             p_data = p_data + 4;
         }
-    }
+    });
 
-    return false;
+    return true;
 }// Quant_Populosity
 
 
@@ -330,19 +603,10 @@ bool TargaImage::Quant_Populosity()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_Threshold()
 {
-    To_Grayscale();
+    if (!data)
+        return false;
 
-    const uint8_t threshold = 128;
-    uint8_t* p_data = data;
-    for (int x = 0; x < width; x++) {
-        for (int y = 0; y < height; y++) {
-            p_data[0] = (p_data[0] > threshold) ? 255 : 0;
-            p_data[1] = (p_data[1] > threshold) ? 255 : 0;
-            p_data[2] = (p_data[2] > threshold) ? 255 : 0;
-            p_data = p_data + 4;
-        }
-    }
-    return false;
+    return Point_Ops(vector<RowOp>(1, Dither_Threshold_Op()));
 }// Dither_Threshold
 
 
@@ -359,9 +623,14 @@ bool TargaImage::Dither_Random()
     const int uniformRange = 256 * 0.2;
     std::default_random_engine generator;
     std::uniform_int_distribution<int> distribution(-uniformRange, uniformRange);
-    uint8_t* p_data = data;
-    for (int x = 0; x < width; x++) {
-        for (int y = 0; y < height; y++) {
+
+    // one generator in row order, so this stays serial
+    SPixelView pixels = Pixels();
+    if (!pixels.base)
+        return false;
+    for (int y = 0; y < pixels.height; y++) {
+        uint8_t* p_data = pixels.Row(y);
+        for (int x = 0; x < pixels.width; x++) {
             int randVal = distribution(generator);
             p_data[0] = (((int)p_data[0] + randVal) > threshold) ? 255 : 0;
             p_data[1] = (((int)p_data[1] + randVal) > threshold) ? 255 : 0;
@@ -373,6 +642,44 @@ bool TargaImage::Dither_Random()
 }// Dither_Random
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Floyd-Steinberg error diffusion over a float plane in serpentine
+//  order.  quantize maps a value to its output level; the error is spread
+//  7/16 ahead, and 3/16, 5/16 and 1/16 to the row below.  Errors falling
+//  outside the view are dropped, so a view never changes pixels around it.
+//
+///////////////////////////////////////////////////////////////////////////////
+template <class Quantize>
+static void Diffuse_Errors(const SPlaneView& plane, Quantize quantize)
+{
+    for (int y = 0; y < plane.height; y++) {
+        float* row = plane.Row(y);
+        float* below = (y + 1 < plane.height) ? plane.Row(y + 1) : NULL;
+        int stepX = (y % 2 == 0) ? 1 : -1;
+        int x = (stepX == 1) ? 0 : plane.width - 1;
+
+        for (int n = 0; n < plane.width; n++, x += stepX) {
+            float newColor = quantize(row[x]);
+            float error = row[x] - newColor;
+            row[x] = newColor;
+
+            bool bAhead = x + stepX >= 0 && x + stepX < plane.width;
+            bool bBehind = x - stepX >= 0 && x - stepX < plane.width;
+            if (bAhead)
+                row[x + stepX] += 7.0f / 16.0f * error;
+            if (below) {
+                if (bBehind)
+                    below[x - stepX] += 3.0f / 16.0f * error;
+                below[x] += 5.0f / 16.0f * error;
+                if (bAhead)
+                    below[x + stepX] += 1.0f / 16.0f * error;
+            }
+        }
+    }
+}// Diffuse_Errors
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Perform Floyd-Steinberg dithering on the image.  Return success of 
@@ -381,87 +688,24 @@ bool TargaImage::Dither_Random()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_FS()
 {
-    To_Grayscale();
-
-    float* fdata = new float[width * height * 3];
-
-    float* p_fdata = fdata;
-    uint8_t* p_data = data;
+    if (!data)
+        return false;
 
-    // convert to float array
-    for (int x = 0; x < width; x++) {
-        for (int y = 0; y < height; y++) {
-            p_fdata[0] = p_data[0] / 255.0f;
-            p_fdata[1] = p_data[1] / 255.0f;
-            p_fdata[2] = p_data[2] / 255.0f;
+    To_Grayscale();
 
-            p_data = p_data + 4;
-            p_fdata = p_fdata + 3;
-        }
-    }
+    SPixelView pixels = Pixels();
+    if (!pixels.base || !Float_Planes())
+        return false;
 
     // Floyd-Steinberg
 
     const float threshold = 0.5f;
     for (int color_i = 0; color_i < 3; color_i++) {
-        float* p_fdata = fdata + color_i;
-        int y = 0, x = 0;
-        int stepX = 1;
-        while (1) {
-            // next pixel
-            if (x == width - 1) {
-                stepX = -1;
-                y = y + 1;
-            }
-            if (x == 0) {
-                stepX = 1;
-                y = y + 1;
-            }
-            if (y >= height) break;
-
-            x = x + stepX;
-
-
-
-            //
-            unsigned int pixelIdx = y * width + x;
-            float newColor = (p_fdata[pixelIdx * 3] > threshold) ? 1.0f : 0.0f;
-            float error = p_fdata[pixelIdx * 3] - newColor;
-
-            unsigned int neighborIdx = pixelIdx + stepX;
-            if (neighborIdx < width * height)
-                p_fdata[neighborIdx * 3] += 7.0f / 16.0f * error;
-            neighborIdx = pixelIdx + stepX + width;
-            if (neighborIdx < width * height)
-                p_fdata[neighborIdx * 3] += 1.0f / 16.0f * error;
-            neighborIdx = pixelIdx + width;
-            if (neighborIdx < width * height)
-                p_fdata[neighborIdx * 3] += 5.0f / 16.0f * error;
-            neighborIdx = pixelIdx - stepX + width;
-            if (neighborIdx < width * height)
-                p_fdata[neighborIdx * 3] += 3.0f / 16.0f * error;
-
-            p_fdata[pixelIdx * 3] = newColor;
-        }
+        SPlaneView plane = Plane(color_i).Sub(pixels.x, pixels.y, pixels.width, pixels.height);
+        Diffuse_Errors(plane, [threshold](float value) { return (value > threshold) ? 1.0f : 0.0f; });
     }
 
-
-    // copy data
-    p_fdata = fdata;
-    p_data = data;
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            p_data[0] = p_fdata[0] * 255.0f;
-            p_data[1] = p_fdata[1] * 255.0f;
-            p_data[2] = p_fdata[2] * 255.0f;
-
-            p_data = p_data + 4;
-            p_fdata = p_fdata + 3;
-        }
-    }
-
-    delete[]fdata;
-    return false;
+    return true;
 }// Dither_FS
 
 
@@ -473,22 +717,30 @@ bool TargaImage::Dither_FS()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_Bright()
 {
-    To_Grayscale();
+    if (!data)
+        return false;
 
-    uint8_t* p_data = data;
+    To_Grayscale();
 
     // histogram
+    SPixelView pixels = Pixels();
+    if (!pixels.base)
+        return false;
     for (unsigned int color_i = 0; color_i < 3; color_i++) {
-        double avgVal = 0.0;
-
-        p_data = data;
-        for (int x = 0; x < width; x++) {
-            for (int y = 0; y < height; y++) {
-                avgVal = avgVal + p_data[color_i];
-                p_data = p_data + 4;
+        // sum per band in integers, so the average does not depend on the banding
+        std::atomic<unsigned long long> sum(0);
+        Parallel_Rows(pixels.height, pixels.Row_Length(), [&](int y0, int y1) {
+            unsigned long long bandSum = 0;
+            for (int y = y0; y < y1; y++) {
+                const uint8_t* p_data = pixels.Row(y) + color_i;
+                for (int x = 0; x < pixels.width; x++) {
+                    bandSum = bandSum + *p_data;
+                    p_data = p_data + 4;
+                }
             }
-        }
-        avgVal = avgVal / (float)(width * height);
+            sum += bandSum;
+        });
+        double avgVal = (double)sum / (float)(pixels.width * pixels.height);
 
         // threshold
         unsigned int threshold = avgVal;
@@ -496,15 +748,15 @@ bool TargaImage::Dither_Bright()
         std::cout << "threshold : " << threshold << std::endl;
 
         // dither
-        p_data = data;
-        for (int x = 0; x < width; x++) {
-            for (int y = 0; y < height; y++) {
-                p_data[color_i] = (p_data[color_i] > threshold) ? 255 : 0;
+        For_Each_Row(pixels, [&](uint8_t* row, int) {
+            uint8_t* p_data = row + color_i;
+            for (int x = 0; x < pixels.width; x++) {
+                *p_data = (*p_data > threshold) ? 255 : 0;
                 p_data = p_data + 4;
             }
-        }
+        });
     }
-    return false;
+    return true;
 }// Dither_Bright
 
 
@@ -515,23 +767,10 @@ bool TargaImage::Dither_Bright()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_Cluster()
 {
-    To_Grayscale();
+    if (!data)
+        return false;
 
-    const uint8_t mask[4][4] = { {180, 90, 150, 60},
-                                 {15, 240, 210, 105},
-                                 {120, 195, 225, 30},
-                                 {45, 135, 75, 165},
-    };
-    uint8_t* p_data = data;
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            p_data[0] = (p_data[0] > mask[y % 4][x % 4]) ? 255 : 0;
-            p_data[1] = (p_data[1] > mask[y % 4][x % 4]) ? 255 : 0;
-            p_data[2] = (p_data[2] > mask[y % 4][x % 4]) ? 255 : 0;
-            p_data = p_data + 4;
-        }
-    }
-    return false;
+    return Point_Ops(vector<RowOp>(1, Dither_Cluster_Op()));
 }// Dither_Cluster
 
 
@@ -544,91 +783,22 @@ bool TargaImage::Dither_Cluster()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_Color()
 {
-    float* fdata = new float[width * height * 3];
-
-    float* p_fdata = fdata;
-    uint8_t* p_data = data;
-
-    // convert to float array
-    for (int x = 0; x < width; x++) {
-        for (int y = 0; y < height; y++) {
-            p_fdata[0] = p_data[0] / 255.0f;
-            p_fdata[1] = p_data[1] / 255.0f;
-            p_fdata[2] = p_data[2] / 255.0f;
-
-            p_data = p_data + 4;
-            p_fdata = p_fdata + 3;
-        }
-    }
+    if (!data)
+        return false;
 
-    // Floyd-Steinberg
+    SPixelView pixels = Pixels();
+    if (!pixels.base || !Float_Planes())
+        return false;
 
-    const float threshold = 0.5f;
+    // Floyd-Steinberg; R and G to 3 bits, B to 2 bits
+    const float levels[3] = { 8.0f, 8.0f, 4.0f };
     for (int color_i = 0; color_i < 3; color_i++) {
-        float* p_fdata = fdata + color_i;
-        int y = 0, x = 0;
-        int stepX = 1;
-        while (1) {
-            // next pixel
-            if (x == width - 1) {
-                stepX = -1;
-                y = y + 1;
-            }
-            if (x == 0) {
-                stepX = 1;
-                y = y + 1;
-            }
-            if (y >= height) break;
-
-            x = x + stepX;
-
-
-
-            //
-            unsigned int pixelIdx = y * width + x;
-            float newColor = p_fdata[pixelIdx * 3];
-            if (color_i == 0)//R, 3bits
-                newColor = floor(newColor * 8.0f) / 8.0f;
-            if (color_i == 1)//G, 3bits
-                newColor = floor(newColor * 8.0f) / 8.0f;
-            if (color_i == 2)//B, 2bits
-                newColor = floor(newColor * 4.0f) / 4.0f;
-            float error = p_fdata[pixelIdx * 3] - newColor;
-
-            unsigned int neighborIdx = pixelIdx + stepX;
-            if (neighborIdx < width * height)
-                p_fdata[neighborIdx * 3] += 7.0f / 16.0f * error;
-            neighborIdx = pixelIdx + stepX + width;
-            if (neighborIdx < width * height)
-                p_fdata[neighborIdx * 3] += 1.0f / 16.0f * error;
-            neighborIdx = pixelIdx + width;
-            if (neighborIdx < width * height)
-                p_fdata[neighborIdx * 3] += 5.0f / 16.0f * error;
-            neighborIdx = pixelIdx - stepX + width;
-            if (neighborIdx < width * height)
-                p_fdata[neighborIdx * 3] += 3.0f / 16.0f * error;
-
-            p_fdata[pixelIdx * 3] = newColor;
-        }
-    }
-
-
-    // copy data
-    p_fdata = fdata;
-    p_data = data;
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            p_data[0] = p_fdata[0] * 255.0f;
-            p_data[1] = p_fdata[1] * 255.0f;
-            p_data[2] = p_fdata[2] * 255.0f;
-
-            p_data = p_data + 4;
-            p_fdata = p_fdata + 3;
-        }
+        SPlaneView plane = Plane(color_i).Sub(pixels.x, pixels.y, pixels.width, pixels.height);
+        const float numLevels = levels[color_i];
+        Diffuse_Errors(plane, [numLevels](float value) { return floor(value * numLevels) / numLevels; });
     }
 
-    delete[]fdata;
-    return false;
+    return true;
 }// Dither_Color
 
 
@@ -744,360 +914,194 @@ bool TargaImage::Difference(TargaImage* pImage)
         return false;
     }// if
 
-    for (int i = 0; i < width * height * 4; i += 4)
-    {
-        unsigned char        rgb1[3];
-        unsigned char        rgb2[3];
-
-        RGBA_To_RGB(data + i, rgb1);
-        RGBA_To_RGB(pImage->data + i, rgb2);
-
-        data[i] = abs(rgb1[0] - rgb2[0]);
-        data[i + 1] = abs(rgb1[1] - rgb2[1]);
-        data[i + 2] = abs(rgb1[2] - rgb2[2]);
-        data[i + 3] = 255;
-    }
-
-    return true;
+    return Point_Ops(vector<RowOp>(1, Difference_Op(pImage)));
 }// Difference
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Perform 5x5 box filter on this image.  Return success of operation.
+//      Apply the given per pixel operations to the region of interest, all of
+//  them to one row before moving to the next, so a chain of point operations
+//  walks the image once and each row stays in cache between them.  Return
+//  success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Filter_Box()
+bool TargaImage::Point_Ops(const vector<RowOp>& ops)
 {
-    float mask[5][5] = { {1, 1, 1, 1, 1},
-                         {1, 1, 1, 1, 1},
-                         {1, 1, 1, 1, 1},
-                         {1, 1, 1, 1, 1},
-                         {1, 1, 1, 1, 1},
-    };
-    // normalize filter
-    float maskSum = 0.0;
-    for (int y = 0; y < 5; y++)
-        for (int x = 0; x < 5; x++)
-            maskSum += mask[y][x];
-    for (int y = 0; y < 5; y++)
-        for (int x = 0; x < 5; x++)
-            mask[y][x] = mask[y][x] / maskSum;
-
-    float* fdata = new float[width * height * 3];
-
-    float* p_fdata = fdata;
-    uint8_t* p_data = data;
-
-    // convert to float array
-    for (int x = 0; x < width; x++) {
-        for (int y = 0; y < height; y++) {
-            p_fdata[0] = p_data[0] / 255.0f;
-            p_fdata[1] = p_data[1] / 255.0f;
-            p_fdata[2] = p_data[2] / 255.0f;
-
-            p_data = p_data + 4;
-            p_fdata = p_fdata + 3;
-        }
-    }
-
-    for (int color_i = 0; color_i < 3; color_i++) {
-        // for each pixel
-        p_fdata = fdata + color_i;
-        p_data = data + color_i;
-        for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x++) {
-
-                float newVal = 0.0;
-                // by element multiply 
-                for (int mask_y = -2; mask_y <= 2; mask_y++) {
-                    if ((y + mask_y) >= height || (y + mask_y) < 0) continue;
-                    for (int mask_x = -2; mask_x <= 2; mask_x++) {
-                        if ((x + mask_x) >= width || (x + mask_x) < 0) continue;
-                        unsigned int idx = (y + mask_y) * width + (x + mask_x);
-                        newVal += p_fdata[idx * 3] * mask[mask_y + 2][mask_x + 2];
-                    }
-                }
+    if (!data)
+        return false;
 
-                unsigned int idx = y * width + x;
-                p_data[idx * 4] = newVal * 255.0f;
-            }
-        }
+    if (!Release_Planes())
+        return false;
 
-    }
+    SPixelView pixels = Pixels();
+    if (!pixels.base)
+        return false;
+    For_Each_Row(pixels, [&pixels, &ops](uint8_t* row, int y) {
+        for (size_t i = 0; i < ops.size(); ++i)
+            ops[i](row, pixels.width, pixels.x, pixels.y + y);
+    });
 
-    delete[]fdata;
-    return false;
-}// Filter_Box
+    return true;
+}// Point_Ops
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Perform 5x5 Bartlett filter on this image.  Return success of 
-//  operation.
+//      Row operations of the point operations above, for Point_Ops.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Filter_Bartlett()
+TargaImage::RowOp TargaImage::Gray_Op()
+{
+    return [](uint8_t* row, int count, int, int) { Gray_Row(row, count); };
+}// Gray_Op
+
+
+TargaImage::RowOp TargaImage::Quant_Uniform_Op()
+{
+    return [](uint8_t* row, int count, int, int) { Quant_Uniform_Row(row, count); };
+}// Quant_Uniform_Op
+
+
+TargaImage::RowOp TargaImage::Dither_Threshold_Op()
 {
-    float mask[5][5] = { {1, 2, 3, 2, 1},
-                         {2, 4, 6, 4, 2},
-                         {3, 6, 9, 6, 3},
-                         {2, 4, 6, 4, 2},
-                         {1, 2, 3, 2, 1},
+    return [](uint8_t* row, int count, int, int) {
+        Gray_Row(row, count);
+        Threshold_Row(row, count, 128);
     };
-    // normalize filter
-    float maskSum = 0.0;
-    for (int y = 0; y < 5; y++)
-        for (int x = 0; x < 5; x++)
-            maskSum += mask[y][x];
-    for (int y = 0; y < 5; y++)
-        for (int x = 0; x < 5; x++)
-            mask[y][x] = mask[y][x] / maskSum;
+}// Dither_Threshold_Op
 
-    float* fdata = new float[width * height * 3];
 
-    float* p_fdata = fdata;
-    uint8_t* p_data = data;
+TargaImage::RowOp TargaImage::Dither_Cluster_Op()
+{
+    return [](uint8_t* row, int count, int x, int y) {
+        Gray_Row(row, count);
+        Threshold_Cluster_Row(row, count, x, y);
+    };
+}// Dither_Cluster_Op
 
-    // convert to float array
-    for (int x = 0; x < width; x++) {
-        for (int y = 0; y < height; y++) {
-            p_fdata[0] = p_data[0] / 255.0f;
-            p_fdata[1] = p_data[1] / 255.0f;
-            p_fdata[2] = p_data[2] / 255.0f;
 
-            p_data = p_data + 4;
-            p_fdata = p_fdata + 3;
-        }
-    }
+TargaImage::RowOp TargaImage::Difference_Op(TargaImage* pImage)
+{
+    pImage->Sync_Bytes();
 
-    for (int color_i = 0; color_i < 3; color_i++) {
-        // for each pixel
-        p_fdata = fdata + color_i;
-        p_data = data + color_i;
-        for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x++) {
-
-                float newVal = 0.0;
-                // by element multiply 
-                for (int mask_y = -2; mask_y <= 2; mask_y++) {
-                    if ((y + mask_y) >= height || (y + mask_y) < 0) continue;
-                    for (int mask_x = -2; mask_x <= 2; mask_x++) {
-                        if ((x + mask_x) >= width || (x + mask_x) < 0) continue;
-                        unsigned int idx = (y + mask_y) * width + (x + mask_x);
-                        newVal += p_fdata[idx * 3] * mask[mask_y + 2][mask_x + 2];
-                    }
-                }
+    return [this, pImage](uint8_t* row, int count, int x, int y) {
+        uint8_t* otherRow = pImage->data + ((ptrdiff_t)y * width + x) * 4;
+        for (int i = 0; i < count * 4; i += 4)
+        {
+            unsigned char        rgb1[3];
+            unsigned char        rgb2[3];
 
-                unsigned int idx = y * width + x;
-                p_data[idx * 4] = newVal * 255.0f;
-            }
+            RGBA_To_RGB(row + i, rgb1);
+            RGBA_To_RGB(otherRow + i, rgb2);
+
+            row[i] = abs(rgb1[0] - rgb2[0]);
+            row[i + 1] = abs(rgb1[1] - rgb2[1]);
+            row[i + 2] = abs(rgb1[2] - rgb2[2]);
+            row[i + 3] = 255;
         }
+    };
+}// Difference_Op
 
-    }
 
-    delete[]fdata;
-    return false;
-}// Filter_Bartlett
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform 5x5 box filter on this image.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Box()
+{
+    return Filter_Box_N(2);
+}// Filter_Box
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Perform 5x5 Gaussian filter on this image.  Return success of 
-//  operation.
+//      Perform a (2 * radius + 1) square box filter on this image.  The cost
+//  per pixel is independent of the radius.  Return success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Filter_Gaussian()
+bool TargaImage::Filter_Box_N(unsigned int radius)
 {
-    float mask[5][5] = { {1, 4, 7, 4, 1},
-                         {4, 16, 26, 16, 4},
-                         {7, 26, 41, 26, 7},
-                         {4, 16, 26, 16, 4},
-                         {1, 4, 7, 4, 1},
-    };
-    // normalize filter
-    float maskSum = 0.0;
-    for (int y = 0; y < 5; y++)
-        for (int x = 0; x < 5; x++)
-            maskSum += mask[y][x];
-    for (int y = 0; y < 5; y++)
-        for (int x = 0; x < 5; x++)
-            mask[y][x] = mask[y][x] / maskSum;
-
-    float* fdata = new float[width * height * 3];
+    if (radius < 1)
+        return false;
 
-    float* p_fdata = fdata;
-    uint8_t* p_data = data;
+    const int r = (int)radius;
+    return Filter_Channels([r](float* plane, int w, int h) { return Box_Filter(plane, w, h, r); }, r, 0.0f, 1.0f, 0.0f);
+}// Filter_Box_N
 
-    // convert to float array
-    for (int x = 0; x < width; x++) {
-        for (int y = 0; y < height; y++) {
-            p_fdata[0] = p_data[0] / 255.0f;
-            p_fdata[1] = p_data[1] / 255.0f;
-            p_fdata[2] = p_data[2] / 255.0f;
 
-            p_data = p_data + 4;
-            p_fdata = p_fdata + 3;
-        }
-    }
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform 5x5 Bartlett filter on this image.  Return success of 
+//  operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Bartlett()
+{
+    const float kernel[5] = { 1.0f / 9, 2.0f / 9, 3.0f / 9, 2.0f / 9, 1.0f / 9 };
 
-    for (int color_i = 0; color_i < 3; color_i++) {
-        // for each pixel
-        p_fdata = fdata + color_i;
-        p_data = data + color_i;
-        for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x++) {
-
-                float newVal = 0.0;
-                // by element multiply 
-                for (int mask_y = -2; mask_y <= 2; mask_y++) {
-                    if ((y + mask_y) >= height || (y + mask_y) < 0) continue;
-                    for (int mask_x = -2; mask_x <= 2; mask_x++) {
-                        if ((x + mask_x) >= width || (x + mask_x) < 0) continue;
-                        unsigned int idx = (y + mask_y) * width + (x + mask_x);
-                        newVal += p_fdata[idx * 3] * mask[mask_y + 2][mask_x + 2];
-                    }
-                }
+    return Filter_Separable(kernel, 2, 0.0f, 1.0f, 0.0f);
+}// Filter_Bartlett
 
-                unsigned int idx = y * width + x;
-                p_data[idx * 4] = newVal * 255.0f;
-            }
-        }
 
-    }
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform 5x5 Gaussian filter on this image.  Return success of 
+//  operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Gaussian()
+{
+    const float kernel[5] = { 1.0f / 16, 4.0f / 16, 6.0f / 16, 4.0f / 16, 1.0f / 16 };
 
-    delete[]fdata;
-    return false;
+    return Filter_Separable(kernel, 2, 0.0f, 1.0f, 0.0f);
 }// Filter_Gaussian
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Perform NxN Gaussian filter on this image.  Return success of 
+//      Perform NxN Gaussian filter on this image.  Small N use the exact
+//  binomial kernel; larger N use the Gaussian of the same variance,
+//  (N - 1) / 4, which the binomial converges to.  Return success of
 //  operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-
 bool TargaImage::Filter_Gaussian_N(unsigned int N)
 {
-    std::vector<std::vector <float>> pascal;
-    pascal.push_back(std::vector<float>(1, 1.0f));
-    pascal.push_back(std::vector<float>(2, 1.0f));
-
-    for (int i = 2; i <= N - 1 ; i++) {
-        std::vector <float> newRow;
-        newRow.push_back(1.0f);
-        for (int j = 1; j < i; j++) {
-            newRow.push_back(pascal[i-1][j] + pascal[i-1][j - 1]);
-        }
-        newRow.push_back(1.0f);
-        pascal.push_back(newRow);
-    }
-
-    //for (std::vector <float> row : pascal) {
-    //    for (float val : row) {
-    //        std::cout << val << ",\t";
-    //    }
-    //    std::cout << std::endl;
-    //}
-/*
-0 |1
-1 |1  1
-2 |1  2  1
-3 |1  3  3  1
-4 |1  4  6  4  1
-5 |1  5 10 10  5  1
-6 |1  6 15 20 15  6  1
-7 |1  7 21 35 35 21  7  1
-8 |1  8 28 56 70 56 28  8  1
-...
-*/
-
-    float* mask = new float[N * N];
-    for (int i = 0; i < N; i++) {
-        for (int j = 0; j < N; j++) {
-            mask[i * N + j] = pascal[N - 1][i] * pascal[N - 1][j];
-        }
-    }
-
-    //for (int i = 0; i < N; i++) {
-    //    for (int j = 0; j < N; j++) {
-    //        std::cout << mask[i * N + j] << "\t";
-    //    }
-    //    std::cout << std::endl;
-    //}
-
-    // normalize filter
-    float maskSum = 0.0;
-    for (int i = 0; i < N * N; i++)
-        maskSum += mask[i];
-    for (int i = 0; i < N * N; i++)
-        mask[i] /= maskSum;
-
-
-    // copy data to float array
-    float* fdata = new float[width * height * 3];
-
-    float* p_fdata = fdata;
-    uint8_t* p_data = data;
-    for (int x = 0; x < width; x++) {
-        for (int y = 0; y < height; y++) {
-            p_fdata[0] = p_data[0] / 255.0f;
-            p_fdata[1] = p_data[1] / 255.0f;
-            p_fdata[2] = p_data[2] / 255.0f;
+    if (N % 2 != 1)
+        return false;
+    if (N == 1)
+        return true;
 
-            p_data = p_data + 4;
-            p_fdata = p_fdata + 3;
-        }
-    }
+    if (N > c_maxBinomialTaps)
+        return Filter_Gaussian_Sigma(sqrtf((float)(N - 1)) / 2.0f);
 
-    // convolution 2d
-    float* result = new float[width * height * 3];
-    for (int colori = 0; colori < 3; colori++) { // for each color
-        for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x++) {
-                int pixelIdx = (y * width + x);
-
-                float newVal = 0.0f;
-                for (int i = 0; i < N; i++) {
-                    int maxk_y = i - (N / 2);
-                    int inIdxY = y + maxk_y;
-                    if (inIdxY < 0 || inIdxY >= height) continue;
-                    for (int j = 0; j < N; j++) {
-                        int maxk_x = j - (N / 2);
-
-                        int inIdxY = y + maxk_y;
-                        int inIdxX = x + maxk_x;
-                        if (inIdxX < 0 || inIdxX >= width) continue;
-
-                        int inIdx = (inIdxY * width + inIdxX);
-                        newVal += fdata[inIdx * 3 + colori] * mask[i * N + j];
-                    }
-                }
-                result[pixelIdx * 3 + colori] = newVal;
-            }
-        }
-    }
+    std::vector<float> kernel;
+    Make_Binomial_Kernel(N, kernel);
+    return Filter_Separable(&kernel[0], N / 2, 0.0f, 1.0f, 0.0f);
+}// Filter_Gaussian_N
 
-    // copy data
-    p_fdata = result;
-    p_data = data;
-    for (int x = 0; x < width; x++) {
-        for (int y = 0; y < height; y++) {
-            p_data[0] = p_fdata[0] * 255.0f;
-            p_data[1] = p_fdata[1] * 255.0f;
-            p_data[2] = p_fdata[2] * 255.0f;
 
-            p_data = p_data + 4;
-            p_fdata = p_fdata + 3;
-        }
-    }
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform a Gaussian filter with the given standard deviation in pixels.
+//  Small sigma use a separable FIR kernel, large sigma the recursive filter
+//  whose cost does not depend on sigma.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Gaussian_Sigma(float sigma)
+{
+    if (sigma <= 0.0f)
+        return false;
 
-    delete[] mask;
-    delete[] result;
-    delete[] fdata;
+    if (sigma >= c_minRecursiveSigma)
+        return Filter_Channels([sigma](float* plane, int w, int h) { return Gaussian_IIR(plane, w, h, sigma); },
+                               (int)ceilf(c_haloSigmas * sigma), 0.0f, 1.0f, 0.0f);
 
-    return false;
-}// Filter_Gaussian_N
+    std::vector<float> kernel;
+    int radius = Make_Gaussian_Kernel(sigma, kernel);
+    return Filter_Separable(&kernel[0], radius, 0.0f, 1.0f, 0.0f);
+}// Filter_Gaussian_Sigma
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -1108,89 +1112,10 @@ bool TargaImage::Filter_Gaussian_N(unsigned int N)
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Filter_Edge()
 {
-    int N = 5;
-    float mask[5 * 5] = {1, 4, 7, 4, 1,
-                         4, 16, 26, 16, 4,
-                         7, 26, 41, 26, 7,
-                         4, 16, 26, 16, 4,
-                         1, 4, 7, 4, 1,
-    };
-    // normalize filter
-    float maskSum = 0.0;
-    for (int i = 0; i < N * N; i++)
-        maskSum += mask[i];
-    for (int i = 0; i < N * N; i++)
-        mask[i] /= maskSum;
-    // cvt heigh filter
-    for (int i = 0; i < N * N; i++)
-        mask[i] = -mask[i];
-    mask[N * N / 2] += 1.0f;
-
-    // copy data to float array
-    float* fdata = new float[width * height * 3];
-
-    float* p_fdata = fdata;
-    uint8_t* p_data = data;
-    for (int x = 0; x < width; x++) {
-        for (int y = 0; y < height; y++) {
-            p_fdata[0] = p_data[0] / 255.0f;
-            p_fdata[1] = p_data[1] / 255.0f;
-            p_fdata[2] = p_data[2] / 255.0f;
-
-            p_data = p_data + 4;
-            p_fdata = p_fdata + 3;
-        }
-    }
-
-    // convolution 2d
-    float* result = new float[width * height * 3];
-    for (int colori = 0; colori < 3; colori++) { // for each color
-        for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x++) {
-                int pixelIdx = (y * width + x);
-
-                float newVal = 0.0f;
-                for (int i = 0; i < N; i++) {
-                    int maxk_y = i - (N / 2);
-                    int inIdxY = y + maxk_y;
-                    if (inIdxY < 0 || inIdxY >= height) continue;
-                    for (int j = 0; j < N; j++) {
-                        int maxk_x = j - (N / 2);
-
-                        int inIdxY = y + maxk_y;
-                        int inIdxX = x + maxk_x;
-                        if (inIdxX < 0 || inIdxX >= width) continue;
-
-                        int inIdx = (inIdxY * width + inIdxX);
-                        newVal += fdata[inIdx * 3 + colori] * mask[i * N + j];
-                    }
-                }
-                newVal = newVal + 0.5f;
-                if (newVal < 0.0f) newVal = 0.0f;
-                if (newVal > 1.0f) newVal = 1.0f;
-                result[pixelIdx * 3 + colori] = newVal;
-            }
-        }
-    }
-
-    // copy data
-    p_fdata = result;
-    p_data = data;
-    for (int x = 0; x < width; x++) {
-        for (int y = 0; y < height; y++) {
-            for (int colori = 0; colori < 3; colori++) {
-                int newVal = p_fdata[0 + colori] * 255.0f;
-                p_data[0 + colori] = newVal;
-            }
-            p_data = p_data + 4;
-            p_fdata = p_fdata + 3;
-        }
-    }
-
-    delete[] result;
-    delete[] fdata;
+    // identity minus the 5x5 Gaussian, shifted so that zero maps to mid gray
+    const float kernel[5] = { 1.0f / 16, 4.0f / 16, 6.0f / 16, 4.0f / 16, 1.0f / 16 };
 
-    return false;
+    return Filter_Separable(kernel, 2, 1.0f, -1.0f, 0.5f);
 }// Filter_Edge
 
 
@@ -1202,88 +1127,10 @@ bool TargaImage::Filter_Edge()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Filter_Enhance()
 {
-    int N = 5;
-    float mask[5 * 5] = { 1, 4, 7, 4, 1,
-                         4, 16, 26, 16, 4,
-                         7, 26, 41, 26, 7,
-                         4, 16, 26, 16, 4,
-                         1, 4, 7, 4, 1,
-    };
-    // normalize filter
-    float maskSum = 0.0;
-    for (int i = 0; i < N * N; i++)
-        maskSum += mask[i];
-    for (int i = 0; i < N * N; i++)
-        mask[i] /= maskSum;
-    // cvt heigh filter
-    for (int i = 0; i < N * N; i++)
-        mask[i] = -mask[i];
-    mask[N * N / 2] += 2.0f;
-
-    // copy data to float array
-    float* fdata = new float[width * height * 3];
-
-    float* p_fdata = fdata;
-    uint8_t* p_data = data;
-    for (int x = 0; x < width; x++) {
-        for (int y = 0; y < height; y++) {
-            p_fdata[0] = p_data[0] / 255.0f;
-            p_fdata[1] = p_data[1] / 255.0f;
-            p_fdata[2] = p_data[2] / 255.0f;
-
-            p_data = p_data + 4;
-            p_fdata = p_fdata + 3;
-        }
-    }
-
-    // convolution 2d
-    float* result = new float[width * height * 3];
-    for (int colori = 0; colori < 3; colori++) { // for each color
-        for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x++) {
-                int pixelIdx = (y * width + x);
-
-                float newVal = 0.0f;
-                for (int i = 0; i < N; i++) {
-                    int maxk_y = i - (N / 2);
-                    int inIdxY = y + maxk_y;
-                    if (inIdxY < 0 || inIdxY >= height) continue;
-                    for (int j = 0; j < N; j++) {
-                        int maxk_x = j - (N / 2);
-
-                        int inIdxY = y + maxk_y;
-                        int inIdxX = x + maxk_x;
-                        if (inIdxX < 0 || inIdxX >= width) continue;
-
-                        int inIdx = (inIdxY * width + inIdxX);
-                        newVal += fdata[inIdx * 3 + colori] * mask[i * N + j];
-                    }
-                }
-                if (newVal < 0.0f) newVal = 0.0f;
-                if (newVal > 1.0f) newVal = 1.0f;
-                result[pixelIdx * 3 + colori] = newVal;
-            }
-        }
-    }
+    // image plus its high pass part: 2 * identity minus the 5x5 Gaussian
+    const float kernel[5] = { 1.0f / 16, 4.0f / 16, 6.0f / 16, 4.0f / 16, 1.0f / 16 };
 
-    // copy data
-    p_fdata = result;
-    p_data = data;
-    for (int x = 0; x < width; x++) {
-        for (int y = 0; y < height; y++) {
-            for (int colori = 0; colori < 3; colori++) {
-                int newVal = p_fdata[0 + colori] * 255.0f;
-                p_data[0 + colori] = newVal;
-            }
-            p_data = p_data + 4;
-            p_fdata = p_fdata + 3;
-        }
-    }
-
-    delete[] result;
-    delete[] fdata;
-
-    return false;
+    return Filter_Separable(kernel, 2, 2.0f, -1.0f, 0.0f);
 }// Filter_Enhance
 
 
@@ -1297,22 +1144,38 @@ bool TargaImage::Filter_Enhance()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::NPR_Paint()
 {
+    if (!Release_Planes())
+        return false;
 
-    float* fdata = new float[width * height * 3];
-    float* p_fdata = fdata;
-    uint8_t* p_data = data;
-    for (int x = 0; x < width; x++) {
-        for (int y = 0; y < height; y++) {
+    // strokes sample the whole image, but only the region of interest is painted
+    float* fdata = Pool_New<float>(width * height * 3);
+    if (!Unshare_Data() || !fdata) {
+        Pool_Free(fdata);
+        return false;
+    }
+    SPixelView whole = SPixelView::Whole(data, width, height, 4);
+    for (int y = 0; y < whole.height; y++) {
+        const uint8_t* p_data = whole.Row(y);
+        float* p_fdata = fdata + y * width * 3;
+        for (int x = 0; x < whole.width; x++) {
             p_fdata[0] = (float)p_data[0];
             p_fdata[1] = (float)p_data[1];
             p_fdata[2] = (float)p_data[2];
 
+            p_data = p_data + 4;
+            p_fdata = p_fdata + 3;
+        }
+    }
+
+    SPixelView pixels = Pixels();
+    for (int y = 0; y < pixels.height; y++) {
+        uint8_t* p_data = pixels.Row(y);
+        for (int x = 0; x < pixels.width; x++) {
             p_data[0] = 0xff;
             p_data[1] = 0xff;
             p_data[2] = 0xff;
 
             p_data = p_data + 4;
-            p_fdata = p_fdata + 3;
         }
     }
 
@@ -1372,7 +1235,7 @@ bool TargaImage::NPR_Paint()
         }
 
         // Randomize the order
-        std::random_shuffle(strokes.begin(), strokes.end());
+        std::shuffle(strokes.begin(), strokes.end(), generator);
         int strokesRange = strokes.size();
         if (brushSizeIdx > 0) strokesRange = strokesRange * drawBrushsProportion[brushSizeIdx];
         for (int strokeIdx = 0; strokeIdx < strokesRange; strokeIdx++)
@@ -1380,7 +1243,7 @@ bool TargaImage::NPR_Paint()
 
     }
     
-    delete[]fdata;
+    Pool_Free(fdata);
 
     return false;
 }
@@ -1394,6 +1257,9 @@ bool TargaImage::NPR_Paint()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Half_Size()
 {
+    if (!Release_Planes())
+        return false;
+
     std::cout << width << "," << height << std::endl;
     float mask[3][3] = { {1 ,2 ,1},
                          {2 ,4 ,2},
@@ -1410,38 +1276,42 @@ bool TargaImage::Half_Size()
 
     int newHeight = height / 2;
     int newWidth = width / 2;
-    unsigned char* newData = new unsigned char[newWidth * newHeight * 4];
-
-    for (int y = 0; y < newHeight; y++) {
-        for (int x = 0; x < newWidth; x++) {
-
-            // transform
-            int srcY = y * 2;
-            int srcX = x * 2;
-
-            for (int color = 0; color < 3; color++) {
-                float newVal = 0.0f;
-                // convulation
-                for (int maskY = 0; maskY < 3; maskY++) {
-                    for (int maskX = 0; maskX < 3; maskX++) {
-                        int idxY = srcY + maskY - 1;
-                        int idxX = srcX + maskX - 1;
-                        if (idxY<0 || idxY > height) continue;
-                        if (idxX<0 || idxX > width) continue;
-                        newVal += mask[maskY][maskX] * (float)data[(idxY * width + idxX) * 4 + color];
+    unsigned char* newData = Pool_New<unsigned char>(newWidth * newHeight * 4);
+    if (!newData)
+        return false;
+
+    Parallel_Rows(newHeight, newWidth, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            for (int x = 0; x < newWidth; x++) {
+
+                // transform
+                int srcY = y * 2;
+                int srcX = x * 2;
+
+                for (int color = 0; color < 3; color++) {
+                    float newVal = 0.0f;
+                    // convulation
+                    for (int maskY = 0; maskY < 3; maskY++) {
+                        for (int maskX = 0; maskX < 3; maskX++) {
+                            int idxY = srcY + maskY - 1;
+                            int idxX = srcX + maskX - 1;
+                            if (idxY<0 || idxY > height) continue;
+                            if (idxX<0 || idxX > width) continue;
+                            newVal += mask[maskY][maskX] * (float)data[(idxY * width + idxX) * 4 + color];
+                        }
                     }
+                    newData[(y * newWidth + x) * 4 + color] = newVal;
                 }
-                newData[(y * newWidth + x) * 4 + color] = newVal;
+                newData[(y * newWidth + x) * 4 + 3] = 255;
             }
-            newData[(y * newWidth + x) * 4 + 3] = 255;
         }
-    }
+    });
 
-    delete[]data;
     width = newWidth;
     height = newHeight;
-    data = newData;
-    return false;
+    Replace_Data(newData);
+    Clear_ROI();
+    return true;
 }// Half_Size
 
 
@@ -1452,48 +1322,55 @@ bool TargaImage::Half_Size()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Double_Size()
 {
+    if (!Release_Planes())
+        return false;
+
     float filter3[3] = { 1 ,2 ,1 };
     float filter4[4] = { 1 ,3 ,3 ,1 };
     float filterNorm[3] = { 0.0625 , 0.03125 ,0.015625 };
 
     int newHeight = height * 2;
     int newWidth = width * 2;
-    unsigned char* newData = new unsigned char[newWidth * newHeight * 4];
-
-    for (int y = 0; y < newHeight; y++) {
-        for (int x = 0; x < newWidth; x++) {
-
-            // transform
-            int srcY = y / 2;
-            int srcX = x / 2;
-
-            for (int color = 0; color < 3; color++) {
-                float newVal = 0.0f;
-                // convulation
-                for (int maskY = 0; maskY < ((y%2==0)? 3:4); maskY++) {
-                    for (int maskX = 0; maskX < ((x%2==0)? 3:4); maskX++) {
-                        int idxY = srcY + maskY - 1;
-                        int idxX = srcX + maskX - 1;
-                        if (idxY < 0 || idxY >= height) continue;
-                        if (idxX < 0 || idxX >= width) continue;
-                        float falterVal = 1.0f;
-                        falterVal *= (y % 2 == 0) ? filter3[maskY] : filter4[maskY];
-                        falterVal *= (x % 2 == 0) ? filter3[maskX] : filter4[maskX];
-                        newVal += falterVal * (float)data[(idxY * width + idxX) * 4 + color];
+    unsigned char* newData = Pool_New<unsigned char>(newWidth * newHeight * 4);
+    if (!newData)
+        return false;
+
+    Parallel_Rows(newHeight, newWidth, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            for (int x = 0; x < newWidth; x++) {
+
+                // transform
+                int srcY = y / 2;
+                int srcX = x / 2;
+
+                for (int color = 0; color < 3; color++) {
+                    float newVal = 0.0f;
+                    // convulation
+                    for (int maskY = 0; maskY < ((y%2==0)? 3:4); maskY++) {
+                        for (int maskX = 0; maskX < ((x%2==0)? 3:4); maskX++) {
+                            int idxY = srcY + maskY - 1;
+                            int idxX = srcX + maskX - 1;
+                            if (idxY < 0 || idxY >= height) continue;
+                            if (idxX < 0 || idxX >= width) continue;
+                            float falterVal = 1.0f;
+                            falterVal *= (y % 2 == 0) ? filter3[maskY] : filter4[maskY];
+                            falterVal *= (x % 2 == 0) ? filter3[maskX] : filter4[maskX];
+                            newVal += falterVal * (float)data[(idxY * width + idxX) * 4 + color];
+                        }
                     }
+                    newVal = newVal * filterNorm[(y & 1) + (x & 1)];
+                    newData[(y * newWidth + x) * 4 + color] = newVal;
                 }
-                newVal = newVal * filterNorm[(y & 1) + (x & 1)];
-                newData[(y * newWidth + x) * 4 + color] = newVal;
+                newData[(y * newWidth + x) * 4 + 3] = 255;
             }
-            newData[(y * newWidth + x) * 4 + 3] = 255;
         }
-    }
+    });
 
-    delete[]data;
     width = newWidth;
     height = newHeight;
-    data = newData;
-    return false;
+    Replace_Data(newData);
+    Clear_ROI();
+    return true;
 }// Double_Size
 
 
@@ -1505,6 +1382,9 @@ bool TargaImage::Double_Size()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Resize(float scale)
 {
+    if (!Release_Planes())
+        return false;
+
     float mask[4][4] = { {1 ,3 ,3 ,1},
                          {3 ,9 ,9 ,3},
                          {3 ,9 ,9 ,3},
@@ -1521,38 +1401,42 @@ bool TargaImage::Resize(float scale)
 
     int newHeight = height * scale;
     int newWidth = width * scale;
-    unsigned char* newData = new unsigned char[newWidth * newHeight * 4];
-
-    for (int y = 0; y < newHeight; y++) {
-        for (int x = 0; x < newWidth; x++) {
-
-            // transform
-            int srcY = y / scale;
-            int srcX = x / scale;
-
-            for (int color = 0; color < 3; color++) {
-                float newVal = 0.0f;
-                // convulation
-                for (int maskY = 0; maskY < 4; maskY++) {
-                    for (int maskX = 0; maskX < 4; maskX++) {
-                        int idxY = srcY + maskY - 1;
-                        int idxX = srcX + maskX - 1;
-                        if (idxY < 0 || idxY >= height) continue;
-                        if (idxX < 0 || idxX >= width) continue;
-                        newVal += mask[maskY][maskX] * (float)data[(idxY * width + idxX) * 4 + color];
+    unsigned char* newData = Pool_New<unsigned char>(newWidth * newHeight * 4);
+    if (!newData)
+        return false;
+
+    Parallel_Rows(newHeight, newWidth, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            for (int x = 0; x < newWidth; x++) {
+
+                // transform
+                int srcY = y / scale;
+                int srcX = x / scale;
+
+                for (int color = 0; color < 3; color++) {
+                    float newVal = 0.0f;
+                    // convulation
+                    for (int maskY = 0; maskY < 4; maskY++) {
+                        for (int maskX = 0; maskX < 4; maskX++) {
+                            int idxY = srcY + maskY - 1;
+                            int idxX = srcX + maskX - 1;
+                            if (idxY < 0 || idxY >= height) continue;
+                            if (idxX < 0 || idxX >= width) continue;
+                            newVal += mask[maskY][maskX] * (float)data[(idxY * width + idxX) * 4 + color];
+                        }
                     }
+                    newData[(y * newWidth + x) * 4 + color] = newVal;
                 }
-                newData[(y * newWidth + x) * 4 + color] = newVal;
+                newData[(y * newWidth + x) * 4 + 3] = 255;
             }
-            newData[(y * newWidth + x) * 4 + 3] = 255;
         }
-    }
+    });
 
-    delete[]data;
     width = newWidth;
     height = newHeight;
-    data = newData;
-    return false;
+    Replace_Data(newData);
+    Clear_ROI();
+    return true;
 }// Resize
 
 
@@ -1564,6 +1448,9 @@ bool TargaImage::Resize(float scale)
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Rotate(float angleDegrees)
 {
+    if (!Release_Planes())
+        return false;
+
     float radian = angleDegrees * c_pi / 180.0f;
     float mask[4][4] = { {1 ,3 ,3 ,1},
                          {3 ,9 ,9 ,3},
@@ -1581,40 +1468,43 @@ bool TargaImage::Rotate(float angleDegrees)
 
     int newHeight = height;
     int newWidth = width;
-    unsigned char* newData = new unsigned char[newWidth * newHeight * 4];
+    unsigned char* newData = Pool_New<unsigned char>(newWidth * newHeight * 4);
+    if (!newData)
+        return false;
 
-    for (int y = 0; y < newHeight; y++) {
-        for (int x = 0; x < newWidth; x++) {
+    Parallel_Rows(newHeight, newWidth, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            for (int x = 0; x < newWidth; x++) {
 
-            // transform
-            int srcX = x * cos(-radian) - y * sin(-radian);
-            int srcY = x * sin(-radian) + y * cos(-radian);
+                // transform
+                int srcX = x * cos(-radian) - y * sin(-radian);
+                int srcY = x * sin(-radian) + y * cos(-radian);
 
 
 
-            for (int color = 0; color < 3; color++) {
-                float newVal = 0.0f;
-                // convulation
-                for (int maskY = 0; maskY < 4; maskY++) {
-                    for (int maskX = 0; maskX < 4; maskX++) {
-                        int idxY = srcY + maskY - 1;
-                        int idxX = srcX + maskX - 1;
-                        if (idxY < 0 || idxY >= height) continue;
-                        if (idxX < 0 || idxX >= width) continue;
-                        newVal += mask[maskY][maskX] * (float)data[(idxY * width + idxX) * 4 + color];
+                for (int color = 0; color < 3; color++) {
+                    float newVal = 0.0f;
+                    // convulation
+                    for (int maskY = 0; maskY < 4; maskY++) {
+                        for (int maskX = 0; maskX < 4; maskX++) {
+                            int idxY = srcY + maskY - 1;
+                            int idxX = srcX + maskX - 1;
+                            if (idxY < 0 || idxY >= height) continue;
+                            if (idxX < 0 || idxX >= width) continue;
+                            newVal += mask[maskY][maskX] * (float)data[(idxY * width + idxX) * 4 + color];
+                        }
                     }
+                    newData[(y * newWidth + x) * 4 + color] = newVal;
                 }
-                newData[(y * newWidth + x) * 4 + color] = newVal;
+                newData[(y * newWidth + x) * 4 + 3] = 255;
             }
-            newData[(y * newWidth + x) * 4 + 3] = 255;
         }
-    }
+    });
 
-    delete[]data;
     width = newWidth;
     height = newHeight;
-    data = newData;
-    return false;
+    Replace_Data(newData);
+    return true;
 }// Rotate
 
 
@@ -1658,48 +1548,364 @@ void TargaImage::RGBA_To_RGB(unsigned char* rgba, unsigned char* rgb)
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Copy this into a new image, reversing the rows as it goes. A pointer
-//  to the new image is returned.
+//      Reverse the rows of the image in place, swapping each row of the top
+//  half with its mirror in the bottom half.
 //
 ///////////////////////////////////////////////////////////////////////////////
-TargaImage* TargaImage::Reverse_Rows(void)
+void TargaImage::Reverse_Rows(void)
 {
-    unsigned char* dest = new unsigned char[width * height * 4];
-    TargaImage* result;
-    int 	        i, j;
+    if (!data)
+        return;
 
+    if (!Release_Planes())
+        return;
+    if (!Unshare_Data())
+        return;
+
+    size_t rowBytes = (size_t)width * 4;
+    for (int i = 0; i < height / 2; i++)
+    {
+        unsigned char* top = data + i * rowBytes;
+        unsigned char* bottom = data + (height - i - 1) * rowBytes;
+        swap_ranges(top, top + rowBytes, bottom);
+    }
+}// Reverse_Rows
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Clear the region of interest (the whole image if none) to all black.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::ClearToBlack()
+{
+    if (!Release_Planes())
+        return;
+
+    SPixelView pixels = Pixels();
+    for (int y = 0; y < pixels.height; y++)
+        memset(pixels.Row(y), 0, pixels.Row_Length());
+}// ClearToBlack
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Copy the pixels if another image shares them, so this image can
+//  change them.  Return false, leaving the pixels shared, if there is no
+//  memory for the copy.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Unshare_Data()
+{
     if (!data)
-        return NULL;
+        return true;
 
-    for (i = 0; i < height; i++)
+    // copies on other threads may have just let go of the pixels after reading
+    // them.  Their release of the count pairs with this fence, so those reads
+    // happen before the writes that follow; a stale count only costs a copy.
+    if (m_pStorage.use_count() <= 1)
     {
-        int in_offset = (height - i - 1) * width * 4;
-        int out_offset = i * width * 4;
+        atomic_thread_fence(memory_order_acquire);
+        return true;
+    }// if
 
-        for (j = 0; j < width; j++)
-        {
-            dest[out_offset + j * 4] = data[in_offset + j * 4];
-            dest[out_offset + j * 4 + 1] = data[in_offset + j * 4 + 1];
-            dest[out_offset + j * 4 + 2] = data[in_offset + j * 4 + 2];
-            dest[out_offset + j * 4 + 3] = data[in_offset + j * 4 + 3];
+    size_t         bytes = (size_t)width * height * 4;
+    unsigned char* copy = Pool_New<unsigned char>(bytes);
+    if (!copy)
+        return false;
+    memcpy(copy, data, bytes);
+    Replace_Data(copy);
+    return true;
+}// Unshare_Data
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Get the pixels, for reading.  They may be shared with copies of this
+//  image, so they must not be written through this pointer.
+//
+///////////////////////////////////////////////////////////////////////////////
+const unsigned char* TargaImage::Data() const
+{
+    return data;
+}// Data
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Make the given buffer, from Pool_Alloc, the pixels of this image,
+//  letting go of the old ones.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Replace_Data(unsigned char* newData)
+{
+    m_pStorage.reset(newData, Pool_Free);
+    data = newData;
+}// Replace_Data
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      View of the RGBA bytes inside the region of interest, the whole image
+//  if there is none, for changing them.  Does not sync them with the float
+//  planes.  The view is empty, with a NULL base, if the pixels are shared
+//  and could not be copied.
+//
+///////////////////////////////////////////////////////////////////////////////
+SPixelView TargaImage::Pixels()
+{
+    if (!Unshare_Data())
+        return SPixelView::Whole(NULL, 0, 0, 4);
+    SPixelView whole = SPixelView::Whole(data, width, height, 4);
+    if (m_roiWidth > 0)
+        return whole.Sub(m_roiX, m_roiY, m_roiWidth, m_roiHeight);
+    return whole;
+}// Pixels
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      View of one float color plane of the whole image.  The planes must
+//  exist, see Float_Planes.
+//
+///////////////////////////////////////////////////////////////////////////////
+SPlaneView TargaImage::Plane(int channel)
+{
+    return SPlaneView::Whole(m_pPlanes + channel * width * height, width, height, 1);
+}// Plane
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run a separable filter over the color channels, where K is the outer
+//  product of the given 2 * radius + 1 tap kernel with itself.  See
+//  Filter_Channels for the meaning of the weights.  Return success of
+//  operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Separable(const float* kernel, int radius, float selfWeight, float blurWeight, float bias)
+{
+    return Filter_Channels([kernel, radius](float* plane, int w, int h) { return Convolve_Separable(plane, w, h, kernel, kernel, radius); },
+                           radius, selfWeight, blurWeight, bias);
+}// Filter_Separable
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run a linear filter over the color channels.  blur filters a w x h
+//  float plane in place, returning false if it ran out of memory, and reads
+//  at most halo pixels around each pixel; each channel becomes
+//  selfWeight * I + blurWeight * blur(I) + bias, clamped to [0, 1].  Alpha
+//  is left unchanged.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Channels(const std::function<bool(float*, int, int)>& blur, int halo, float selfWeight, float blurWeight, float bias)
+{
+    if (!data)
+        return false;
+
+    SPixelView pixels = Pixels();
+    if (!pixels.base)
+        return false;
+    if (pixels.width != width || pixels.height != height)
+        return Filter_Region(blur, halo, selfWeight, blurWeight, bias);
+
+    const int numPixels = width * height;
+    float*    planes = Float_Planes();
+    if (!planes)
+        return false;
+
+    // a plain blur keeps the plane in [0, 1], so it can run in place
+    if (selfWeight == 0.0f && blurWeight == 1.0f && bias == 0.0f) {
+        for (int color_i = 0; color_i < 3; color_i++)
+            if (!blur(planes + color_i * numPixels, width, height))
+                return false;
+        return true;
+    }
+
+    float*    blurred = Pool_New<float>(numPixels);
+    if (!blurred)
+        return false;
+
+    for (int color_i = 0; color_i < 3; color_i++) {
+        float* plane = planes + color_i * numPixels;
+        memcpy(blurred, plane, sizeof(float) * numPixels);
+        if (!blur(blurred, width, height)) {
+            Pool_Free(blurred);
+            return false;
         }
+
+        Parallel_Rows(height, width, [&](int y0, int y1) {
+            for (int i = y0 * width; i < y1 * width; i++) {
+                float newVal = selfWeight * plane[i] + blurWeight * blurred[i] + bias;
+                if (newVal < 0.0f) newVal = 0.0f;
+                if (newVal > 1.0f) newVal = 1.0f;
+                plane[i] = newVal;
+            }
+        });
     }
 
-    result = new TargaImage(width, height, dest);
-    delete[] dest;
-    return result;
-}// Reverse_Rows
+    Pool_Free(blurred);
+    return true;
+}// Filter_Channels
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Clear the image to all black.
+//      Filter_Channels for a region of interest.  Only the region grown by
+//  the halo is blurred, and only the region is written, so the cost follows
+//  the region's area.  Colors come from the float planes if the image has
+//  them, else straight from the bytes.  Return success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-void TargaImage::ClearToBlack()
+bool TargaImage::Filter_Region(const std::function<bool(float*, int, int)>& blur, int halo, float selfWeight, float blurWeight, float bias)
 {
-    memset(data, 0, width * height * 4);
-}// ClearToBlack
+    SPixelView pixels = Pixels();
+
+    // the region grown by the halo, clipped to the image
+    const int haloX = Max(pixels.x - halo, 0);
+    const int haloY = Max(pixels.y - halo, 0);
+    const int haloWidth = Min(pixels.x + pixels.width + halo, width) - haloX;
+    const int haloHeight = Min(pixels.y + pixels.height + halo, height) - haloY;
+    const int offsetX = pixels.x - haloX;
+    const int offsetY = pixels.y - haloY;
+
+    SPixelView haloPixels = SPixelView::Whole(data, width, height, 4).Sub(haloX, haloY, haloWidth, haloHeight);
+    SPlaneView source = SPlaneView::Whole(Pool_New<float>(haloWidth * haloHeight), haloWidth, haloHeight, 1);
+    SPlaneView blurred = SPlaneView::Whole(Pool_New<float>(haloWidth * haloHeight), haloWidth, haloHeight, 1);
+    if (!source.base || !blurred.base) {
+        Pool_Free(blurred.base);
+        Pool_Free(source.base);
+        return false;
+    }
+
+    for (int color_i = 0; color_i < 3; color_i++) {
+        if (m_pPlanes) {
+            SPlaneView plane = Plane(color_i).Sub(haloX, haloY, haloWidth, haloHeight);
+            For_Each_Row(source, [&](float* row, int y) {
+                memcpy(row, plane.Row(y), sizeof(float) * haloWidth);
+            });
+        }
+        else {
+            For_Each_Row(source, [&](float* row, int y) {
+                const uint8_t* p_data = haloPixels.Row(y) + color_i;
+                for (int x = 0; x < haloWidth; x++)
+                    row[x] = p_data[x * 4] / 255.0f;
+            });
+        }
+
+        memcpy(blurred.base, source.base, sizeof(float) * haloWidth * haloHeight);
+        if (!blur(blurred.base, haloWidth, haloHeight)) {
+            Pool_Free(blurred.base);
+            Pool_Free(source.base);
+            return false;
+        }
+
+        For_Each_Row(pixels, [&](uint8_t* row, int y) {
+            const float* sourceRow = source.Row(offsetY + y) + offsetX;
+            const float* blurredRow = blurred.Row(offsetY + y) + offsetX;
+            float* planeRow = m_pPlanes ? Plane(color_i).Row(pixels.y + y) + pixels.x : NULL;
+            for (int x = 0; x < pixels.width; x++) {
+                float newVal = selfWeight * sourceRow[x] + blurWeight * blurredRow[x] + bias;
+                if (newVal < 0.0f) newVal = 0.0f;
+                if (newVal > 1.0f) newVal = 1.0f;
+                if (planeRow)
+                    planeRow[x] = newVal;
+                else
+                    row[x * 4 + color_i] = (unsigned char)(newVal * 255.0f + 0.5f);
+            }
+        });
+    }
+
+    Pool_Free(blurred.base);
+    Pool_Free(source.base);
+    if (m_pPlanes)
+        m_bBytesStale = true;
+    return true;
+}// Filter_Region
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Get the color channels as planar floats in [0, 1], red plane first,
+//  converting from data if they are not already held.  The planes become the
+//  current colors, so data is brought back in step by Sync_Bytes before
+//  anything reads it.  Chained filters thus work on the planes and round to
+//  8 bits only when the image is saved, drawn or handed to a byte operation.
+//  Returns NULL if there is no memory for the planes.
+//
+///////////////////////////////////////////////////////////////////////////////
+float* TargaImage::Float_Planes()
+{
+    const int numPixels = width * height;
+
+    if (!m_pPlanes) {
+        m_pPlanes = Pool_New<float>(numPixels * 3);
+        if (!m_pPlanes)
+            return NULL;
+        SPixelView pixels = SPixelView::Whole(data, width, height, 4);
+        SPlaneView red = Plane(RED), green = Plane(GREEN), blue = Plane(BLUE);
+        For_Each_Row(pixels, [&](const uint8_t* row, int y) {
+            float* redRow = red.Row(y);
+            float* greenRow = green.Row(y);
+            float* blueRow = blue.Row(y);
+            for (int x = 0; x < pixels.width; x++) {
+                redRow[x] = row[x * 4] / 255.0f;
+                greenRow[x] = row[x * 4 + 1] / 255.0f;
+                blueRow[x] = row[x * 4 + 2] / 255.0f;
+            }
+        });
+    }
+
+    m_bBytesStale = true;
+    return m_pPlanes;
+}// Float_Planes
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Round the float planes back into the color bytes of data if they hold
+//  newer colors.  The planes are kept.  Alpha is never held in the planes.
+//  If the bytes are shared and cannot be copied they are left stale.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Sync_Bytes()
+{
+    if (!m_pPlanes || !m_bBytesStale || !Unshare_Data())
+        return;
+    SPixelView pixels = SPixelView::Whole(data, width, height, 4);
+    SPlaneView planes[3] = { Plane(RED), Plane(GREEN), Plane(BLUE) };
+    For_Each_Row(pixels, [&](uint8_t* row, int y) {
+        for (int color_i = 0; color_i < 3; color_i++) {
+            const float* planeRow = planes[color_i].Row(y);
+            for (int x = 0; x < pixels.width; x++) {
+                float newVal = planeRow[x];
+                if (newVal < 0.0f) newVal = 0.0f;
+                if (newVal > 1.0f) newVal = 1.0f;
+                row[x * 4 + color_i] = (unsigned char)(newVal * 255.0f + 0.5f);
+            }
+        }
+    });
+    m_bBytesStale = false;
+}// Sync_Bytes
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Sync the bytes and drop the float planes, before an operation that
+//  works on (or replaces) data directly.  Return false, keeping the planes,
+//  if the bytes could not be synced.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Release_Planes()
+{
+    Sync_Bytes();
+    if (m_bBytesStale)
+        return false;
+    Pool_Free(m_pPlanes);
+    m_pPlanes = NULL;
+    return true;
+}// Release_Planes
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -1709,13 +1915,19 @@ void TargaImage::ClearToBlack()
 //
 ///////////////////////////////////////////////////////////////////////////////
 void TargaImage::Paint_Stroke(const Stroke& s) {
+    // strokes are clipped to the region of interest
+    const int left = m_roiWidth > 0 ? m_roiX : 0;
+    const int top = m_roiWidth > 0 ? m_roiY : 0;
+    const int right = m_roiWidth > 0 ? m_roiX + m_roiWidth : width;
+    const int bottom = m_roiWidth > 0 ? m_roiY + m_roiHeight : height;
+
     int radius_squared = (int)s.radius * (int)s.radius;
     for (int x_off = -((int)s.radius); x_off <= (int)s.radius; x_off++) {
         for (int y_off = -((int)s.radius); y_off <= (int)s.radius; y_off++) {
             int x_loc = (int)s.x + x_off;
             int y_loc = (int)s.y + y_off;
-            // are we inside the circle, and inside the image?
-            if ((x_loc >= 0 && x_loc < width && y_loc >= 0 && y_loc < height)) {
+            // are we inside the circle, and inside the region?
+            if ((x_loc >= left && x_loc < right && y_loc >= top && y_loc < bottom)) {
                 int dist_squared = x_off * x_off + y_off * y_off;
                 if (dist_squared <= radius_squared) {
                     data[(y_loc * width + x_loc) * 4 + 0] = s.r;
@@ -16,23 +16,48 @@
 #include <Fl/Fl_Widget.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "ImageView.h"
 
 class Stroke;
 class DistanceImage;
 
 class TargaImage
 {
+    // types
+    public:
+        enum EAdopt { ADOPT };                      // tag for the constructor that takes over a buffer
+
+        // per pixel operation on count pixels of a row, in place; the first is at image position (x, y)
+        typedef std::function<void(uint8_t* row, int count, int x, int y)> RowOp;
+
     // methods
     public:
 	    TargaImage(void);
             TargaImage(int w, int h);
-	    TargaImage(int w, int h, unsigned char *d);
-            TargaImage(const TargaImage& image);
+	    TargaImage(int w, int h, const unsigned char *d);
+            TargaImage(int w, int h, unsigned char *d, EAdopt);    // take ownership of d, which must come from Pool_Alloc
+            TargaImage(const TargaImage& image);        // shares the pixels until either image changes them
+            TargaImage(TargaImage&& image);
 	    ~TargaImage(void);
 
+        TargaImage& operator=(const TargaImage& image);
+        TargaImage& operator=(TargaImage&& image);
+        void Swap(TargaImage& image);               // exchange buffers, planes and region of interest
+
         unsigned char*	To_RGB(void);	            // Convert the image to RGB format,
-        bool Save_Image(const char*);               // save the image to a file
+        bool Save_Image(const char*, bool bRLE = false);    // save the image to a file, run length encoded if bRLE
         static TargaImage* Load_Image(char*);       // Load a file and return a pointer to a new TargaImage object.  Returns NULL on failure
+        bool Save_Raw(const char*);                 // save the premultiplied pixels and float planes as they are in memory, for caches
+        static TargaImage* Load_Raw(const char*);   // load a file written by Save_Raw.  Returns NULL on failure
+        size_t Raw_Size() const;                    // bytes Save_Raw would write
+        void Share_Pixels(TargaImage& image);       // take on the size, pixels and planes of image, keeping the region of interest
+        const unsigned char* Data() const;          // the pixels, read only; change them through the operations, which unshare them first
+
+        bool Set_ROI(int x, int y, int w, int h);   // limit the following operations to a rectangle, clipped to the image
+        void Clear_ROI();                           // operate on the whole image again
 
         bool To_Grayscale();
 
@@ -55,10 +80,19 @@ class TargaImage
 
         bool Difference(TargaImage* pImage);
 
+        bool Point_Ops(const std::vector<RowOp>& ops);     // apply each operation to a row in turn, in one pass over the image
+        static RowOp Gray_Op();
+        static RowOp Quant_Uniform_Op();
+        static RowOp Dither_Threshold_Op();
+        static RowOp Dither_Cluster_Op();
+        RowOp Difference_Op(TargaImage* pImage);    // pImage must be the same size and outlive the operation
+
         bool Filter_Box();
+        bool Filter_Box_N(unsigned int radius);
         bool Filter_Bartlett();
         bool Filter_Gaussian();
         bool Filter_Gaussian_N(unsigned int N);
+        bool Filter_Gaussian_Sigma(float sigma);
         bool Filter_Edge();
         bool Filter_Enhance();
 
@@ -73,12 +107,30 @@ class TargaImage
 	// helper function for format conversion
         void RGBA_To_RGB(unsigned char *rgba, unsigned char *rgb);
 
-        // reverse the rows of the image, some targas are stored bottom to top
-	TargaImage* Reverse_Rows(void);
+        // reverse the rows of the image in place, some targas are stored bottom to top
+	void Reverse_Rows(void);
 
 	// clear image to all black
         void ClearToBlack();
 
+	// copy on write: give the image its own pixels before changing them, or new pixels
+        bool Unshare_Data();
+        void Replace_Data(unsigned char* newData);
+
+	// views of the region of interest and of whole float planes, row by row
+        SPixelView Pixels();
+        SPlaneView Plane(int channel);
+
+	// keep data and the float planes in step, see TargaImage.cpp
+        float* Float_Planes();
+        void Sync_Bytes();
+        bool Release_Planes();
+
+	// run a separable filter over the color channels, see TargaImage.cpp
+        bool Filter_Separable(const float* kernel, int radius, float selfWeight, float blurWeight, float bias);
+        bool Filter_Channels(const std::function<bool(float*, int, int)>& blur, int halo, float selfWeight, float blurWeight, float bias);
+        bool Filter_Region(const std::function<bool(float*, int, int)>& blur, int halo, float selfWeight, float blurWeight, float bias);
+
 	// Draws a filled circle according to the stroke data
         void Paint_Stroke(const Stroke& s);
 
@@ -86,7 +138,17 @@ class TargaImage
     public:
         int		width;	    // width of the image in pixels
         int		height;	    // height of the image in pixels
+
+    private:
         unsigned char	*data;	    // pixel data for the image, assumed to be in pre-multiplied RGBA format.
+        std::shared_ptr<unsigned char> m_pStorage;  // owns data, which copies of the image share until one writes; each
+                                                    // image is used by one thread at a time, its copies may be on others
+        float           *m_pPlanes;         // planar red, green and blue in [0, 1] while filters run, else NULL
+        bool            m_bBytesStale;      // m_pPlanes holds colors newer than data
+        int             m_roiX;             // region of interest, top down
+        int             m_roiY;
+        int             m_roiWidth;         // 0 when operations cover the whole image
+        int             m_roiHeight;
 };
 
 class Stroke { // Data structure for holding painterly strokes.
@@ -0,0 +1,317 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ThreadPool.cpp
+//
+//      Implementation of CThreadPool methods.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "ThreadPool.h"
+#include <memory>
+
+using namespace std;
+
+// constants
+const int       c_bandSamples           = 32768;        // target samples per band handed to a thread
+const int       c_minStripColumns       = 16;           // narrowest column strip, one cache line of floats
+
+// index of the pool worker running on this thread, -1 for other threads
+static thread_local int s_workerIndex = -1;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      State shared by the chunks of one ParallelFor call.  Chunks are claimed
+//  through next, so a helper that starts after all chunks are claimed just
+//  returns.
+//
+///////////////////////////////////////////////////////////////////////////////
+struct SParallelJob
+{
+    const function<void(int, int)>* pBody;
+    int                             count;
+    int                             grain;
+    int                             numChunks;
+    atomic<int>                     next;
+    atomic<int>                     done;
+    mutex                           doneMutex;
+    condition_variable              doneSignal;
+
+    void RunChunks()
+    {
+        int chunk;
+        while ((chunk = next++) < numChunks)
+        {
+            int begin = chunk * grain;
+            int end = (begin + grain < count) ? begin + grain : count;
+            (*pBody)(begin, end);
+
+            if (++done == numChunks)
+            {
+                lock_guard<mutex> lock(doneMutex);
+                doneSignal.notify_all();
+            }// if
+        }// while
+    }// RunChunks
+};// SParallelJob
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Get the process wide pool.
+//
+///////////////////////////////////////////////////////////////////////////////
+CThreadPool& CThreadPool::Instance()
+{
+    static CThreadPool pool;
+    return pool;
+}// Instance
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  Start one worker per hardware thread, less the caller.
+//
+///////////////////////////////////////////////////////////////////////////////
+CThreadPool::CThreadPool() : m_pending(0), m_nextQueue(0), m_bStop(false), m_threadCount(1)
+{
+    int hardwareThreads = (int)thread::hardware_concurrency();
+    SetThreadCount(hardwareThreads > 0 ? hardwareThreads : 1);
+}// CThreadPool
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Destructor.  Finish queued tasks and join the workers.
+//
+///////////////////////////////////////////////////////////////////////////////
+CThreadPool::~CThreadPool()
+{
+    StopWorkers();
+}// ~CThreadPool
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Set the number of threads used by ParallelFor, counting the caller.
+//  Pool tasks may not change it, since stopping the workers would join the
+//  thread doing the stopping.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPool::SetThreadCount(int count)
+{
+    if (s_workerIndex >= 0)
+        return;
+    if (count < 1)
+        count = 1;
+
+    StopWorkers();
+    m_threadCount = count;
+    StartWorkers(count - 1);
+}// SetThreadCount
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Get the number of threads used by ParallelFor, counting the caller.
+//
+///////////////////////////////////////////////////////////////////////////////
+int CThreadPool::GetThreadCount() const
+{
+    return m_threadCount;
+}// GetThreadCount
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Call body(begin, end) over [0, count) in chunks of at most grain items
+//  and return when all chunks are done.  The caller runs chunks too, and only
+//  waits for chunks other threads have already claimed, so nested calls from
+//  pool tasks cannot deadlock.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPool::ParallelFor(int count, int grain, const function<void(int, int)>& body)
+{
+    if (count <= 0)
+        return;
+    if (grain < 1)
+        grain = 1;
+
+    int numChunks = (count + grain - 1) / grain;
+    if (numChunks == 1 || m_workers.empty())
+    {
+        body(0, count);
+        return;
+    }// if
+
+    shared_ptr<SParallelJob> pJob = make_shared<SParallelJob>();
+    pJob->pBody = &body;
+    pJob->count = count;
+    pJob->grain = grain;
+    pJob->numChunks = numChunks;
+    pJob->next = 0;
+    pJob->done = 0;
+
+    int numHelpers = (int)m_workers.size() < numChunks - 1 ? (int)m_workers.size() : numChunks - 1;
+    for (int i = 0; i < numHelpers; ++i)
+        Submit([pJob]() { pJob->RunChunks(); });
+
+    pJob->RunChunks();
+
+    unique_lock<mutex> lock(pJob->doneMutex);
+    pJob->doneSignal.wait(lock, [&pJob]() { return pJob->done == pJob->numChunks; });
+}// ParallelFor
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Queue a task.  Workers push onto their own deque, other threads spread
+//  their tasks round robin.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPool::Submit(const function<void()>& task)
+{
+    if (m_workers.empty())
+    {
+        task();
+        return;
+    }// if
+
+    int index = s_workerIndex >= 0 ? s_workerIndex : (int)(m_nextQueue++ % m_queues.size());
+    {
+        lock_guard<mutex> lock(m_queues[index]->m_mutex);
+        m_queues[index]->m_tasks.push_back(task);
+    }
+    ++m_pending;
+
+    lock_guard<mutex> lock(m_sleepMutex);
+    m_wake.notify_one();
+}// Submit
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Start the given number of workers.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPool::StartWorkers(int count)
+{
+    m_bStop = false;
+    for (int i = 0; i < count; ++i)
+        m_queues.push_back(new SQueue);
+    for (int i = 0; i < count; ++i)
+        m_workers.push_back(thread(&CThreadPool::WorkerLoop, this, i));
+}// StartWorkers
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Let the workers drain their queues, then join and free them.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPool::StopWorkers()
+{
+    {
+        lock_guard<mutex> lock(m_sleepMutex);
+        m_bStop = true;
+        m_wake.notify_all();
+    }
+
+    for (size_t i = 0; i < m_workers.size(); ++i)
+        m_workers[i].join();
+    for (size_t i = 0; i < m_queues.size(); ++i)
+        delete m_queues[i];
+
+    m_workers.clear();
+    m_queues.clear();
+}// StopWorkers
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Worker main loop.  Run tasks until told to stop, sleeping while there
+//  is nothing to do.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPool::WorkerLoop(int index)
+{
+    s_workerIndex = index;
+
+    for (;;)
+    {
+        function<void()> task;
+        if (PopTask(index, task))
+        {
+            task();
+            continue;
+        }// if
+
+        unique_lock<mutex> lock(m_sleepMutex);
+        m_wake.wait(lock, [this]() { return m_bStop || m_pending > 0; });
+        if (m_bStop && m_pending == 0)
+            return;
+    }// for
+}// WorkerLoop
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Take the newest task from our own deque, or steal the oldest task from
+//  another worker.  Return false if every deque is empty.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CThreadPool::PopTask(int index, function<void()>& task)
+{
+    int numQueues = (int)m_queues.size();
+    for (int i = 0; i < numQueues; ++i)
+    {
+        SQueue* pQueue = m_queues[(index + i) % numQueues];
+        lock_guard<mutex> lock(pQueue->m_mutex);
+        if (pQueue->m_tasks.empty())
+            continue;
+
+        if (i == 0)
+        {
+            task = pQueue->m_tasks.back();
+            pQueue->m_tasks.pop_back();
+        }// if
+        else
+        {
+            task = pQueue->m_tasks.front();
+            pQueue->m_tasks.pop_front();
+        }// else
+
+        --m_pending;
+        return true;
+    }// for
+
+    return false;
+}// PopTask
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run body(begin, end) on the pool over the rows [0, rows) of an image
+//  whose rows hold rowLength samples.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Parallel_Rows(int rows, int rowLength, const function<void(int, int)>& body)
+{
+    int grain = rowLength > 0 ? c_bandSamples / rowLength : rows;
+    CThreadPool::Instance().ParallelFor(rows, grain, body);
+}// Parallel_Rows
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run body(begin, end) on the pool over the columns [0, columns) of an
+//  image with the given number of rows.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Parallel_Columns(int columns, int rows, const function<void(int, int)>& body)
+{
+    int grain = rows > 0 ? c_bandSamples / rows : columns;
+    if (grain < c_minStripColumns)
+        grain = c_minStripColumns;
+    CThreadPool::Instance().ParallelFor(columns, grain, body);
+}// Parallel_Columns
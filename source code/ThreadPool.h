@@ -0,0 +1,109 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ThreadPool.h
+//
+//      Process wide pool of worker threads.  Each worker owns a task deque
+//  and steals from the others when it runs dry.  Image operations use
+//  ParallelFor to split their rows (or columns) into bands; the results do
+//  not depend on the number of threads.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _C_THREAD_POOL
+#define _C_THREAD_POOL
+
+#include <functional>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+class CThreadPool
+{
+    // methods
+    public:
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Get the process wide pool.  It starts with one thread per hardware
+        //  thread, the caller of ParallelFor included.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static CThreadPool& Instance();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Set the number of threads used by ParallelFor, counting the caller.
+        //  One runs everything on the calling thread.  Must not be called while
+        //  work is in flight, from this thread or any other, such as the image
+        //  cache's background loader.  Ignored from a pool task, which cannot
+        //  stop the pool it runs on.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        void SetThreadCount(int count);
+        int  GetThreadCount() const;
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Call body(begin, end) over [0, count) in chunks of at most grain
+        //  items, on the pool and the calling thread, and return when all chunks
+        //  are done.  Safe to call from inside a pool task.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        void ParallelFor(int count, int grain, const std::function<void(int, int)>& body);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Queue a task to run on a worker.  Runs it inline if the pool has no
+        //  workers.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        void Submit(const std::function<void()>& task);
+
+    private:
+        CThreadPool();
+        ~CThreadPool();
+
+        void StartWorkers(int count);
+        void StopWorkers();
+        void WorkerLoop(int index);
+        bool PopTask(int index, std::function<void()>& task);
+
+    // members
+    private:
+        struct SQueue
+        {
+            std::mutex                          m_mutex;
+            std::deque<std::function<void()> >  m_tasks;
+        };
+
+        std::vector<std::thread>    m_workers;          // worker threads, one queue each
+        std::vector<SQueue*>        m_queues;           // per worker task deques
+        std::mutex                  m_sleepMutex;       // guards sleeping on m_wake
+        std::condition_variable     m_wake;             // signalled when tasks are queued
+        std::atomic<int>            m_pending;          // tasks queued but not yet started
+        std::atomic<unsigned int>   m_nextQueue;        // round robin queue for submissions from outside
+        bool                        m_bStop;            // workers should exit
+        int                         m_threadCount;      // threads used by ParallelFor, caller included
+};// CThreadPool
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run body(begin, end) on the pool over the rows [0, rows) of an image
+//  whose rows hold rowLength samples, in bands of a few ten thousand samples.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Parallel_Rows(int rows, int rowLength, const std::function<void(int, int)>& body);
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run body(begin, end) on the pool over the columns [0, columns) of an
+//  image with the given number of rows, for passes that must walk down each
+//  column in order.  Strips are at least a cache line of floats wide.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Parallel_Columns(int columns, int rows, const std::function<void(int, int)>& body);
+
+#endif // _C_THREAD_POOL
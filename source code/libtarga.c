@@ -4,6 +4,17 @@
 
 #include <stdio.h>
 #include <malloc.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include "libtarga.h"
 
@@ -51,22 +62,229 @@
 #define TGA_ERR_READ_FAILS              (9)
 #define TGA_ERR_BAD_IMAGE_TYPE          (10)
 #define TGA_ERR_BAD_DIMENSIONS          (11)
+#define TGA_ERR_WRITE_FAILS             (12)
 
 
 static uint32 TargaError;
 
 
+/* allocator for the image and row buffers, see tga_set_allocator */
+static void * (*TargaAlloc)( size_t bytes ) = malloc;
+static void   (*TargaFree)( void * ptr ) = free;
+
+
+/* row order of image buffers, see tga_set_row_order */
+static int TargaRowOrder = TGA_ROWS_BOTTOM_UP;
+
+
+/* runs bands of rows on several threads, see tga_set_parallel */
+static void (*TargaParallel)( int rows, int row_length, tga_row_body body, void * context ) = NULL;
+
+
+/* bytes fetched from the file per read; rows larger than this are read straight into place */
+#define TGA_READ_CHUNK           (1 << 18)
+
+
+/* input from a memory mapping of the whole file, or failing that buffered 
+   stdio, so pixels are fetched in large blocks rather than a byte at a time */
+typedef struct {
+    FILE *        file;       // NULL when reading from the mapping
+    const ubyte * buf;        // the mapped file, or the chunk last read from file
+    size_t        pos;        // next unread byte of buf
+    size_t        len;        // bytes held in buf
+    ubyte *       chunk;      // TGA_READ_CHUNK bytes behind buf when reading through stdio
+    void *        map_base;   // the mapping, NULL if none
+    size_t        map_size;
+} tga_reader;
+
+
+/* state of the run length packet being expanded, which may span rows */
+typedef struct {
+    uint32  left;       // pixels of the packet not yet expanded
+    int     run;        // non-zero for a run, zero for raw pixels
+    ubyte   pix[4];     // the pixel repeated by a run
+} tga_packet;
+
+
+/* the ways a row of file pixels is converted, one tight loop each */
+enum TGA_DECODE_KIND {
+    TGA_DECODE_BGRA,        // 32 bit with alpha
+    TGA_DECODE_BGRX,        // 32 bit without alpha bits, alpha forced to full
+    TGA_DECODE_BGR,         // 24 bit
+    TGA_DECODE_RGB565,      // 16 bit
+    TGA_DECODE_RGB555,      // 15 bit, or 16 bit with one alpha bit (ignored)
+    TGA_DECODE_GRAY,        // 8 bit grayscale
+    TGA_DECODE_GRAY_ALPHA,  // 16 bit grayscale, gray then alpha
+    TGA_DECODE_PALETTED,    // colormap index, colormap converted up front
+    TGA_DECODE_GENERIC      // anything else, a pixel at a time through tga_convert_color
+};
+
+
+/* where a row starts in a file held in memory, so rows can be decoded 
+   apart from each other: its offset, and the packet it starts inside */
+typedef struct {
+    size_t      pos;
+    tga_packet  packet;
+} tga_row_mark;
+
+
+/* row converter for one load; the colormap, if any, follows it in memory */
+typedef struct {
+    int     kind;               // one of TGA_DECODE_KIND
+    uint32  format;             // bytes per output pixel
+    ubyte   bytes_per_pix;      // bytes per file pixel
+    ubyte   bits_per_pix;       // for the generic path
+    ubyte   alphabits;
+    ubyte   expand5[32];        // 5 bit channel to 8 bits
+    ubyte   expand6[64];        // 6 bit channel to 8 bits
+    uint32  palette_first;      // index of the first colormap entry
+    uint32  palette_length;
+    uint32 * palette;           // converted colormap entries
+    ubyte   premul_ready[256];  // rows of premul filled so far
+    ubyte   premul[256][256];   // premul[a][c] -- c premultiplied by alpha a
+} tga_decoder;
+
+
+/* bytes collected before each write to the file */
+#define TGA_WRITE_CHUNK          (1 << 20)
+
+
+/* buffered output */
+typedef struct {
+    FILE *  file;
+    ubyte * buf;        // size bytes
+    uint32  size;
+    uint32  len;        // bytes waiting in buf
+    int     failed;     // non-zero once a write has failed
+} tga_writer;
+
+
+/* row converter for one save */
+typedef struct {
+    uint32  format;                 // bytes per image pixel
+    ubyte   unpremul_ready[256];    // rows of unpremul filled so far
+    ubyte   unpremul[256][256];     // unpremul[a][c] -- c un-premultiplied by alpha a
+} tga_encoder;
+
+
+/* state of a targa being read a row at a time, see tga_open_rows */
+struct tga_row_reader {
+    tga_reader      reader;
+    tga_packet      packet;
+    tga_decoder *   decoder;
+    ubyte *         src_row;        // one row of file pixels, for rows not read in place
+    uint32          width;
+    uint32          height;
+    uint32          format;
+    ubyte           bytes_per_pix;
+    int             rle;
+    int             top_first;      // rows are stored top row first
+    int             from_right;     // pixels are stored right to left
+    uint32          rows_read;
+};
+
+
+/* a load decoding bands of rows on several threads, see tga_load_parallel */
+typedef struct {
+    tga_row_reader *        rows;
+    const tga_row_mark *    marks;      // start of each row in file order
+    ubyte *                 skipped;    // nonzero for rows a band could not decode, in file order
+    ubyte *                 image_data;
+} tga_parallel_load;
+
+
+/* a save encoding rows on several threads, see tga_write_band */
+typedef struct {
+    struct tga_row_writer * rows;
+    const ubyte *           dat;        // first image row of the wave
+    ptrdiff_t               stride;     // bytes from one image row to the next, in file order
+    ubyte *                 out;        // row i of the wave is encoded at out + i * row_worst
+    uint32 *                lens;       // bytes row i takes in the file, 0 if not yet encoded
+} tga_parallel_save;
+
+
+/* state of a targa being written a row at a time, see tga_create_rows */
+struct tga_row_writer {
+    tga_writer      writer;
+    tga_encoder     enc;
+    ubyte *         file_row;       // one row of file pixels, for run length encoding
+    uint32          width;
+    uint32          format;
+    int             rle;
+    uint32          row_worst;      // most bytes a row can take in the file
+};
+
+
 static int16 ttohs( int16 val );
 static int16 htots( int16 val );
 static int32 ttohl( int32 val );
 static int32 htotl( int32 val );
 
 
-static uint32 tga_get_pixel( FILE * tga, ubyte bytes_per_pix, 
-                            ubyte * colormap, ubyte cmap_bytes_entry );
 static uint32 tga_convert_color( uint32 pixel, uint32 bpp_in, ubyte alphabits, uint32 format_out );
-static void tga_write_pixel_to_mem( ubyte * dat, ubyte img_spec, uint32 number, 
-                                   uint32 w, uint32 h, uint32 pixel, uint32 format );
+static ubyte tga_premultiply( ubyte c, ubyte a );
+static int tga_open_reader( tga_reader * reader, const char * filename );
+static void tga_close_reader( tga_reader * reader );
+static int tga_map_file( tga_reader * reader, const char * filename );
+static uint32 tga_read( tga_reader * reader, ubyte * dest, uint32 count );
+static const ubyte * tga_read_span( tga_reader * reader, ubyte * scratch, uint32 count );
+static void tga_read_rle_row( tga_reader * reader, tga_packet * packet, ubyte * dest, 
+                             uint32 count, ubyte bytes_per_pix );
+static tga_decoder * tga_create_decoder( ubyte image_type, ubyte pix_depth, ubyte alphabits, uint32 format,
+                                        const ubyte * colormap, uint16 cmap_first, uint16 cmap_length,
+                                        ubyte cmap_entry_size, ubyte cmap_bytes_entry );
+static const ubyte * tga_premul_row( tga_decoder * dec, ubyte a );
+static void tga_decode_row( tga_decoder * dec, const ubyte * src, ubyte * dst, uint32 count );
+static void tga_mirror_row( ubyte * row, uint32 count, uint32 format );
+static void tga_next_row( tga_row_reader * rows, tga_reader * reader, tga_packet * packet, 
+                         ubyte * scratch, ubyte * dat );
+static uint32 tga_mem_row( uint32 row, uint32 h );
+static uint32 tga_load_row( tga_row_reader * rows, uint32 i );
+static int tga_load_parallel( tga_row_reader * rows, ubyte * image_data );
+static void tga_index_rows( tga_row_reader * rows, tga_row_mark * marks );
+static void tga_decode_band( void * context, int begin, int end );
+static int tga_write( const char * file, int width, int height, unsigned char * dat, unsigned int format, int rle );
+static void tga_put( tga_writer * writer, const ubyte * src, uint32 count );
+static void tga_flush( tga_writer * writer );
+static void tga_encode_row( tga_encoder * enc, const ubyte * src, ubyte * dst, uint32 count );
+static uint32 tga_pack_row( const ubyte * src, ubyte * dst, uint32 count, uint32 format );
+static uint32 tga_file_row( tga_row_writer * rows, const ubyte * src, ubyte * dst, ubyte * scratch );
+static void tga_write_band( tga_row_writer * rows, const ubyte * dat, ptrdiff_t stride, uint32 count );
+static void tga_encode_band( void * context, int begin, int end );
+static const ubyte * tga_unpremul_row( tga_encoder * enc, ubyte a );
+static ubyte tga_unpremultiply( ubyte c, ubyte a );
+
+
+/* sets the allocator used for image buffers; NULL for either restores malloc/free */
+void tga_set_allocator( void * (*alloc_fn)( size_t bytes ), void (*free_fn)( void * ptr ) ) {
+
+    if( alloc_fn && free_fn ) {
+        TargaAlloc = alloc_fn;
+        TargaFree = free_fn;
+    } else {
+        TargaAlloc = malloc;
+        TargaFree = free;
+    }
+
+}
+
+
+/* sets the row order of image buffers in memory */
+void tga_set_row_order( int order ) {
+    TargaRowOrder = order == TGA_ROWS_TOP_DOWN ? TGA_ROWS_TOP_DOWN : TGA_ROWS_BOTTOM_UP;
+}
+
+
+/* sets the function that runs bands of rows in parallel; NULL runs them in turn */
+void tga_set_parallel( void (*parallel_fn)( int rows, int row_length, tga_row_body body, void * context ) ) {
+    TargaParallel = parallel_fn;
+}
+
+
+/* frees an image returned by tga_create or tga_load */
+void tga_free( void * data ) {
+    TargaFree( data );
+}
 
 
 /* returns the last error encountered */
@@ -116,6 +334,9 @@ const char * tga_error_string( int error_code ) {
     case TGA_ERR_BAD_DIMENSIONS:
         return( "image has size 0 width or height (or both)" );
 
+    case TGA_ERR_WRITE_FAILS:
+        return( "cannot write file" );
+
     default:
         return( "unknown error" );
 
@@ -133,10 +354,10 @@ void * tga_create( int width, int height, unsigned int format ) {
     switch( format ) {
         
     case TGA_TRUECOLOR_32:
-        return( (void *)malloc( width * height * 4 ) );
+        return( TargaAlloc( width * height * 4 ) );
         
     case TGA_TRUECOLOR_24:
-        return( (void *)malloc( width * height * 3 ) );
+        return( TargaAlloc( width * height * 3 ) );
         
     default:
         TargaError = TGA_ERR_BAD_FORMAT;
@@ -149,9 +370,9 @@ void * tga_create( int width, int height, unsigned int format ) {
 }
 
 
-/* loads and converts a targa from disk */
-void * tga_load( const char * filename, 
-                int * width, int * height, unsigned int format ) {
+/* opens a targa for reading a row at a time */
+tga_row_reader * tga_open_rows( const char * filename, 
+                               int * width, int * height, int * top_first, unsigned int format ) {
     
     ubyte  idlen;               // length of the image_id string below.
     ubyte  cmap_type;           // paletted image <=> cmap_type
@@ -166,37 +387,24 @@ void * tga_load( const char * filename,
     ubyte  img_spec_pix_depth;  // the depth of a pixel in the image.
     ubyte  img_spec_img_desc;   // the image descriptor.
 
-    FILE * targafile;
-
-    ubyte * tga_hdr = NULL;
+    ubyte tga_hdr[HDR_LENGTH];
+    ubyte tga_id[256];
 
     ubyte * colormap = NULL;
 
     ubyte cmap_bytes_entry = 0; // Prevents spurious debug runtime check in VC2003
     uint32 cmap_bytes;
-    
-    uint32 tmp_col;
-    uint32 tmp_int32;
-    ubyte  tmp_byte;
 
     ubyte alphabits = 0;
 
     uint32 num_pixels;
-    
-    uint32 i;
-    uint32 j;
-
-    ubyte * image_data;
-    uint32 img_dat_len;
 
     ubyte bytes_per_pix;
 
-    ubyte true_bits_per_pixel;
-
-    uint32 bytes_total = 0;
+    int rle;
 
-    ubyte packet_header;
-    ubyte repcount;
+    tga_row_reader * rows;
+    tga_reader * reader;
     
 
     switch( format ) {
@@ -212,20 +420,25 @@ void * tga_load( const char * filename,
     }
 
     
+    rows = (tga_row_reader *)malloc( sizeof( tga_row_reader ) );
+    if( rows == NULL ) {
+        TargaError = TGA_ERR_READ_FAILS;
+        return( NULL );
+    }
+    reader = &rows->reader;
+
     /* open binary image file */
-    targafile = fopen( filename, "rb" );
-    if( targafile == NULL ) {
+    if( !tga_open_reader( reader, filename ) ) {
+        free( rows );
         TargaError = TGA_ERR_OPEN_FAILS;
         return( NULL );
     }
 
 
-    /* allocate memory for the header */
-    tga_hdr = (ubyte *)malloc( HDR_LENGTH );
-
     /* read the header in. */
-    if( fread( (void *)tga_hdr, 1, HDR_LENGTH, targafile ) != HDR_LENGTH ) {
-        free( tga_hdr );
+    if( tga_read( reader, tga_hdr, HDR_LENGTH ) != HDR_LENGTH ) {
+        tga_close_reader( reader );
+        free( rows );
         TargaError = TGA_ERR_BAD_HEADER;
         return( NULL );
     }
@@ -248,12 +461,12 @@ void * tga_load( const char * filename,
     img_spec_pix_depth = (ubyte)tga_hdr[HDR_IMG_SPEC_PIX_DEPTH];
     img_spec_img_desc  = (ubyte)tga_hdr[HDR_IMG_SPEC_IMG_DESC];
 
-    free( tga_hdr );
-
 
     num_pixels = img_spec_width * img_spec_height;
 
     if( num_pixels == 0 ) {
+        tga_close_reader( reader );
+        free( rows );
         TargaError = TGA_ERR_BAD_DIMENSIONS;
         return( NULL );
     }
@@ -264,7 +477,9 @@ void * tga_load( const char * filename,
     
     /* seek past the image id, if there is one */
     if( idlen ) {
-        if( fseek( targafile, idlen, SEEK_CUR ) ) {
+        if( tga_read( reader, tga_id, idlen ) != idlen ) {
+            tga_close_reader( reader );
+            free( rows );
             TargaError = TGA_ERR_UNEXPECTED_EOF;
             return( NULL );
         }
@@ -273,11 +488,36 @@ void * tga_load( const char * filename,
 
     /* if this is a 'nodata' image, just jump out. */
     if( image_type == TGA_IMG_NODATA ) {
+        tga_close_reader( reader );
+        free( rows );
         TargaError = TGA_ERR_NODATA_IMAGE;
         return( NULL );
     }
 
 
+    switch( image_type ) {
+
+    case TGA_IMG_UNC_TRUECOLOR:
+    case TGA_IMG_UNC_GRAYSCALE:
+    case TGA_IMG_UNC_PALETTED:
+        rle = 0;
+        break;
+
+    case TGA_IMG_RLE_TRUECOLOR:
+    case TGA_IMG_RLE_GRAYSCALE:
+    case TGA_IMG_RLE_PALETTED:
+        rle = 1;
+        break;
+
+    default:
+        tga_close_reader( reader );
+        free( rows );
+        TargaError = TGA_ERR_BAD_IMAGE_TYPE;
+        return( NULL );
+
+    }
+
+
     /* now we're starting to get into the meat of the matter. */
     
     
@@ -299,6 +539,8 @@ void * tga_load( const char * filename,
             
         case TGA_IMG_UNC_GRAYSCALE:
         case TGA_IMG_RLE_GRAYSCALE:
+            tga_close_reader( reader );
+            free( rows );
             TargaError = TGA_ERR_COLORMAP_FOR_GRAY;
             return( NULL );
         }
@@ -308,12 +550,14 @@ void * tga_load( const char * filename,
             cmap_entry_size == 16 ||
             cmap_entry_size == 24 ||
             cmap_entry_size == 32) ) {
+            tga_close_reader( reader );
+            free( rows );
             TargaError = TGA_ERR_BAD_COLORMAP_ENTRY_SIZE;
             return( NULL );
         }
         
         
-        /* allocate memory for a colormap */
+        /* read the whole colormap in one go */
         if( cmap_entry_size & 0x07 ) {
             cmap_bytes_entry = (((8 - (cmap_entry_size & 0x07)) + cmap_entry_size) >> 3);
         } else {
@@ -321,33 +565,14 @@ void * tga_load( const char * filename,
         }
         
         cmap_bytes = cmap_bytes_entry * cmap_length;
-        colormap = (ubyte *)malloc( cmap_bytes );
-        
-        
-        for( i = 0; i < cmap_length; i++ ) {
-            
-            /* seek ahead to first entry used */
-            if( cmap_first != 0 ) {
-                fseek( targafile, cmap_first * cmap_bytes_entry, SEEK_CUR );
-            }
-            
-            tmp_int32 = 0;
-            for( j = 0; j < cmap_bytes_entry; j++ ) {
-                if( !fread( &tmp_byte, 1, 1, targafile ) ) {
-                    free( colormap );
-                    TargaError = TGA_ERR_BAD_COLORMAP;
-                    return( NULL );
-                }
-                tmp_int32 += tmp_byte << (j * 8);
-            }
-
-            // byte order correct.
-            tmp_int32 = ttohl( tmp_int32 );
+        colormap = (ubyte *)malloc( cmap_bytes + 1 );
 
-            for( j = 0; j < cmap_bytes_entry; j++ ) {
-                colormap[i * cmap_bytes_entry + j] = (tmp_int32 >> (8 * j)) & 0xFF;
-            }
-            
+        if( tga_read( reader, colormap, cmap_bytes ) != cmap_bytes ) {
+            free( colormap );
+            tga_close_reader( reader );
+            free( rows );
+            TargaError = TGA_ERR_BAD_COLORMAP;
+            return( NULL );
         }
 
     }
@@ -367,105 +592,110 @@ void * tga_load( const char * filename,
     }
 
 
-    /* compute how many bytes of storage we need for the image */
-    bytes_total = img_spec_width * img_spec_height * format;
+    /* pick the row converter, then let it have the colormap */
+    rows->decoder = tga_create_decoder( image_type, img_spec_pix_depth, alphabits, format, 
+        colormap, cmap_first, cmap_length, cmap_entry_size, cmap_bytes_entry );
+    free( colormap );
 
-    image_data = (ubyte *)malloc( bytes_total );
+    rows->src_row = (ubyte *)malloc( img_spec_width * bytes_per_pix );
 
-    img_dat_len = img_spec_width * img_spec_height * bytes_per_pix;
+    if( rows->decoder == NULL || rows->src_row == NULL ) {
+        tga_close_rows( rows );
+        TargaError = TGA_ERR_READ_FAILS;
+        return( NULL );
+    }
 
-    // compute the true number of bits per pixel
-    true_bits_per_pixel = cmap_type ? cmap_entry_size : img_spec_pix_depth;
+    rows->width = img_spec_width;
+    rows->height = img_spec_height;
+    rows->format = format;
+    rows->bytes_per_pix = bytes_per_pix;
+    rows->rle = rle;
+    rows->rows_read = 0;
+    rows->packet.left = 0;
+    rows->packet.run = 0;
+
+    /* rows in the file run from the origin corner given by the descriptor */
+    rows->top_first = ((img_spec_img_desc & 0x30) >> 4) == TGA_UPPER_LEFT ||
+                      ((img_spec_img_desc & 0x30) >> 4) == TGA_UPPER_RIGHT;
+    rows->from_right = ((img_spec_img_desc & 0x30) >> 4) == TGA_LOWER_RIGHT ||
+                       ((img_spec_img_desc & 0x30) >> 4) == TGA_UPPER_RIGHT;
 
-    switch( image_type ) {
+    *width  = img_spec_width;
+    *height = img_spec_height;
+    *top_first = rows->top_first;
 
-    case TGA_IMG_UNC_TRUECOLOR:
-    case TGA_IMG_UNC_GRAYSCALE:
-    case TGA_IMG_UNC_PALETTED:
+    return( rows );
 
-        /* FIXME: support grayscale */
+}
 
-        for( i = 0; i < num_pixels; i++ ) {
 
-            // get the color value.
-            tmp_col = tga_get_pixel( targafile, bytes_per_pix, colormap, cmap_bytes_entry );
-            tmp_col = tga_convert_color( tmp_col, true_bits_per_pixel, alphabits, format );
-            
-            // now write the data out.
-            tga_write_pixel_to_mem( image_data, img_spec_img_desc, 
-                i, img_spec_width, img_spec_height, tmp_col, format );
 
-        }
-    
-        break;
 
+/* reads the next count rows in file order into dat, returns how many there were */
+int tga_read_rows( tga_row_reader * rows, unsigned char * dat, int count ) {
 
-    case TGA_IMG_RLE_TRUECOLOR:
-    case TGA_IMG_RLE_GRAYSCALE:
-    case TGA_IMG_RLE_PALETTED:
+    int i;
 
-        // FIXME: handle grayscale..
+    for( i = 0; i < count && rows->rows_read < rows->height; i++, rows->rows_read++ ) {
+        tga_next_row( rows, &rows->reader, &rows->packet, rows->src_row, dat );
+        dat += rows->width * rows->format;
+    }
 
-        for( i = 0; i < num_pixels; ) {
+    return( i );
 
-            /* a bit of work to do to read the data.. */
-            if( fread( &packet_header, 1, 1, targafile ) < 1 ) {
-                // well, just let them fill the rest with null pixels then...
-                packet_header = 1;
-            }
+}
 
-            if( packet_header & 0x80 ) {
-                /* run length packet */
-
-                tmp_col = tga_get_pixel( targafile, bytes_per_pix, colormap, cmap_bytes_entry );
-                tmp_col = tga_convert_color( tmp_col, true_bits_per_pixel, alphabits, format );
-                
-                repcount = (packet_header & 0x7F) + 1;
-                
-                /* write all the data out */
-                for( j = 0; j < repcount; j++ ) {
-                    tga_write_pixel_to_mem( image_data, img_spec_img_desc, 
-                        i + j, img_spec_width, img_spec_height, tmp_col, format );
-                }
 
-                i += repcount;
-
-            } else {
-                /* raw packet */
-                /* get pixel from file */
-                
-                repcount = (packet_header & 0x7F) + 1;
-                
-                for( j = 0; j < repcount; j++ ) {
-                    
-                    tmp_col = tga_get_pixel( targafile, bytes_per_pix, colormap, cmap_bytes_entry );
-                    tmp_col = tga_convert_color( tmp_col, true_bits_per_pixel, alphabits, format );
-                    
-                    tga_write_pixel_to_mem( image_data, img_spec_img_desc, 
-                        i + j, img_spec_width, img_spec_height, tmp_col, format );
 
-                }
 
-                i += repcount;
+/* closes a targa opened by tga_open_rows */
+void tga_close_rows( tga_row_reader * rows ) {
 
-            }
+    if( rows == NULL ) {
+        return;
+    }
 
-        }
+    free( rows->src_row );
+    free( rows->decoder );
+    tga_close_reader( &rows->reader );
+    free( rows );
 
-        break;
-    
+}
 
-    default:
 
-        TargaError = TGA_ERR_BAD_IMAGE_TYPE;
+
+
+/* loads and converts a targa from disk */
+void * tga_load( const char * filename, 
+                int * width, int * height, unsigned int format ) {
+
+    tga_row_reader * rows;
+    ubyte * image_data;
+    uint32 row_bytes;
+    uint32 i;
+    int top_first;
+
+    rows = tga_open_rows( filename, width, height, &top_first, format );
+    if( rows == NULL ) {
         return( NULL );
+    }
 
+    image_data = (ubyte *)TargaAlloc( (size_t)*width * *height * format );
+    if( image_data == NULL ) {
+        tga_close_rows( rows );
+        TargaError = TGA_ERR_READ_FAILS;
+        return( NULL );
     }
 
-    fclose( targafile );
+    row_bytes = *width * format;
 
-    *width  = img_spec_width;
-    *height = img_spec_height;
+    if( !tga_load_parallel( rows, image_data ) ) {
+        for( i = 0; i < rows->height; i++ ) {
+            tga_read_rows( rows, image_data + (size_t)tga_load_row( rows, i ) * row_bytes, 1 );
+        }
+    }
+
+    tga_close_rows( rows );
 
     return( (void *)image_data );
 
@@ -476,484 +706,681 @@ void * tga_load( const char * filename,
 
 int tga_write_raw( const char * file, int width, int height, unsigned char * dat, unsigned int format ) {
 
-    FILE * tga;
+    return( tga_write( file, width, height, dat, format, 0 ) );
+
+}
+
+
+
+
+int tga_write_rle( const char * file, int width, int height, unsigned char * dat, unsigned int format ) {
+
+    return( tga_write( file, width, height, dat, format, 1 ) );
+
+}
+
 
-    uint32 i, j;
 
-    uint32 size = width * height;
 
-    float red, green, blue, alpha;
+/* creates a targa for writing a row at a time */
+tga_row_writer * tga_create_rows( const char * file, int width, int height, int top_first, 
+                                 unsigned int format, int rle ) {
 
+    tga_row_writer * rows;
+    tga_writer * writer;
+
+    uint32 row_bytes = width * format;
+
+    ubyte hdr[HDR_LENGTH];
     char id[] = "written with libtarga";
     ubyte idlen = 21;
-    ubyte zeroes[5] = { 0, 0, 0, 0, 0 };
-    uint32 pixbuf;
-    ubyte one = 1;
-    ubyte cmap_type = 0;
-    ubyte img_type  = 2;  // 2 - uncompressed truecolor  10 - RLE truecolor
-    uint16 xorigin  = 0;
-    uint16 yorigin  = 0;
-    ubyte  pixdepth = format * 8;  // bpp
-    ubyte img_desc;
-    
-    
+
+
     switch( format ) {
 
     case TGA_TRUECOLOR_24:
-        img_desc = 0;
-        break;
-
     case TGA_TRUECOLOR_32:
-        img_desc = 8;
         break;
 
     default:
         TargaError = TGA_ERR_BAD_FORMAT;
-        return( 0 );
-        break;
+        return( NULL );
+
+    }
+
+    if( width <= 0 || height <= 0 || width > 0xFFFF || height > 0xFFFF ) {
+        TargaError = TGA_ERR_BAD_DIMENSIONS;
+        return( NULL );
+    }
 
+    rows = (tga_row_writer *)malloc( sizeof( tga_row_writer ) );
+    if( rows == NULL ) {
+        TargaError = TGA_ERR_WRITE_FAILS;
+        return( NULL );
+    }
+    writer = &rows->writer;
+
+    // raw packets hold up to 128 pixels behind a one byte header
+    rows->row_worst = rle ? row_bytes + (width + 127) / 128 : row_bytes;
+
+    rows->file_row = (ubyte *)malloc( row_bytes );
+    writer->size = rows->row_worst > TGA_WRITE_CHUNK ? rows->row_worst : TGA_WRITE_CHUNK;
+    writer->buf = (ubyte *)malloc( writer->size );
+    writer->len = 0;
+    writer->failed = 0;
+
+    if( rows->file_row == NULL || writer->buf == NULL ) {
+        free( writer->buf );
+        free( rows->file_row );
+        free( rows );
+        TargaError = TGA_ERR_WRITE_FAILS;
+        return( NULL );
     }
 
-    tga = fopen( file, "wb" );
+    writer->file = fopen( file, "wb" );
 
-    if( tga == NULL ) {
+    if( writer->file == NULL ) {
+        free( writer->buf );
+        free( rows->file_row );
+        free( rows );
         TargaError = TGA_ERR_OPEN_FAILS;
-        return( 0 );
+        return( NULL );
     }
 
-    // write id length
-    fwrite( &idlen, 1, 1, tga );
+#if defined( POSIX_FADV_SEQUENTIAL ) && !defined( _WIN32 )
+    // the file is written once front to back
+    posix_fadvise( fileno( writer->file ), 0, 0, POSIX_FADV_SEQUENTIAL );
+#endif
 
-    // write colormap type
-    fwrite( &cmap_type, 1, 1, tga );
+    rows->width = width;
+    rows->format = format;
+    rows->rle = rle;
+    rows->enc.format = format;
+    memset( rows->enc.unpremul_ready, 0, sizeof( rows->enc.unpremul_ready ) );
 
-    // write image type
-    fwrite( &img_type, 1, 1, tga );
 
-    // write cmap spec.
-    fwrite( &zeroes, 5, 1, tga );
+    // header, then image id.
+    memset( hdr, 0, HDR_LENGTH );
+    hdr[HDR_IDLEN] = idlen;
+    hdr[HDR_CMAP_TYPE] = 0;
+    hdr[HDR_IMAGE_TYPE] = rle ? TGA_IMG_RLE_TRUECOLOR : TGA_IMG_UNC_TRUECOLOR;
+    hdr[HDR_IMG_SPEC_WIDTH] = (ubyte)(width & 0xFF);
+    hdr[HDR_IMG_SPEC_WIDTH + 1] = (ubyte)(width >> 8);
+    hdr[HDR_IMG_SPEC_HEIGHT] = (ubyte)(height & 0xFF);
+    hdr[HDR_IMG_SPEC_HEIGHT + 1] = (ubyte)(height >> 8);
+    hdr[HDR_IMG_SPEC_PIX_DEPTH] = (ubyte)(format * 8);
+    hdr[HDR_IMG_SPEC_IMG_DESC] = (format == TGA_TRUECOLOR_32 ? 8 : 0) | 
+                                 (top_first ? TGA_UPPER_LEFT << 4 : TGA_LOWER_LEFT << 4);
 
-    // write image spec.
-    fwrite( &xorigin, 2, 1, tga );
-    fwrite( &yorigin, 2, 1, tga );
-    fwrite( &width, 2, 1, tga );
-    fwrite( &height, 2, 1, tga );
-    fwrite( &pixdepth, 1, 1, tga );
-    fwrite( &img_desc, 1, 1, tga );
+    tga_put( writer, hdr, HDR_LENGTH );
+    tga_put( writer, (ubyte *)id, idlen );
 
+    return( rows );
 
-    // write image id.
-    fwrite( &id, idlen, 1, tga );
+}
 
-    // color correction -- data is in RGB, need BGR.
-    for( i = 0; i < size; i++ ) {
 
-        pixbuf = 0;
-        for( j = 0; j < format; j++ ) {
-            pixbuf += dat[i*format+j] << (8 * j);
-        }
 
-        switch( format ) {
 
-        case TGA_TRUECOLOR_24:
+/* converts count rows at dat into the output buffer, writing it out as it fills;
+   returns 0 once a write has failed */
+int tga_write_rows( tga_row_writer * rows, const unsigned char * dat, int count ) {
 
-            pixbuf = ((pixbuf & 0xFF) << 16) + 
-                     (pixbuf & 0xFF00) + 
-                     ((pixbuf & 0xFF0000) >> 16);
+    if( count > 0 ) {
+        tga_write_band( rows, dat, rows->width * rows->format, count );
+    }
 
-            pixbuf = htotl( pixbuf );
-            
-            fwrite( &pixbuf, 3, 1, tga );
+    return( !rows->writer.failed );
 
-            break;
+}
 
-        case TGA_TRUECOLOR_32:
 
-            /* need to un-premultiply alpha.. */
 
-            red     = (pixbuf & 0xFF) / 255.0f;
-            green   = ((pixbuf & 0xFF00) >> 8) / 255.0f;
-            blue    = ((pixbuf & 0xFF0000) >> 16) / 255.0f;
-            alpha   = ((pixbuf & 0xFF000000) >> 24) / 255.0f;
 
-            if( alpha > 0.0001 ) {
-                red /= alpha;
-                green /= alpha;
-                blue /= alpha;
-            }
+/* flushes and closes a targa from tga_create_rows, returns 1 if it was all written */
+int tga_finish_rows( tga_row_writer * rows ) {
 
-            /* clamp to 1.0f */
+    tga_writer * writer = &rows->writer;
+    int ok;
 
-            red = red > 1.0f ? 255.0f : red * 255.0f;
-            green = green > 1.0f ? 255.0f : green * 255.0f;
-            blue = blue > 1.0f ? 255.0f : blue * 255.0f;
-            alpha = alpha > 1.0f ? 255.0f : alpha * 255.0f;
+    tga_flush( writer );
 
-            pixbuf = (ubyte)blue + (((ubyte)green) << 8) + 
-                (((ubyte)red) << 16) + (((ubyte)alpha) << 24);
-                
-            pixbuf = htotl( pixbuf );
-           
-            fwrite( &pixbuf, 4, 1, tga );
+    if( fclose( writer->file ) != 0 ) {
+        writer->failed = 1;
+    }
 
-            break;
+    ok = !writer->failed;
 
-        }
+    free( writer->buf );
+    free( rows->file_row );
+    free( rows );
 
+    if( !ok ) {
+        TargaError = TGA_ERR_WRITE_FAILS;
     }
 
-    fclose( tga );
-
-    return( 1 );
+    return( ok );
 
 }
 
 
 
 
-int tga_write_rle( const char * file, int width, int height, unsigned char * dat, unsigned int format ) {
+/* writes an image, rows going out bottom first */
+static int tga_write( const char * file, int width, int height, unsigned char * dat, unsigned int format, int rle ) {
 
-    FILE * tga;
+    tga_row_writer * rows;
+    ptrdiff_t row_bytes = width * format;
 
-    uint32 i, j;
-    uint32 oc, nc;
+    rows = tga_create_rows( file, width, height, 0, format, rle );
+    if( rows == NULL ) {
+        return( 0 );
+    }
 
-    enum RLE_STATE { INIT, NONE, RLP, RAWP };
+    // the file is bottom row first, whichever way the rows are held
+    tga_write_band( rows, dat + (size_t)tga_mem_row( 0, height ) * row_bytes, 
+                    tga_mem_row( 0, height ) == 0 ? row_bytes : -row_bytes, height );
 
-    int state = INIT;
+    return( tga_finish_rows( rows ) );
 
-    uint32 size = width * height;
+}
 
-    uint16 shortwidth = (uint16)width;
-    uint16 shortheight = (uint16)height;
 
-    ubyte repcount;
 
-    float red, green, blue, alpha;
 
-    int idx, row, column;
+/* encodes the image row at src as it goes in the file, at dst, and returns its
+   length; a run length encoded row is converted in scratch first */
+static uint32 tga_file_row( tga_row_writer * rows, const ubyte * src, ubyte * dst, ubyte * scratch ) {
 
-    // have to buffer a whole line for raw packets.
-    unsigned char * rawbuf = (unsigned char *)malloc( width * format );  
+    if( rows->rle ) {
+        tga_encode_row( &rows->enc, src, scratch, rows->width );
+        return( tga_pack_row( scratch, dst, rows->width, rows->format ) );
+    }
 
-    char id[] = "written with libtarga";
-    ubyte idlen = 21;
-    ubyte zeroes[5] = { 0, 0, 0, 0, 0 };
-    uint32 pixbuf;
-    ubyte one = 1;
-    ubyte cmap_type = 0;
-    ubyte img_type  = 10;  // 2 - uncompressed truecolor  10 - RLE truecolor
-    uint16 xorigin  = 0;
-    uint16 yorigin  = 0;
-    ubyte  pixdepth = format * 8;  // bpp
-    ubyte img_desc  = format == TGA_TRUECOLOR_32 ? 8 : 0;
-  
+    tga_encode_row( &rows->enc, src, dst, rows->width );
+    return( rows->width * rows->format );
 
-    switch( format ) {
-    case TGA_TRUECOLOR_24:
-    case TGA_TRUECOLOR_32:
-        break;
+}
 
-    default:
-        TargaError = TGA_ERR_BAD_FORMAT;
-        return( 0 );
-    }
 
 
-    tga = fopen( file, "wb" );
 
-    if( tga == NULL ) {
-        TargaError = TGA_ERR_OPEN_FAILS;
-        return( 0 );
-    }
+/* writes count image rows in file order, the first at dat and each stride
+   bytes on from the last.  with a parallel function set, the rows that fit in
+   the write buffer are encoded on several threads at once, each into its own
+   slot of row_worst bytes, then run length encoded rows are closed up. 
+   packets never cross rows, so the file is the same either way */
+static void tga_write_band( tga_row_writer * rows, const ubyte * dat, ptrdiff_t stride, uint32 count ) {
 
-    // write id length
-    fwrite( &idlen, 1, 1, tga );
+    tga_writer * writer = &rows->writer;
+    tga_parallel_save save;
+    ubyte * slot;
+    ubyte * end;
+    uint32 wave;
+    uint32 i;
 
-    // write colormap type
-    fwrite( &cmap_type, 1, 1, tga );
+    save.lens = NULL;
+    if( TargaParallel != NULL && count > 1 ) {
+        save.lens = (uint32 *)malloc( (writer->size / rows->row_worst) * sizeof( uint32 ) );
+    }
 
-    // write image type
-    fwrite( &img_type, 1, 1, tga );
+    if( save.lens == NULL ) {
+        for( i = 0; i < count; i++, dat += stride ) {
+            if( writer->size - writer->len < rows->row_worst ) {
+                tga_flush( writer );
+            }
+            writer->len += tga_file_row( rows, dat, writer->buf + writer->len, rows->file_row );
+        }
+        return;
+    }
 
-    // write cmap spec.
-    fwrite( &zeroes, 5, 1, tga );
+    // fill the un-premultiply table up front, the threads share it
+    for( i = 0; i < 256; i++ ) {
+        tga_unpremul_row( &rows->enc, (ubyte)i );
+    }
 
-    // write image spec.
-    fwrite( &xorigin, 2, 1, tga );
-    fwrite( &yorigin, 2, 1, tga );
-    fwrite( &shortwidth, 2, 1, tga );
-    fwrite( &shortheight, 2, 1, tga );
-    fwrite( &pixdepth, 1, 1, tga );
-    fwrite( &img_desc, 1, 1, tga );
+    save.rows = rows;
+    save.stride = stride;
 
+    while( count > 0 ) {
 
-    // write image id.
-    fwrite( &id, idlen, 1, tga );
+        if( writer->size - writer->len < rows->row_worst ) {
+            tga_flush( writer );
+        }
 
-    // initial color values -- just to shut up the compiler.
-    nc = 0;
+        wave = (writer->size - writer->len) / rows->row_worst;
+        if( wave > count ) {
+            wave = count;
+        }
 
-    // color correction -- data is in RGB, need BGR.
-    // also run-length-encoding.
-    for( i = 0; i < size; i++ ) {
+        save.dat = dat;
+        save.out = writer->buf + writer->len;
+        TargaParallel( wave, rows->width * rows->format, tga_encode_band, &save );
 
-        idx = i * format;
+        end = save.out;
+        for( i = 0; i < wave; i++ ) {
+            slot = save.out + (size_t)i * rows->row_worst;
 
-        row = i / width;
-        column = i % width;
+            // a band that could not get scratch space left its rows
+            if( save.lens[i] == 0 ) {
+                save.lens[i] = tga_file_row( rows, dat + i * stride, slot, rows->file_row );
+            }
 
-        //printf( "row: %d, col: %d\n", row, column );
-        pixbuf = 0;
-        for( j = 0; j < format; j++ ) {
-            pixbuf += dat[idx+j] << (8 * j);
+            if( end != slot ) {
+                memmove( end, slot, save.lens[i] );
+            }
+            end += save.lens[i];
         }
+        writer->len += (uint32)(end - save.out);
 
-        switch( format ) {
+        dat += wave * stride;
+        count -= wave;
 
-        case TGA_TRUECOLOR_24:
+    }
 
-            pixbuf = ((pixbuf & 0xFF) << 16) + 
-                     (pixbuf & 0xFF00) + 
-                     ((pixbuf & 0xFF0000) >> 16);
+    free( save.lens );
 
-            pixbuf = htotl( pixbuf );
-            break;
+}
 
-        case TGA_TRUECOLOR_32:
 
-            /* need to un-premultiply alpha.. */
 
-            red     = (pixbuf & 0xFF) / 255.0f;
-            green   = ((pixbuf & 0xFF00) >> 8) / 255.0f;
-            blue    = ((pixbuf & 0xFF0000) >> 16) / 255.0f;
-            alpha   = ((pixbuf & 0xFF000000) >> 24) / 255.0f;
 
-            if( alpha > 0.0001 ) {
-                red /= alpha;
-                green /= alpha;
-                blue /= alpha;
-            }
+/* encodes rows [begin, end) of a wave into their slots; runs on any thread */
+static void tga_encode_band( void * context, int begin, int end ) {
 
-            /* clamp to 1.0f */
+    tga_parallel_save * save = (tga_parallel_save *)context;
+    tga_row_writer * rows = save->rows;
+    ubyte * scratch = NULL;
+    int i;
 
-            red = red > 1.0f ? 255.0f : red * 255.0f;
-            green = green > 1.0f ? 255.0f : green * 255.0f;
-            blue = blue > 1.0f ? 255.0f : blue * 255.0f;
-            alpha = alpha > 1.0f ? 255.0f : alpha * 255.0f;
+    if( rows->rle ) {
+        scratch = (ubyte *)malloc( rows->width * rows->format );
+    }
 
-            pixbuf = (ubyte)blue + (((ubyte)green) << 8) + 
-                (((ubyte)red) << 16) + (((ubyte)alpha) << 24);
-                
-            pixbuf = htotl( pixbuf );
-            break;
+    for( i = begin; i < end; i++ ) {
+        save->lens[i] = rows->rle && scratch == NULL ? 0 :
+                        tga_file_row( rows, save->dat + i * save->stride, 
+                                      save->out + (size_t)i * rows->row_worst, scratch );
+    }
 
-        }
+    free( scratch );
 
+}
 
-        oc = nc;
 
-        nc = pixbuf;
 
 
-        switch( state ) {
 
-        case INIT:
-            // this is just used to make sure we have 2 pixel values to consider.
-            state = NONE;
-            break;
+/*************************************************************************************************/
 
 
-        case NONE:
 
-            if( column == 0 ) {
-                // write a 1 pixel raw packet for the old pixel, then go thru again.
-                repcount = 0;
-                fwrite( &repcount, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
-                state = NONE;
-                break;
-            }
 
-            if( nc == oc ) {
-                repcount = 0;
-                state = RLP;
-            } else {
-                repcount = 0;
-                state = RAWP;
-                for( j = 0; j < format; j++ ) {
-#ifdef WORDS_BIGENDIAN
-                    rawbuf[(repcount * format) + j] = (ubyte)(*((&oc)+format-j-1));
-#else
-                    rawbuf[(repcount * format) + j] = *(((ubyte *)(&oc)) + j);
-#endif
-                }
-            }
-            break;
 
+/* row of an image buffer holding the given row of the file, counted from the bottom */
+static uint32 tga_mem_row( uint32 row, uint32 h ) {
 
-        case RLP:
-            repcount++;
+    if( TargaRowOrder == TGA_ROWS_TOP_DOWN ) {
+        return( h - 1 - row );
+    }
 
-            if( column == 0 ) {
-                // finish off rlp.
-                repcount |= 0x80;
-                fwrite( &repcount, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
-                state = NONE;
-                break;
-            }
+    return( row );
 
-            if( repcount == 127 ) {
-                // finish off rlp.
-                repcount |= 0x80;
-                fwrite( &repcount, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
-                state = NONE;
-                break;
-            }
+}
 
-            if( nc != oc ) {
-                // finish off rlp
-                repcount |= 0x80;
-                fwrite( &repcount, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
-                state = NONE;
-            }
-            break;
 
 
-        case RAWP:
-            repcount++;
 
-            if( column == 0 ) {
-                // finish off rawp.
-                for( j = 0; j < format; j++ ) {
-#ifdef WORDS_BIGENDIAN
-                    rawbuf[(repcount * format) + j] = (ubyte)(*((&oc)+format-j-1));
-#else
-                    rawbuf[(repcount * format) + j] = *(((ubyte *)(&oc)) + j);
-#endif
-                }
-                fwrite( &repcount, 1, 1, tga );
-                fwrite( rawbuf, (repcount + 1) * format, 1, tga );
-                state = NONE;
-                break;
-            }
+/* the image row that row i of the file, counted in file order, loads into */
+static uint32 tga_load_row( tga_row_reader * rows, uint32 i ) {
 
-            if( repcount == 127 ) {
-                // finish off rawp.
-                for( j = 0; j < format; j++ ) {
-#ifdef WORDS_BIGENDIAN
-                    rawbuf[(repcount * format) + j] = (ubyte)(*((&oc)+format-j-1));
-#else
-                    rawbuf[(repcount * format) + j] = *(((ubyte *)(&oc)) + j);
-#endif
-                }
-                fwrite( &repcount, 1, 1, tga );
-                fwrite( rawbuf, (repcount + 1) * format, 1, tga );
-                state = NONE;
-                break;
-            }
+    return( tga_mem_row( rows->top_first ? rows->height - 1 - i : i, rows->height ) );
 
-            if( nc == oc ) {
-                // finish off rawp
-                repcount--;
-                fwrite( &repcount, 1, 1, tga );
-                fwrite( rawbuf, (repcount + 1) * format, 1, tga );
-                
-                // start new rlp
-                repcount = 0;
-                state = RLP;
-                break;
-            }
+}
 
-            // continue making rawp
-            for( j = 0; j < format; j++ ) {
-#ifdef WORDS_BIGENDIAN
-                rawbuf[(repcount * format) + j] = (ubyte)(*((&oc)+format-j-1));
-#else
-                rawbuf[(repcount * format) + j] = *(((ubyte *)(&oc)) + j);
-#endif
-            }
 
-            break;
 
-        }
-       
 
+/* fetches the next row of file pixels and converts it into dat; uncompressed
+   rows are read straight from the mapping, and a short file leaves the rest null */
+static void tga_next_row( tga_row_reader * rows, tga_reader * reader, tga_packet * packet, 
+                         ubyte * scratch, ubyte * dat ) {
+
+    const ubyte * src;
+
+    if( rows->rle ) {
+        tga_read_rle_row( reader, packet, scratch, rows->width, rows->bytes_per_pix );
+        src = scratch;
+    } else {
+        src = tga_read_span( reader, scratch, rows->width * rows->bytes_per_pix );
     }
 
+    tga_decode_row( rows->decoder, src, dat, rows->width );
 
-    // clean up state.
+    if( rows->from_right ) {
+        tga_mirror_row( dat, rows->width, rows->format );
+    }
 
-    switch( state ) {
+}
 
-    case INIT:
-        break;
 
-    case NONE:
-        // write the last 2 pixels in a raw packet.
-        fwrite( &one, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&nc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &nc, format, 1, tga );
-#endif
-        break;
 
-    case RLP:
-        repcount++;
-        repcount |= 0x80;
-        fwrite( &repcount, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
-        break;
 
-    case RAWP:
-        repcount++;
-        for( j = 0; j < format; j++ ) {
-#ifdef WORDS_BIGENDIAN
-            rawbuf[(repcount * format) + j] = (ubyte)(*((&oc)+format-j-1));
-#else
-            rawbuf[(repcount * format) + j] = *(((ubyte *)(&oc)) + j);
-#endif
+/* loads all rows on several threads, when a parallel function is set and the
+   file is mapped: a scan pass finds where each row starts, reading only the
+   packet headers, then bands of rows are decoded apart.  returns 0, having
+   read nothing, if the load has to run in turn */
+static int tga_load_parallel( tga_row_reader * rows, ubyte * image_data ) {
+
+    tga_parallel_load load;
+    tga_row_mark * marks;
+    tga_reader reader;
+    tga_packet packet;
+    uint32 row_bytes = rows->width * rows->format;
+    uint32 a;
+    uint32 i;
+
+    if( TargaParallel == NULL || rows->reader.file != NULL || rows->height < 2 ) {
+        return( 0 );
+    }
+
+    // the skipped flags follow the marks
+    marks = (tga_row_mark *)malloc( rows->height * (sizeof( tga_row_mark ) + 1) );
+    if( marks == NULL ) {
+        return( 0 );
+    }
+
+    tga_index_rows( rows, marks );
+
+    // fill the premultiply table up front, the bands share it
+    for( a = 0; a < 256; a++ ) {
+        tga_premul_row( rows->decoder, (ubyte)a );
+    }
+
+    load.rows = rows;
+    load.marks = marks;
+    load.skipped = (ubyte *)(marks + rows->height);
+    load.image_data = image_data;
+    memset( load.skipped, 0, rows->height );
+    TargaParallel( rows->height, row_bytes, tga_decode_band, &load );
+
+    // a band that could not get scratch space left its rows
+    for( i = 0; i < rows->height; i++ ) {
+        if( load.skipped[i] ) {
+            reader = rows->reader;
+            reader.pos = marks[i].pos;
+            packet = marks[i].packet;
+            tga_next_row( rows, &reader, &packet, rows->src_row, image_data + (size_t)tga_load_row( rows, i ) * row_bytes );
         }
-        fwrite( &repcount, 1, 1, tga );
-        fwrite( rawbuf, (repcount + 1) * 3, 1, tga );
-        break;
+    }
+
+    rows->rows_read = rows->height;
+    free( marks );
+
+    return( 1 );
+
+}
+
+
+
+
+/* records where each row of the file starts, walking the run length packets
+   without expanding them.  offsets are clipped to the end of the file, so the
+   rows of a short file come out null as when read in turn */
+static void tga_index_rows( tga_row_reader * rows, tga_row_mark * marks ) {
+
+    const ubyte * buf = rows->reader.buf;
+    size_t len = rows->reader.len;
+    size_t pos = rows->reader.pos;
+    size_t bytes;
+    tga_packet packet = rows->packet;
+    uint32 bytes_per_pix = rows->bytes_per_pix;
+    uint32 row_bytes = rows->width * bytes_per_pix;
+    uint32 count;
+    uint32 n;
+    uint32 i;
 
+    for( i = 0; i < rows->height; i++ ) {
+
+        marks[i].pos = pos;
+        marks[i].packet = packet;
+
+        if( !rows->rle ) {
+            pos += len - pos < row_bytes ? len - pos : row_bytes;
+            continue;
+        }
+
+        for( count = rows->width; count > 0 && (packet.left > 0 || pos < len); count -= n ) {
+
+            if( packet.left == 0 ) {
+                packet.left = (buf[pos] & 0x7F) + 1;
+                packet.run = buf[pos] & 0x80;
+                pos++;
+
+                if( packet.run ) {
+                    bytes = len - pos < bytes_per_pix ? len - pos : bytes_per_pix;
+                    memcpy( packet.pix, buf + pos, bytes );
+                    memset( packet.pix + bytes, 0, bytes_per_pix - bytes );
+                    pos += bytes;
+                }
+            }
+
+            n = packet.left < count ? packet.left : count;
+
+            if( !packet.run ) {
+                bytes = (size_t)n * bytes_per_pix;
+                pos += len - pos < bytes ? len - pos : bytes;
+            }
+
+            packet.left -= n;
+
+        }
+
+    }
+
+}
+
+
+
+
+/* decodes rows [begin, end) of the file, counted in file order, from their
+   marks; runs on any thread, with its own reader and packet state.  without
+   scratch space it flags its rows as skipped for the caller to decode */
+static void tga_decode_band( void * context, int begin, int end ) {
+
+    tga_parallel_load * load = (tga_parallel_load *)context;
+    tga_row_reader * rows = load->rows;
+    tga_reader reader = rows->reader;
+    tga_packet packet = load->marks[begin].packet;
+    ubyte * scratch;
+    uint32 row_bytes = rows->width * rows->format;
+    int i;
+
+    reader.pos = load->marks[begin].pos;
+    scratch = (ubyte *)malloc( rows->width * rows->bytes_per_pix );
+
+    for( i = begin; i < end; i++ ) {
+        if( scratch == NULL ) {
+            load->skipped[i] = 1;
+            continue;
+        }
+        tga_next_row( rows, &reader, &packet, scratch, load->image_data + (size_t)tga_load_row( rows, i ) * row_bytes );
     }
 
+    free( scratch );
+
+}
+
+
+
+
+/* appends bytes to the output buffer, which must have room for them */
+static void tga_put( tga_writer * writer, const ubyte * src, uint32 count ) {
+
+    memcpy( writer->buf + writer->len, src, count );
+    writer->len += count;
+
+}
+
+
+
+
+/* writes out whatever the output buffer holds */
+static void tga_flush( tga_writer * writer ) {
+
+    if( writer->len > 0 && fwrite( writer->buf, 1, writer->len, writer->file ) != writer->len ) {
+        writer->failed = 1;
+    }
+
+    writer->len = 0;
+
+}
+
+
 
-    // close the file.
-    fclose( tga );
 
-    free( rawbuf );
+/* un-premultiplies every channel value by alpha a, filling the table row on first use */
+static const ubyte * tga_unpremul_row( tga_encoder * enc, ubyte a ) {
+
+    uint32 c;
+
+    if( !enc->unpremul_ready[a] ) {
+        for( c = 0; c < 256; c++ ) {
+            enc->unpremul[a][c] = tga_unpremultiply( (ubyte)c, a );
+        }
+        enc->unpremul_ready[a] = 1;
+    }
+
+    return( enc->unpremul[a] );
+
+}
+
+
+
+
+/* converts count pixels of RGB(A) at src to the BGR(A) of the file at dst */
+static void tga_encode_row( tga_encoder * enc, const ubyte * src, ubyte * dst, uint32 count ) {
+
+    const ubyte * lut;
+    const ubyte * alpha_lut;
+    uint32 i;
+
+    if( enc->format == TGA_TRUECOLOR_24 ) {
+
+        for( i = 0; i < count; i++, src += 3, dst += 3 ) {
+            dst[0] = src[2];
+            dst[1] = src[1];
+            dst[2] = src[0];
+        }
+
+    } else {
+
+        // alpha itself goes through the same rounding as the colors did
+        alpha_lut = tga_unpremul_row( enc, 0xFF );
+
+        for( i = 0; i < count; i++, src += 4, dst += 4 ) {
+            lut = tga_unpremul_row( enc, src[3] );
+            dst[0] = lut[src[2]];
+            dst[1] = lut[src[1]];
+            dst[2] = lut[src[0]];
+            dst[3] = alpha_lut[src[3]];
+        }
+
+    }
+
+}
+
+
+
+
+/* run length encodes one row of file pixels into dst, returns the bytes written.
+   Packets never cross rows. */
+static uint32 tga_pack_row( const ubyte * src, ubyte * dst, uint32 count, uint32 format ) {
+
+    ubyte * out = dst;
+    uint32 i = 0;
+    uint32 start;
+    uint32 run;
+
+    while( i < count ) {
+
+        // a run of two or more identical pixels makes a run packet
+        run = 1;
+        while( i + run < count && run < 128 && 
+               !memcmp( src + (i + run) * format, src + i * format, format ) ) {
+            run++;
+        }
+
+        if( run > 1 ) {
+            *out++ = (ubyte)(0x80 | (run - 1));
+            memcpy( out, src + i * format, format );
+            out += format;
+            i += run;
+            continue;
+        }
+
+        // otherwise raw pixels up to the next pair of identical ones
+        start = i++;
+        while( i < count && i - start < 128 && 
+               !(i + 1 < count && !memcmp( src + i * format, src + (i + 1) * format, format )) ) {
+            i++;
+        }
+
+        *out++ = (ubyte)(i - start - 1);
+        memcpy( out, src + start * format, (i - start) * format );
+        out += (i - start) * format;
+
+    }
+
+    return( (uint32)(out - dst) );
+
+}
+
+
+
+
+/* c un-premultiplied by a, both as bytes */
+static ubyte tga_unpremultiply( ubyte c, ubyte a ) {
+
+    float color = c / 255.0f;
+    float alpha = a / 255.0f;
+
+    if( alpha > 0.0001 ) {
+        color /= alpha;
+    }
+
+    /* clamp to 1.0f */
+    color = color > 1.0f ? 255.0f : color * 255.0f;
+
+    return( (ubyte)color );
+
+}
+
+
+
+
+/* opens a file for tga_read, mapping it if the system allows */
+static int tga_open_reader( tga_reader * reader, const char * filename ) {
+
+    memset( reader, 0, sizeof( tga_reader ) );
+
+    if( tga_map_file( reader, filename ) ) {
+        reader->buf = (const ubyte *)reader->map_base;
+        reader->len = reader->map_size;
+        return( 1 );
+    }
+
+    reader->file = fopen( filename, "rb" );
+    if( reader->file == NULL ) {
+        return( 0 );
+    }
+
+    reader->chunk = (ubyte *)malloc( TGA_READ_CHUNK );
+    if( reader->chunk == NULL ) {
+        fclose( reader->file );
+        return( 0 );
+    }
+    reader->buf = reader->chunk;
 
     return( 1 );
 
@@ -962,104 +1389,478 @@ int tga_write_rle( const char * file, int width, int height, unsigned char * dat
 
 
 
+/* releases the mapping or file and buffer of a reader */
+static void tga_close_reader( tga_reader * reader ) {
 
-/*************************************************************************************************/
+    if( reader->map_base != NULL ) {
+#ifdef _WIN32
+        UnmapViewOfFile( reader->map_base );
+#else
+        munmap( reader->map_base, reader->map_size );
+#endif
+    }
 
+    if( reader->file != NULL ) {
+        fclose( reader->file );
+    }
 
+    free( reader->chunk );
 
+}
 
 
-static void tga_write_pixel_to_mem( ubyte * dat, ubyte img_spec, uint32 number, 
-                                   uint32 w, uint32 h, uint32 pixel, uint32 format ) {
 
-    // write the pixel to the data regarding how the
-    // header says the data is ordered.
 
-    uint32 j;
-    uint32 x, y;
-    uint32 addy;
+/* maps a whole regular file read-only; 0 if it cannot be mapped */
+static int tga_map_file( tga_reader * reader, const char * filename ) {
 
-    switch( (img_spec & 0x30) >> 4 ) {
+#ifdef _WIN32
 
-    case TGA_LOWER_RIGHT:
-        x = w - 1 - (number % w);
-        y = number / h;
-        break;
+    HANDLE file;
+    HANDLE mapping;
+    LARGE_INTEGER size;
+    void * base;
 
-    case TGA_UPPER_LEFT:
-        x = number % w;
-        y = h - 1 - (number / w);
-        break;
+    file = CreateFileA( filename, GENERIC_READ, FILE_SHARE_READ, NULL, 
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+    if( file == INVALID_HANDLE_VALUE ) {
+        return( 0 );
+    }
 
-    case TGA_UPPER_RIGHT:
-        x = w - 1 - (number % w);
-        y = h - 1 - (number / w);
-        break;
+    if( !GetFileSizeEx( file, &size ) || size.QuadPart == 0 || 
+        (unsigned long long)size.QuadPart > (size_t)-1 ) {
+        CloseHandle( file );
+        return( 0 );
+    }
 
-    case TGA_LOWER_LEFT:
-    default:
-        x = number % w;
-        y = number / w;
-        break;
+    mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+    CloseHandle( file );
+    if( mapping == NULL ) {
+        return( 0 );
+    }
 
+    // the view keeps the mapping alive
+    base = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+    CloseHandle( mapping );
+    if( base == NULL ) {
+        return( 0 );
     }
 
-    addy = (y * w + x) * format;
-    for( j = 0; j < format; j++ ) {
-        dat[addy + j] = (ubyte)((pixel >> (j * 8)) & 0xFF);
+    reader->map_base = base;
+    reader->map_size = (size_t)size.QuadPart;
+
+    return( 1 );
+
+#else
+
+    int fd;
+    struct stat st;
+    void * base;
+
+    fd = open( filename, O_RDONLY );
+    if( fd < 0 ) {
+        return( 0 );
     }
-    
+
+    if( fstat( fd, &st ) != 0 || !S_ISREG( st.st_mode ) || st.st_size <= 0 || 
+        (unsigned long long)st.st_size > (size_t)-1 ) {
+        close( fd );
+        return( 0 );
+    }
+
+    base = mmap( NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if( base == MAP_FAILED ) {
+        return( 0 );
+    }
+
+    // the file is read once front to back
+    madvise( base, (size_t)st.st_size, MADV_SEQUENTIAL );
+
+    reader->map_base = base;
+    reader->map_size = (size_t)st.st_size;
+
+    return( 1 );
+
+#endif
+
 }
 
 
 
 
-static uint32 tga_get_pixel( FILE * tga, ubyte bytes_per_pix, 
-                            ubyte * colormap, ubyte cmap_bytes_entry ) {
-    
-    /* get the image data value out */
+/* copies the next count bytes of the file to dest, returns how many there were */
+static uint32 tga_read( tga_reader * reader, ubyte * dest, uint32 count ) {
+
+    uint32 done = 0;
+    uint32 n;
+
+    while( done < count ) {
+
+        if( reader->pos == reader->len ) {
+
+            // a mapping holds the whole file
+            if( reader->file == NULL ) {
+                break;
+            }
+
+            // big requests skip the buffer
+            if( count - done >= TGA_READ_CHUNK ) {
+                done += (uint32)fread( dest + done, 1, count - done, reader->file );
+                break;
+            }
+
+            reader->len = fread( reader->chunk, 1, TGA_READ_CHUNK, reader->file );
+            reader->pos = 0;
+            if( reader->len == 0 ) {
+                break;
+            }
+        }
+
+        n = count - done;
+        if( n > reader->len - reader->pos ) {
+            n = (uint32)(reader->len - reader->pos);
+        }
+
+        memcpy( dest + done, reader->buf + reader->pos, n );
+        reader->pos += n;
+        done += n;
+
+    }
+
+    return( done );
+
+}
+
+
+
+
+/* returns the next count bytes of the file, in place when the mapping or 
+   buffer holds them all, else copied to scratch with null bytes past the end */
+static const ubyte * tga_read_span( tga_reader * reader, ubyte * scratch, uint32 count ) {
+
+    const ubyte * span;
+    uint32 got;
+
+    if( reader->len - reader->pos >= count ) {
+        span = reader->buf + reader->pos;
+        reader->pos += count;
+        return( span );
+    }
+
+    got = tga_read( reader, scratch, count );
+    memset( scratch + got, 0, count - got );
 
-    uint32 tmp_col;
-    uint32 tmp_int32;
-    ubyte tmp_byte;
+    return( scratch );
 
+}
+
+
+
+
+/* expands run length packets into count file pixels at dest */
+static void tga_read_rle_row( tga_reader * reader, tga_packet * packet, ubyte * dest, 
+                             uint32 count, ubyte bytes_per_pix ) {
+
+    ubyte packet_header;
+    uint32 n;
+    uint32 got;
     uint32 j;
 
-    tmp_int32 = 0;
-    for( j = 0; j < bytes_per_pix; j++ ) {
-        if( fread( &tmp_byte, 1, 1, tga ) < 1 ) {
-            tmp_int32 = 0;
+    while( count > 0 ) {
+
+        if( packet->left == 0 ) {
+
+            if( tga_read( reader, &packet_header, 1 ) < 1 ) {
+                // well, just let them fill the rest with null pixels then...
+                memset( dest, 0, count * bytes_per_pix );
+                return;
+            }
+
+            packet->left = (packet_header & 0x7F) + 1;
+            packet->run = packet_header & 0x80;
+
+            if( packet->run ) {
+                got = tga_read( reader, packet->pix, bytes_per_pix );
+                memset( packet->pix + got, 0, bytes_per_pix - got );
+            }
+        }
+
+        n = packet->left < count ? packet->left : count;
+
+        if( packet->run ) {
+            for( j = 0; j < n; j++ ) {
+                memcpy( dest + j * bytes_per_pix, packet->pix, bytes_per_pix );
+            }
         } else {
-            tmp_int32 += tmp_byte << (j * 8);
+            got = tga_read( reader, dest, n * bytes_per_pix );
+            memset( dest + got, 0, n * bytes_per_pix - got );
         }
+
+        dest += n * bytes_per_pix;
+        count -= n;
+        packet->left -= n;
+
     }
-    
-    /* byte-order correct the thing */
-    switch( bytes_per_pix ) {
-        
-    case 2:
-        tmp_int32 = ttohs( (uint16)tmp_int32 );
-        break;
-        
-    case 3: /* intentional fall-thru */
-    case 4:
-        tmp_int32 = ttohl( tmp_int32 );
-        break;
-        
+
+}
+
+
+
+
+/* sets up the row conversion for an image, NULL if out of memory */
+static tga_decoder * tga_create_decoder( ubyte image_type, ubyte pix_depth, ubyte alphabits, uint32 format,
+                                        const ubyte * colormap, uint16 cmap_first, uint16 cmap_length,
+                                        ubyte cmap_entry_size, ubyte cmap_bytes_entry ) {
+
+    tga_decoder * dec;
+    uint32 i, j;
+    uint32 entry;
+    uint32 palette_length = colormap != NULL ? cmap_length : 0;
+
+    dec = (tga_decoder *)malloc( sizeof( tga_decoder ) + palette_length * sizeof( uint32 ) );
+    if( dec == NULL ) {
+        return( NULL );
     }
-    
+
+    dec->format = format;
+    dec->bits_per_pix = pix_depth;
+    dec->bytes_per_pix = (pix_depth + 7) >> 3;
+    if( dec->bytes_per_pix == 0 ) {
+        dec->bytes_per_pix = 1;
+    }
+    dec->alphabits = alphabits;
+    dec->palette_first = cmap_first;
+    dec->palette_length = palette_length;
+    dec->palette = (uint32 *)(dec + 1);
+    memset( dec->premul_ready, 0, sizeof( dec->premul_ready ) );
+
+    // same scale factors as tga_convert_color
+    for( i = 0; i < 32; i++ ) {
+        dec->expand5[i] = (ubyte)(((float)i) * 8.2258f);
+    }
+    for( i = 0; i < 64; i++ ) {
+        dec->expand6[i] = (ubyte)(((float)i) * 4.0476f);
+    }
+
     if( colormap != NULL ) {
-        /* need to look up value to get real color */
-        tmp_col = 0;
-        for( j = 0; j < cmap_bytes_entry; j++ ) {
-            tmp_col += colormap[cmap_bytes_entry * tmp_int32 + j] << (8 * j);
+
+        // convert every colormap entry once, rather than once per pixel
+        dec->kind = TGA_DECODE_PALETTED;
+        for( i = 0; i < palette_length; i++ ) {
+            entry = 0;
+            for( j = 0; j < cmap_bytes_entry; j++ ) {
+                entry += colormap[i * cmap_bytes_entry + j] << (j * 8);
+            }
+            dec->palette[i] = tga_convert_color( entry, cmap_entry_size, alphabits, format );
         }
+
+    } else if( image_type == TGA_IMG_UNC_GRAYSCALE || image_type == TGA_IMG_RLE_GRAYSCALE ) {
+
+        switch( pix_depth ) {
+        case 8:
+            dec->kind = TGA_DECODE_GRAY;
+            break;
+        case 16:
+            dec->kind = TGA_DECODE_GRAY_ALPHA;
+            break;
+        default:
+            dec->kind = TGA_DECODE_GENERIC;
+            break;
+        }
+
     } else {
-        tmp_col = tmp_int32;
+
+        switch( pix_depth ) {
+        case 32:
+            dec->kind = alphabits ? TGA_DECODE_BGRA : TGA_DECODE_BGRX;
+            break;
+        case 24:
+            dec->kind = TGA_DECODE_BGR;
+            break;
+        case 16:
+            dec->kind = alphabits == 1 ? TGA_DECODE_RGB555 : TGA_DECODE_RGB565;
+            break;
+        case 15:
+            dec->kind = TGA_DECODE_RGB555;
+            break;
+        default:
+            dec->kind = TGA_DECODE_GENERIC;
+            break;
+        }
+
     }
-    
-    return( tmp_col );
-    
+
+    return( dec );
+
+}
+
+
+
+
+/* premultiplies every channel value by alpha a, filling the table row on first use */
+static const ubyte * tga_premul_row( tga_decoder * dec, ubyte a ) {
+
+    uint32 c;
+
+    if( !dec->premul_ready[a] ) {
+        for( c = 0; c < 256; c++ ) {
+            dec->premul[a][c] = tga_premultiply( (ubyte)c, a );
+        }
+        dec->premul_ready[a] = 1;
+    }
+
+    return( dec->premul[a] );
+
+}
+
+
+
+
+/* converts count file pixels at src to premultiplied RGB(A) at dst */
+static void tga_decode_row( tga_decoder * dec, const ubyte * src, ubyte * dst, uint32 count ) {
+
+    const ubyte * lut;
+    uint32 out = dec->format;
+    uint32 in = dec->bytes_per_pix;
+    uint32 i, j;
+    uint32 value;
+    uint32 pixel;
+
+    switch( dec->kind ) {
+
+    case TGA_DECODE_BGRA:
+        for( i = 0; i < count; i++, src += 4, dst += out ) {
+            lut = tga_premul_row( dec, src[3] );
+            dst[0] = lut[src[2]];
+            dst[1] = lut[src[1]];
+            dst[2] = lut[src[0]];
+            if( out == 4 ) {
+                dst[3] = src[3];
+            }
+        }
+        break;
+
+    case TGA_DECODE_BGRX:
+    case TGA_DECODE_BGR:
+        lut = tga_premul_row( dec, 0xFF );
+        for( i = 0; i < count; i++, src += in, dst += out ) {
+            dst[0] = lut[src[2]];
+            dst[1] = lut[src[1]];
+            dst[2] = lut[src[0]];
+            if( out == 4 ) {
+                dst[3] = 0xFF;
+            }
+        }
+        break;
+
+    case TGA_DECODE_RGB565:
+        lut = tga_premul_row( dec, 0xFF );
+        for( i = 0; i < count; i++, src += 2, dst += out ) {
+            value = src[0] + (src[1] << 8);
+            dst[0] = lut[dec->expand5[(value >> 11) & 0x1F]];
+            dst[1] = lut[dec->expand6[(value >> 5) & 0x3F]];
+            dst[2] = lut[dec->expand5[value & 0x1F]];
+            if( out == 4 ) {
+                dst[3] = 0xFF;
+            }
+        }
+        break;
+
+    case TGA_DECODE_RGB555:
+        lut = tga_premul_row( dec, 0xFF );
+        for( i = 0; i < count; i++, src += 2, dst += out ) {
+            value = src[0] + (src[1] << 8);
+            dst[0] = lut[dec->expand5[(value >> 10) & 0x1F]];
+            dst[1] = lut[dec->expand5[(value >> 5) & 0x1F]];
+            dst[2] = lut[dec->expand5[value & 0x1F]];
+            if( out == 4 ) {
+                dst[3] = 0xFF;
+            }
+        }
+        break;
+
+    case TGA_DECODE_GRAY:
+        lut = tga_premul_row( dec, 0xFF );
+        for( i = 0; i < count; i++, src += 1, dst += out ) {
+            dst[0] = dst[1] = dst[2] = lut[src[0]];
+            if( out == 4 ) {
+                dst[3] = 0xFF;
+            }
+        }
+        break;
+
+    case TGA_DECODE_GRAY_ALPHA:
+        for( i = 0; i < count; i++, src += 2, dst += out ) {
+            lut = tga_premul_row( dec, dec->alphabits ? src[1] : 0xFF );
+            dst[0] = dst[1] = dst[2] = lut[src[0]];
+            if( out == 4 ) {
+                dst[3] = dec->alphabits ? src[1] : 0xFF;
+            }
+        }
+        break;
+
+    case TGA_DECODE_PALETTED:
+        for( i = 0; i < count; i++, src += in, dst += out ) {
+            value = 0;
+            for( j = 0; j < in; j++ ) {
+                value += src[j] << (j * 8);
+            }
+            // indices outside the colormap come out as null pixels
+            value -= dec->palette_first;
+            pixel = value < dec->palette_length ? dec->palette[value] : 0;
+            for( j = 0; j < out; j++ ) {
+                dst[j] = (ubyte)((pixel >> (j * 8)) & 0xFF);
+            }
+        }
+        break;
+
+    default:
+        for( i = 0; i < count; i++, src += in, dst += out ) {
+            value = 0;
+            for( j = 0; j < in; j++ ) {
+                value += src[j] << (j * 8);
+            }
+            pixel = tga_convert_color( value, dec->bits_per_pix, dec->alphabits, out );
+            for( j = 0; j < out; j++ ) {
+                dst[j] = (ubyte)((pixel >> (j * 8)) & 0xFF);
+            }
+        }
+        break;
+
+    }
+
+}
+
+
+
+
+/* reverses the order of the pixels in a row, for images stored right to left */
+static void tga_mirror_row( ubyte * row, uint32 count, uint32 format ) {
+
+    ubyte * left = row;
+    ubyte * right = row + (count - 1) * format;
+    ubyte tmp;
+    uint32 j;
+
+    while( left < right ) {
+        for( j = 0; j < format; j++ ) {
+            tmp = left[j];
+            left[j] = right[j];
+            right[j] = tmp;
+        }
+        left += format;
+        right -= format;
+    }
+
+}
+
+
+
+
+/* c premultiplied by a, both as bytes */
+static ubyte tga_premultiply( ubyte c, ubyte a ) {
+    return( (ubyte)(((float)c / 255.0f) * ((float)a / 255.0f) * 255.0f) );
 }
 
 
@@ -1120,9 +1921,9 @@ is_15_bit_in_disguise:
     a = (pixel & 0xFF000000) >> 24;
     
     // not premultiplied alpha -- multiply.
-    r = (ubyte)(((float)r / 255.0f) * ((float)a / 255.0f) * 255.0f);
-    g = (ubyte)(((float)g / 255.0f) * ((float)a / 255.0f) * 255.0f);
-    b = (ubyte)(((float)b / 255.0f) * ((float)a / 255.0f) * 255.0f);
+    r = tga_premultiply( r, a );
+    g = tga_premultiply( g, a );
+    b = tga_premultiply( b, a );
 
     pixel = r + (g << 8) + (b << 16) + (a << 24);
 
@@ -36,6 +36,14 @@
     16              <any of above>  <same as above> ..
     24              <any of above>  <same as above> ..
 
+
+    Grayscale images supported:
+
+    bits            components
+    --------------------------
+    8               gray
+    16              gray, alpha
+
 */
 
 
@@ -62,9 +70,16 @@
 
 /*
    Image data will start in the low-left corner
-   of the image.
+   of the image, unless tga_set_row_order asks
+   for the top row first.
 */
 
+#define TGA_ROWS_BOTTOM_UP    (0)
+#define TGA_ROWS_TOP_DOWN     (1)
+
+
+#include <stddef.h>
+
 
 #ifdef __cplusplus
 extern "C" {
@@ -76,6 +91,26 @@ int             tga_get_last_error();
 const char *    tga_error_string( int error_code );
 
 
+/* Memory for image buffers  --  defaults to malloc/free, NULL restores them.
+   Images from tga_create/tga_load must be freed with tga_free. */
+void tga_set_allocator( void * (*alloc_fn)( size_t bytes ), void (*free_fn)( void * ptr ) );
+void tga_free( void * data );
+
+
+/* Row order of image buffers passed to and returned from the library  --
+   TGA_ROWS_BOTTOM_UP (the default) or TGA_ROWS_TOP_DOWN.  Files are always
+   written bottom up. */
+void tga_set_row_order( int order );
+
+
+/* Running work on several threads  --  parallel_fn must call body( context,
+   begin, end ) over bands covering rows [0, rows) of row_length bytes each,
+   and return once all are done.  The loader uses it to decode bands of rows
+   at once.  NULL (the default) keeps everything on the calling thread. */
+typedef void (*tga_row_body)( void * context, int begin, int end );
+void tga_set_parallel( void (*parallel_fn)( int rows, int row_length, tga_row_body body, void * context ) );
+
+
 /* Creating/Loading images  --  a return of NULL indicates a fatal error */
 void * tga_create( int width, int height, unsigned int format );
 void * tga_load( const char * file, int * width, int * height, unsigned int format );
@@ -86,6 +121,23 @@ int tga_write_raw( const char * file, int width, int height, unsigned char * dat
 int tga_write_rle( const char * file, int width, int height, unsigned char * dat, unsigned int format );
 
 
+/* Reading and writing a row at a time, for images too large to hold whole.
+   Rows go in file order: top row first if top_first, else bottom row first.
+   tga_open_rows returns NULL on error; tga_read_rows returns the number of rows
+   read; tga_write_rows and tga_finish_rows return 1 on success, 0 on error.
+   Written files are run length encoded if rle is non-zero. */
+typedef struct tga_row_reader tga_row_reader;
+typedef struct tga_row_writer tga_row_writer;
+
+tga_row_reader * tga_open_rows( const char * file, int * width, int * height, int * top_first, unsigned int format );
+int tga_read_rows( tga_row_reader * rows, unsigned char * dat, int count );
+void tga_close_rows( tga_row_reader * rows );
+
+tga_row_writer * tga_create_rows( const char * file, int width, int height, int top_first, unsigned int format, int rle );
+int tga_write_rows( tga_row_writer * rows, const unsigned char * dat, int count );
+int tga_finish_rows( tga_row_writer * rows );
+
+
 #ifdef __cplusplus
 }
 #endif